@@ -0,0 +1,63 @@
+#include "logbuf.h"
+#include "lolserial.h"
+#include "imports.h"
+
+// must be a power of two
+#define LOGBUF_SIZE 0x2000
+
+static char logBuffer[LOGBUF_SIZE];
+// only ever advanced by the producers
+static volatile uint32_t logWritePos;
+// only ever advanced by the consumer
+static volatile uint32_t logReadPos;
+static volatile int logConsumerAttached;
+
+void logbuf_write(const char* str, int len)
+{
+    if (!logConsumerAttached) {
+        // nobody drains the buffer yet, so write straight to the serial port
+        lolserial_lprint(str, len);
+        return;
+    }
+
+    // IRQs are already masked when called from the svc handler, this only guards
+    // against the kernel thread itself being preempted while copying a few bytes
+    // (there is no ldrex/strex on the arm926)
+    int level = disable_interrupts();
+
+    uint32_t pos = logWritePos;
+    uint32_t avail = LOGBUF_SIZE - (pos - logReadPos);
+
+    // loop until null terminator or string end, drop whatever doesn't fit
+    for (const char *end = str + len; *str && (str != end) && avail; str++, avail--) {
+        logBuffer[pos++ & (LOGBUF_SIZE - 1)] = *str;
+    }
+
+    logWritePos = pos;
+
+    enable_interrupts(level);
+}
+
+void logbuf_print(const char* str)
+{
+    logbuf_write(str, -1);
+}
+
+int logbuf_read(void* dst, uint32_t size)
+{
+    logConsumerAttached = 1;
+
+    uint32_t pos = logReadPos;
+    uint32_t avail = logWritePos - pos;
+    if (size > avail) {
+        size = avail;
+    }
+
+    for (uint32_t i = 0; i < size; i++) {
+        ((char*) dst)[i] = logBuffer[pos++ & (LOGBUF_SIZE - 1)];
+    }
+
+    logReadPos = pos;
+
+    return size;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+void logbuf_write(const char* str, int len);
+
+void logbuf_print(const char* str);
+
+int logbuf_read(void* dst, uint32_t size);
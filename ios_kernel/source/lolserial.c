@@ -1,4 +1,5 @@
 #include "lolserial.h"
+#include "logbuf.h"
 #include "imports.h"
 #include <stdio.h>
 #include <stdarg.h>
@@ -29,6 +30,9 @@ void lolserial_lprint(const char *str, int len)
 
     /* loop until null terminator or string end */
     for (const char *end = str + len; *str && (str != end); str++) {
+        /* only keep interrupts disabled for a single character to keep the bit timing intact */
+        int level = disable_interrupts();
+
         for (uint32_t bits = 0x200 | (*str << 1); bits; bits >>= 1) {
             /* set bit value */
             *(volatile uint32_t*) LT_GPIO_OUT = ((*(volatile uint32_t*) LT_GPIO_OUT) & ~LOLSERIAL_PIN) | ((bits & 1) ? LOLSERIAL_PIN : 0);
@@ -38,6 +42,8 @@ void lolserial_lprint(const char *str, int len)
             for (; then < now; now = *(volatile uint32_t*) LT_TIMER); /* wait overflow */
             for (; now < then; now = *(volatile uint32_t*) LT_TIMER); /* wait */
         }
+
+        enable_interrupts(level);
     }
 }
 
@@ -48,17 +54,13 @@ void lolserial_print(const char *str)
 
 void lolserial_printf(const char* format, ...)
 {
-    int level = disable_interrupts();
-
     va_list args;
     va_start(args, format);
 
     char buffer[0x100];
 
     int len = vsnprintf(buffer, sizeof(buffer), format, args);
-    lolserial_lprint(buffer, len);
+    logbuf_write(buffer, len);
 
     va_end(args);
-
-    enable_interrupts(level);
 }
@@ -1,6 +1,8 @@
 #include "imports.h"
 #include "thread.h"
 #include "lolserial.h"
+#include "logbuf.h"
+#include "profiler.h"
 #include "bsp.h"
 #include "../../ios_mcp/ios_mcp_syms.h"
 
@@ -13,6 +15,12 @@ extern uint32_t domainAccessPermissions[];
 
 int kernel_syscall_0x81(int type, uint32_t address, uint32_t value)
 {
+    if (type == 3) { // serialWrite
+        // lolserial only masks interrupts per character, so don't disable them here
+        lolserial_lprint((const char*) address, value);
+        return value;
+    }
+
     int res = 0;
     int level = disable_interrupts();
     set_domain_register(domainAccessPermissions[0]); // 0 = KERNEL
@@ -21,7 +29,16 @@ int kernel_syscall_0x81(int type, uint32_t address, uint32_t value)
         res = *(volatile uint32_t*) address;
     } else if (type == 1) { // kernWrite32
         *(volatile uint32_t*) address = value;
+    } else if (type == 2) { // readLog
+        res = logbuf_read((void*) address, value);
     }
+#ifdef PROFILER
+    else if (type == 4) { // profilerControl
+        res = profiler_control(value);
+    } else if (type == 5) { // profilerRead
+        res = profiler_read((void*) address, value);
+    }
+#endif /* PROFILER */
 
     set_domain_register(domainAccessPermissions[currentThreadContext->pid]);
     enable_interrupts(level);
@@ -31,13 +48,15 @@ int kernel_syscall_0x81(int type, uint32_t address, uint32_t value)
 
 int _main(void* arg)
 {
+    // clear kernel bss before anything uses the log buffer
+    memset(&__kernel_bss_start, 0, &__kernel_bss_end - &__kernel_bss_start);
+
     lolserial_printf("Hello world from recovery_menu. Running from '%s'.\n", arg);
 
     int level = disable_interrupts();
     uint32_t control_register = disable_mmu();
 
-    // clear all bss
-    memset(&__kernel_bss_start, 0, &__kernel_bss_end - &__kernel_bss_start);
+    // clear mcp bss
     memset((void*) (__mcp_bss_start - 0x05074000 + 0x08234000), 0, __mcp_bss_end - __mcp_bss_start);
 
     // map the mcp sections
@@ -60,7 +79,7 @@ int _main(void* arg)
     map_info.cached = 0xffffffff;
     _iosMapSharedUserExecution(&map_info);
 
-    // redirect __sys_write0 to lolserial
+    // redirect __sys_write0 to the log buffer
     *(volatile uint32_t*) 0x0812dd68 = ARM_B(0x0812dd68, (uint32_t) &svcAB_handler);
 
 #ifdef MCP_RECOVERY
@@ -71,6 +90,11 @@ int _main(void* arg)
     *(volatile uint32_t*) (0x05025242 - 0x05000000 + 0x081c0000) = THUMB_BL(0x05025242, _MCP_ioctl100_patch);
 #endif /* MCP_RECOVERY */
 
+#ifdef PROFILER
+    // hook the irq vector for pc sampling
+    profiler_init();
+#endif /* PROFILER */
+
     // replace custom kernel syscall
     *(volatile uint32_t*) 0x0812cd2c = ARM_B(0x0812cd2c, kernel_syscall_0x81);
     
@@ -0,0 +1,156 @@
+#include "profiler.h"
+
+#ifdef PROFILER
+
+#include "imports.h"
+#include "thread.h"
+
+#define LT_REG_BASE                   (0x0d800000)
+#define LT_INTSR_AHBALL_ARM           (LT_REG_BASE + 0x470)
+#define LT_INTMR_AHBALL_ARM           (LT_REG_BASE + 0x474)
+
+#define IRQ_TIMER                     (1 << 0)
+
+// only threads of this process get sampled
+#define PROFILER_PID 1 // MCP
+
+// must be a power of two
+#define PROFILER_SAMPLE_COUNT 1024
+
+#define PROFILER_FLAG_PRIVILEGED      (1 << 15)
+
+typedef struct {
+    uint32_t pc;
+    uint16_t flags;
+    uint16_t threadId;
+} ProfilerSample;
+static_assert(sizeof(ProfilerSample) == 8, "ProfilerSample: different size than expected");
+
+extern uint32_t domainAccessPermissions[];
+
+static ProfilerSample samples[PROFILER_SAMPLE_COUNT];
+// only ever advanced by the irq handler
+static volatile uint32_t sampleWritePos;
+// only ever advanced by the consumer
+static volatile uint32_t sampleReadPos;
+static volatile uint32_t sampleInterval;
+static volatile uint32_t sampleTicks;
+static volatile uint32_t samplesDropped;
+
+// the handler the irq vector pointed to before
+__attribute__((used)) uint32_t profilerOrigIrqHandler;
+
+static inline uint32_t get_domain_register(void)
+{
+    uint32_t domain_register;
+    asm volatile("MRC p15, 0, %0, c3, c0, 0" : "=r"(domain_register));
+    return domain_register;
+}
+
+__attribute__((used)) void profiler_sample(uint32_t pc, uint32_t spsr)
+{
+    if (!sampleInterval) {
+        return;
+    }
+
+    // all other interrupt sources are not periodic and would skew the samples
+    if (!(*(volatile uint32_t*) LT_INTSR_AHBALL_ARM & *(volatile uint32_t*) LT_INTMR_AHBALL_ARM & IRQ_TIMER)) {
+        return;
+    }
+
+    if (++sampleTicks < sampleInterval) {
+        return;
+    }
+    sampleTicks = 0;
+
+    ThreadContext_t* ctx = currentThreadContext;
+    if (!ctx || ctx->pid != PROFILER_PID) {
+        return;
+    }
+
+    // the domain register still belongs to the interrupted process
+    uint32_t domain = get_domain_register();
+    set_domain_register(domainAccessPermissions[0]); // 0 = KERNEL
+
+    uint32_t pos = sampleWritePos;
+    if (pos - sampleReadPos < PROFILER_SAMPLE_COUNT) {
+        ProfilerSample* sample = &samples[pos & (PROFILER_SAMPLE_COUNT - 1)];
+        sample->pc = pc;
+        // anything but usr mode means the thread was inside a syscall or an exception
+        sample->flags = ((spsr & 0x1f) != 0x10) ? PROFILER_FLAG_PRIVILEGED : 0;
+        sample->threadId = ctx->id;
+        sampleWritePos = pos + 1;
+    } else {
+        samplesDropped++;
+    }
+
+    set_domain_register(domain);
+}
+
+// runs in irq mode before the original handler and preserves all registers,
+// the extra slot on the stack gets the original handler address to return into it
+__attribute__((naked)) static void profiler_irq_handler(void)
+{
+    asm volatile(
+        "sub sp, sp, #4\n"
+        "stmfd sp!, {r0-r4, r12, lr}\n"
+        "sub r0, lr, #4\n"
+        "mrs r1, spsr\n"
+        "bl profiler_sample\n"
+        "ldr r0, =profilerOrigIrqHandler\n"
+        "ldr r0, [r0]\n"
+        "str r0, [sp, #28]\n"
+        "ldmfd sp!, {r0-r4, r12, lr, pc}\n"
+        ".ltorg\n"
+    );
+}
+
+void profiler_init(void)
+{
+    // the irq vector is a "ldr pc, [pc, #imm]", replace the address it loads
+    uint32_t vector = *(volatile uint32_t*) 0xffff0018;
+    if ((vector & 0xfffff000) != 0xe59ff000) {
+        return;
+    }
+
+    volatile uint32_t* literal = (volatile uint32_t*) (0xffff0018 + 8 + (vector & 0xfff));
+    profilerOrigIrqHandler = *literal;
+    *literal = (uint32_t) &profiler_irq_handler;
+}
+
+int profiler_control(uint32_t interval)
+{
+    if (!profilerOrigIrqHandler) {
+        return -1;
+    }
+
+    int dropped = samplesDropped;
+
+    if (interval) {
+        sampleWritePos = sampleReadPos = 0;
+        sampleTicks = 0;
+        samplesDropped = 0;
+    }
+    sampleInterval = interval;
+
+    return dropped;
+}
+
+int profiler_read(void* dst, uint32_t size)
+{
+    uint32_t pos = sampleReadPos;
+    uint32_t count = sampleWritePos - pos;
+    if (count > size / sizeof(ProfilerSample)) {
+        count = size / sizeof(ProfilerSample);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        ((ProfilerSample*) dst)[i] = samples[pos++ & (PROFILER_SAMPLE_COUNT - 1)];
+    }
+
+    sampleReadPos = pos;
+
+    return count * sizeof(ProfilerSample);
+}
+
+#endif /* PROFILER */
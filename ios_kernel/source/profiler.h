@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef PROFILER
+
+// hook the irq vector, sampling starts once an interval is set
+void profiler_init(void);
+
+// set the sampling interval in timer interrupts, 0 stops sampling
+// returns the amount of samples dropped since the last start
+int profiler_control(uint32_t interval);
+
+int profiler_read(void* dst, uint32_t size);
+
+#endif /* PROFILER */
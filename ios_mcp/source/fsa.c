@@ -3,6 +3,7 @@
 #include <string.h>
 #include "imports.h"
 #include "fsa.h"
+#include "trace.h"
 
 static void* allocIobuf()
 {
@@ -172,7 +173,9 @@ int FSA_OpenFile(int fd, const char* path, const char* mode, int* outHandle)
     strncpy((char*)&inbuf[0x01], path, 0x27F);
     strncpy((char*)&inbuf[0xA1], mode, 0x10);
 
+    TRACE_BEGIN(TRACE_TAG_FSA_OPEN_FILE, 0, 0);
     int ret = IOS_Ioctl(fd, 0x0E, inbuf, 0x520, outbuf, 0x293);
+    TRACE_END(TRACE_TAG_FSA_OPEN_FILE, ret, outbuf[1]);
 
     if(outHandle) *outHandle = outbuf[1];
 
@@ -203,10 +206,14 @@ int _FSA_ReadWriteFile(int fd, void* data, uint32_t size, uint32_t cnt, int file
     iovec[2].ptr = outbuf;
     iovec[2].len = 0x293;
 
+    TRACE_BEGIN(read ? TRACE_TAG_FSA_READ_FILE : TRACE_TAG_FSA_WRITE_FILE, fileHandle, size * cnt);
+
     int ret;
     if(read) ret = IOS_Ioctlv(fd, 0x0F, 1, 2, iovec);
     else ret = IOS_Ioctlv(fd, 0x10, 2, 1, iovec);
 
+    TRACE_END(read ? TRACE_TAG_FSA_READ_FILE : TRACE_TAG_FSA_WRITE_FILE, fileHandle, ret);
+
     freeIobuf(iobuf);
     return ret;
 }
@@ -245,7 +252,9 @@ int FSA_CloseFile(int fd, int fileHandle)
 
     inbuf[1] = fileHandle;
 
+    TRACE_BEGIN(TRACE_TAG_FSA_CLOSE_FILE, fileHandle, 0);
     int ret = IOS_Ioctl(fd, 0x15, inbuf, 0x520, outbuf, 0x293);
+    TRACE_END(TRACE_TAG_FSA_CLOSE_FILE, fileHandle, ret);
 
     freeIobuf(iobuf);
     return ret;
@@ -413,7 +422,9 @@ int FSA_RawRead(int fd, void* data, uint32_t size_bytes, uint32_t cnt, uint64_t
     iovec[2].ptr = outbuf;
     iovec[2].len = 0x293;
 
+    TRACE_BEGIN(TRACE_TAG_FSA_RAW_READ, (uint32_t) blocks_offset, size_bytes * cnt);
     int ret = IOS_Ioctlv(fd, 0x6B, 1, 2, iovec);
+    TRACE_END(TRACE_TAG_FSA_RAW_READ, (uint32_t) blocks_offset, ret);
 
     freeIobuf(iobuf);
     return ret;
@@ -443,7 +454,9 @@ int FSA_RawWrite(int fd, void* data, uint32_t size_bytes, uint32_t cnt, uint64_t
     iovec[2].ptr = outbuf;
     iovec[2].len = 0x293;
 
+    TRACE_BEGIN(TRACE_TAG_FSA_RAW_WRITE, (uint32_t) blocks_offset, size_bytes * cnt);
     int ret = IOS_Ioctlv(fd, 0x6C, 2, 1, iovec);
+    TRACE_END(TRACE_TAG_FSA_RAW_WRITE, (uint32_t) blocks_offset, ret);
 
     freeIobuf(iobuf);
     return ret;
@@ -1,5 +1,6 @@
 #include "gfx.h"
 #include "imports.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <stdarg.h>
@@ -71,6 +72,8 @@ void gfx_init(void* fb, uint32_t w, uint32_t h)
 
 void gfx_clear(uint32_t col)
 {
+    TRACE_BEGIN(TRACE_TAG_GFX_CLEAR, col, 0);
+
 #if defined(DC_INIT) || defined(MCP_RECOVERY)
     // both DC configurations use XRGB instead of RGBX
     col >>= 8;
@@ -89,6 +92,8 @@ void gfx_clear(uint32_t col)
         DRC_FRAMEBUFFER[i] = col;
     }
 #endif /* MCP_RECOVERY */
+
+    TRACE_END(TRACE_TAG_GFX_CLEAR, col, 0);
 }
 
 void gfx_draw_pixel(uint32_t x, uint32_t y, uint32_t col)
@@ -126,6 +131,8 @@ void gfx_draw_pixel(uint32_t x, uint32_t y, uint32_t col)
 
 void gfx_draw_rect_filled(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t col)
 {
+    TRACE_BEGIN(TRACE_TAG_GFX_RECT, (x << 16) | y, (w << 16) | h);
+
 #if defined(DC_INIT) || defined(MCP_RECOVERY)
     // both DC configurations use XRGB instead of RGBX
     col >>= 8;
@@ -166,6 +173,8 @@ void gfx_draw_rect_filled(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32
         p += stride_diff;
     }
 #endif /* MCP_RECOVERY */
+
+    TRACE_END(TRACE_TAG_GFX_RECT, (x << 16) | y, (w << 16) | h);
 }
 
 void gfx_draw_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t borderSize, uint32_t col)
@@ -266,6 +275,8 @@ uint32_t gfx_print(uint32_t x, uint32_t y, uint32_t gfxPrintFlags, const char* s
 {
     const uint32_t orig_x = x;
 
+    TRACE_BEGIN(TRACE_TAG_GFX_PRINT, (x << 16) | y, gfxPrintFlags);
+
     if (gfxPrintFlags & GfxPrintFlag_AlignRight) {
         x -= gfx_get_text_width(str);
     }
@@ -293,6 +304,8 @@ uint32_t gfx_print(uint32_t x, uint32_t y, uint32_t gfxPrintFlags, const char* s
         x += CHAR_SIZE_DRC_X;
     }
 
+    TRACE_END(TRACE_TAG_GFX_PRINT, (x << 16) | y, gfxPrintFlags);
+
     return y;
 }
 
@@ -0,0 +1,386 @@
+#include <string.h>
+#include "imports.h"
+#include "menu.h"
+#include "httpclient.h"
+
+/*
+ * HTTP/1.1 client. Requests are sent one at a time, the connection is reused for the next request
+ * unless the server asks to close it or the body of the response ends with the connection.
+ * Header lines have to fit into the buffer, bodies are passed on in pieces as they arrive,
+ * the buffer is filled with recvv() whenever it's empty so large bodies aren't copied.
+ */
+
+// in milliseconds
+#define HTTP_CLIENT_TIMEOUT 10000
+
+static char toLower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (c - 'A' + 'a') : c;
+}
+
+// case-insensitive check if str starts with prefix, returns the rest of str without leading spaces or NULL
+static const char* matchPrefix(const char* str, const char* prefix)
+{
+    while (*prefix) {
+        if (toLower(*str++) != *prefix++) {
+            return NULL;
+        }
+    }
+
+    while (*str == ' ' || *str == '\t') {
+        str++;
+    }
+    return str;
+}
+
+static int parseNumber(const char* str, uint32_t base, uint32_t* out)
+{
+    uint32_t number = 0;
+    const char* start = str;
+    for (;; str++) {
+        char c = toLower(*str);
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else {
+            break;
+        }
+
+        if (digit >= base || number > (0xffffffffu - digit) / base) {
+            return -1;
+        }
+        number = number * base + digit;
+    }
+
+    if (str == start) {
+        return -1;
+    }
+
+    *out = number;
+    return 0;
+}
+
+static void disconnect(HttpClient* client)
+{
+    if (client->socket >= 0) {
+        closesocket(client->socket);
+        client->socket = -1;
+    }
+
+    client->start = client->end = 0;
+}
+
+// receive more data after the data which wasn't consumed yet
+static int fill(HttpClient* client)
+{
+    if (client->start == client->end) {
+        client->start = client->end = 0;
+    } else if (client->start) {
+        memmove(client->buffer, client->buffer + client->start, client->end - client->start);
+        client->end -= client->start;
+        client->start = 0;
+    }
+
+    if (client->end == HTTP_CLIENT_BUFFER_SIZE) {
+        // a header line longer than the buffer
+        return HTTP_CLIENT_ERROR_RESPONSE;
+    }
+
+    struct pollfd pfd = { client->socket, POLLIN, 0 };
+    int ret = poll(&pfd, 1, HTTP_CLIENT_TIMEOUT);
+    if (ret <= 0) {
+        return (ret == 0) ? HTTP_CLIENT_ERROR_TIMEOUT : HTTP_CLIENT_ERROR_SOCKET;
+    }
+
+    if (client->end == 0) {
+        const struct iovec iov = { client->buffer, HTTP_CLIENT_BUFFER_SIZE };
+        ret = recvv(client->socket, &iov, 1, 0);
+    } else {
+        ret = recv(client->socket, client->buffer + client->end, HTTP_CLIENT_BUFFER_SIZE - client->end, 0);
+    }
+
+    if (ret <= 0) {
+        return (ret == 0) ? HTTP_CLIENT_ERROR_CLOSED : HTTP_CLIENT_ERROR_SOCKET;
+    }
+
+    client->end += ret;
+    return ret;
+}
+
+// get the next line without its line break, it stays valid until the next call
+static int readLine(HttpClient* client, char** line)
+{
+    uint32_t pos = client->start;
+    while (1) {
+        for (; pos < client->end; pos++) {
+            if (client->buffer[pos] != '\n') {
+                continue;
+            }
+
+            uint32_t lineEnd = pos;
+            if (lineEnd > client->start && client->buffer[lineEnd - 1] == '\r') {
+                lineEnd--;
+            }
+            client->buffer[lineEnd] = '\0';
+
+            *line = (char*) client->buffer + client->start;
+            client->start = pos + 1;
+            return 0;
+        }
+
+        // fill() moves the unconsumed data to the start of the buffer
+        uint32_t scanned = pos - client->start;
+        int ret = fill(client);
+        if (ret < 0) {
+            return ret;
+        }
+        pos = client->start + scanned;
+    }
+}
+
+// pass length bytes of the body on, HTTP_CLIENT_UNKNOWN_LENGTH reads until the connection is closed
+static int receiveBody(HttpClient* client, HttpResponse* response, uint32_t length)
+{
+    while (length) {
+        if (client->start == client->end) {
+            int ret = fill(client);
+            if (ret < 0) {
+                return (ret == HTTP_CLIENT_ERROR_CLOSED && length == HTTP_CLIENT_UNKNOWN_LENGTH) ? 0 : ret;
+            }
+        }
+
+        uint32_t size = client->end - client->start;
+        if (size > length) {
+            size = length;
+        }
+
+        if (response->body && response->body(response, client->buffer + client->start, size) < 0) {
+            return HTTP_CLIENT_ERROR_ABORTED;
+        }
+
+        client->start += size;
+        if (length != HTTP_CLIENT_UNKNOWN_LENGTH) {
+            length -= size;
+        }
+    }
+
+    return 0;
+}
+
+static int receiveChunkedBody(HttpClient* client, HttpResponse* response)
+{
+    char* line;
+    while (1) {
+        uint32_t size;
+        int ret = readLine(client, &line);
+        if (ret < 0) {
+            return ret;
+        }
+        // the size can be followed by extensions, which are ignored
+        if (parseNumber(line, 16, &size) < 0) {
+            return HTTP_CLIENT_ERROR_RESPONSE;
+        }
+
+        if (size == 0) {
+            break;
+        }
+
+        ret = receiveBody(client, response, size);
+        if (ret < 0) {
+            return ret;
+        }
+
+        ret = readLine(client, &line);
+        if (ret < 0) {
+            return ret;
+        }
+        if (*line) {
+            return HTTP_CLIENT_ERROR_RESPONSE;
+        }
+    }
+
+    // skip the trailer
+    do {
+        int ret = readLine(client, &line);
+        if (ret < 0) {
+            return ret;
+        }
+    } while (*line);
+
+    return 0;
+}
+
+static int receiveResponse(HttpClient* client, const char* method, HttpResponse* response, int* keepAlive)
+{
+    char* line;
+    int chunked;
+    do {
+        int ret = readLine(client, &line);
+        if (ret < 0) {
+            return ret;
+        }
+
+        // "HTTP/1.1 200 OK"
+        if (strncmp(line, "HTTP/1.", 7) != 0 || line[8] != ' '
+            || line[9] < '1' || line[9] > '5' || line[10] < '0' || line[10] > '9' || line[11] < '0' || line[11] > '9') {
+            return HTTP_CLIENT_ERROR_RESPONSE;
+        }
+
+        response->status = (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+        strncpy(response->statusLine, line + 9, sizeof(response->statusLine) - 1);
+        response->statusLine[sizeof(response->statusLine) - 1] = '\0';
+        response->contentLength = HTTP_CLIENT_UNKNOWN_LENGTH;
+        *keepAlive = (line[7] != '0');
+        chunked = 0;
+
+        while (1) {
+            ret = readLine(client, &line);
+            if (ret < 0) {
+                return ret;
+            }
+            if (!*line) {
+                break;
+            }
+
+            const char* value;
+            if ((value = matchPrefix(line, "content-length:"))) {
+                if (parseNumber(value, 10, &response->contentLength) < 0) {
+                    return HTTP_CLIENT_ERROR_RESPONSE;
+                }
+            } else if ((value = matchPrefix(line, "transfer-encoding:"))) {
+                chunked = (matchPrefix(value, "chunked") != NULL);
+            } else if ((value = matchPrefix(line, "connection:"))) {
+                if (matchPrefix(value, "close")) {
+                    *keepAlive = 0;
+                } else if (matchPrefix(value, "keep-alive")) {
+                    *keepAlive = 1;
+                }
+            }
+        }
+        // interim responses like "100 Continue" are followed by the actual response
+    } while (response->status < 200);
+
+    // responses to HEAD requests, 204 and 304 never have a body
+    if (method[0] == 'H' || response->status == 204 || response->status == 304) {
+        response->contentLength = 0;
+        return 0;
+    }
+
+    if (chunked) {
+        response->contentLength = HTTP_CLIENT_UNKNOWN_LENGTH;
+        return receiveChunkedBody(client, response);
+    }
+
+    if (response->contentLength == HTTP_CLIENT_UNKNOWN_LENGTH) {
+        *keepAlive = 0;
+    }
+    return receiveBody(client, response, response->contentLength);
+}
+
+static int sendRequest(HttpClient* client, const char* method, const char* path, const char* headers, const struct iovec* body)
+{
+    char* buffer = (char*) client->buffer;
+    uint32_t length = snprintf(buffer, HTTP_CLIENT_BUFFER_SIZE,
+        "%s %s HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "User-Agent: Wii U Recovery Menu/" VERSION_STRING "\r\n"
+        "%s", method, path, client->host, headers ? headers : "");
+    if (body && length < HTTP_CLIENT_BUFFER_SIZE) {
+        length += snprintf(buffer + length, HTTP_CLIENT_BUFFER_SIZE - length, "Content-Length: %lu\r\n", (uint32_t) body->iov_len);
+    }
+    if (length + 2 >= HTTP_CLIENT_BUFFER_SIZE) {
+        return HTTP_CLIENT_ERROR_MEMORY;
+    }
+    memcpy(buffer + length, "\r\n", 2);
+    length += 2;
+
+    // the header and the body go out together, without copying the body
+    struct iovec iov[2] = {
+        { buffer, length },
+        { body ? body->iov_base : NULL, body ? body->iov_len : 0 },
+    };
+    struct iovec* vec = iov;
+    int count = body ? 2 : 1;
+    while (count) {
+        int ret = sendv(client->socket, vec, count, 0);
+        if (ret <= 0) {
+            return HTTP_CLIENT_ERROR_SOCKET;
+        }
+
+        while (count && (uint32_t) ret >= vec->iov_len) {
+            ret -= vec->iov_len;
+            vec++;
+            count--;
+        }
+        if (count) {
+            vec->iov_base = (uint8_t*) vec->iov_base + ret;
+            vec->iov_len -= ret;
+        }
+    }
+
+    return 0;
+}
+
+int httpclient_init(HttpClient* client, uint32_t address, uint16_t port, const char* host)
+{
+    memset(client, 0, sizeof(*client));
+    client->socket = -1;
+    client->address.sin_family = AF_INET;
+    client->address.sin_port = port;
+    client->address.sin_addr.s_addr = address;
+    client->host = host;
+
+    client->buffer = socketAllocBuffer(HTTP_CLIENT_BUFFER_SIZE);
+    return client->buffer ? 0 : HTTP_CLIENT_ERROR_MEMORY;
+}
+
+void httpclient_close(HttpClient* client)
+{
+    disconnect(client);
+
+    if (client->buffer) {
+        socketFreeBuffer(client->buffer);
+        client->buffer = NULL;
+    }
+}
+
+int httpclient_request(HttpClient* client, const char* method, const char* path, const char* headers,
+    const struct iovec* body, HttpResponse* response)
+{
+    while (1) {
+        int reused = (client->socket >= 0);
+        if (!reused) {
+            client->socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (client->socket < 0) {
+                return HTTP_CLIENT_ERROR_SOCKET;
+            }
+
+            if (connect(client->socket, (struct sockaddr*) &client->address, sizeof(client->address)) < 0) {
+                disconnect(client);
+                return HTTP_CLIENT_ERROR_SOCKET;
+            }
+        }
+
+        response->status = 0;
+        client->start = client->end = 0;
+
+        int keepAlive = 0;
+        int ret = sendRequest(client, method, path, headers, body);
+        if (ret == 0) {
+            ret = receiveResponse(client, method, response, &keepAlive);
+        }
+
+        if (ret < 0 || !keepAlive) {
+            disconnect(client);
+        }
+
+        // the server closed the kept open connection before it got the request, try again on a new one
+        if (reused && response->status == 0 && (ret == HTTP_CLIENT_ERROR_SOCKET || ret == HTTP_CLIENT_ERROR_CLOSED)) {
+            continue;
+        }
+
+        return ret;
+    }
+}
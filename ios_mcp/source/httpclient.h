@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include "socket.h"
+
+// size of the buffer for request headers and received data, also the longest header line
+#define HTTP_CLIENT_BUFFER_SIZE 0x1000
+
+// contentLength of responses which end with the last chunk or when the server closes the connection
+#define HTTP_CLIENT_UNKNOWN_LENGTH 0xffffffffu
+
+#define HTTP_CLIENT_ERROR_SOCKET    -1
+#define HTTP_CLIENT_ERROR_TIMEOUT   -2
+#define HTTP_CLIENT_ERROR_RESPONSE  -3
+#define HTTP_CLIENT_ERROR_ABORTED   -4
+#define HTTP_CLIENT_ERROR_MEMORY    -5
+#define HTTP_CLIENT_ERROR_CLOSED    -6
+
+typedef struct {
+    int socket;
+    struct sockaddr_in address;
+    const char* host;
+
+    // socket buffer, received data which wasn't consumed yet is between start and end
+    uint8_t* buffer;
+    uint32_t start;
+    uint32_t end;
+} HttpClient;
+
+typedef struct HttpResponse HttpResponse;
+
+struct HttpResponse {
+    /**
+     * Called with the body as it is received, already decoded if it was chunked.
+     * Can be NULL to skip the body.
+     * @return 0 to continue, negative to abort the request
+     */
+    int (*body)(HttpResponse* response, const uint8_t* data, uint32_t size);
+    void* userdata;
+
+    int status;
+    // status code and reason phrase, e.g. "200 OK"
+    char statusLine[0x40];
+    uint32_t contentLength;
+};
+
+/**
+ * Set up a client for a server. The connection is made by the first request
+ * and kept open between requests, unless the server closes it.
+ * @param host Value of the Host header, must stay valid while the client is used
+ * @return 0 on success or HTTP_CLIENT_ERROR_MEMORY
+ */
+int httpclient_init(HttpClient* client, uint32_t address, uint16_t port, const char* host);
+
+void httpclient_close(HttpClient* client);
+
+/**
+ * Send a request and receive the whole response, the body is passed to response->body.
+ * A kept open connection which the server closed in the meantime is reopened once.
+ * @param headers Additional header lines, each ending with "\r\n", or NULL
+ * @param body Body to send, must be a socket buffer (see socketAllocBuffer), or NULL
+ * @return 0 on success or a HTTP_CLIENT_ERROR_* code, the connection is closed after errors
+ */
+int httpclient_request(HttpClient* client, const char* method, const char* path, const char* headers,
+    const struct iovec* body, HttpResponse* response);
@@ -0,0 +1,681 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "imports.h"
+#include "socket.h"
+#include "httpserver.h"
+#include "server.h"
+#include "fsa.h"
+#include "menu.h"
+
+#ifdef HTTPSERVER
+
+/*
+ * Minimal HTTP/1.1 server for browsing and downloading files, GET and HEAD only.
+ * The volumes are served under /sd/, /slc/ and /mlc/.
+ * Directory listings are html sent with chunked transfer encoding, HTTP/1.0 clients get them without
+ * it and the connection is closed after. Files are streamed through a socket buffer with a
+ * Content-Length. A single byte range can be requested to resume downloads.
+ * Connections are kept alive until the client closes them or is idle for too long.
+ */
+
+// every client gets its own worker thread with its own file buffer
+#define HTTP_MAX_CLIENTS 3
+
+#define WORKER_STACK_SIZE 0x800
+#define REQUEST_BUFFER_SIZE 0x400
+// files are read into this and sent from it without copying, listings are built in it
+#define FILE_BUFFER_SIZE 0x8000
+#define MAX_PATH_LENGTH 0x280
+
+// idle connections are closed after this many SERVER_POLL_TIMEOUTs, so they don't keep the worker busy
+#define KEEPALIVE_POLLS 10
+
+// room for the chunk size in front of a chunk and the line break after it
+#define CHUNK_HEADER_SIZE 8
+#define CHUNK_TRAILER_SIZE 2
+
+typedef struct {
+    const char* name;
+    const char* path;
+} Volume;
+
+static const Volume volumes[] = {
+    { "sd",  "/vol/storage_recovsd" },
+    { "slc", "/vol/system" },
+    { "mlc", "/vol/storage_mlc01" },
+};
+
+// buffers of a worker of the pool
+typedef struct {
+    char* request;
+    uint32_t requestLength;
+    uint8_t* buffer;
+    char path[MAX_PATH_LENGTH];
+} Worker;
+
+typedef struct {
+    int sock;
+    uint8_t* buffer;
+    uint32_t length;
+    // without it the data is sent as is
+    int chunked;
+    int error;
+} ChunkWriter;
+
+static const char* const workerNames[] = { "httpworker0", "httpworker1", "httpworker2", "httpworker3" };
+static_assert(HTTP_MAX_CLIENTS <= sizeof(workerNames) / sizeof(workerNames[0]), "not enough worker names");
+static_assert(HTTP_MAX_CLIENTS <= SERVER_MAX_WORKERS, "too many workers");
+
+static ServerPool pool = { .threadId = -1 };
+static Worker* workers = NULL;
+
+static const char busyResponse[] = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+static char toLower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (c - 'A' + 'a') : c;
+}
+
+// case-insensitive check if str starts with prefix, returns the rest of str or NULL
+static const char* matchPrefix(const char* str, const char* prefix)
+{
+    while (*prefix) {
+        if (toLower(*str++) != *prefix++) {
+            return NULL;
+        }
+    }
+
+    return str;
+}
+
+static const char* parseNumber(const char* str, uint32_t* out)
+{
+    if (*str < '0' || *str > '9') {
+        return NULL;
+    }
+
+    uint32_t value = 0;
+    while (*str >= '0' && *str <= '9') {
+        value = value * 10 + (*str++ - '0');
+    }
+
+    *out = value;
+    return str;
+}
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = toLower(c);
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/*
+ * Parses "bytes=first-last", "bytes=first-" or "bytes=-suffix" into an inclusive range.
+ * Returns 1 if a range was parsed, 0 if the header should be ignored (including multiple ranges),
+ * or -1 if the range can't be satisfied.
+ */
+static int parseRange(const char* value, uint32_t size, uint32_t* first, uint32_t* last)
+{
+    uint32_t a, b;
+
+    value = matchPrefix(value, "bytes=");
+    if (!value) {
+        return 0;
+    }
+
+    if (*value == '-') {
+        value = parseNumber(value + 1, &b);
+        if (!value || *value) {
+            return 0;
+        }
+        if (!b || !size) {
+            return -1;
+        }
+
+        *first = (b < size) ? size - b : 0;
+        *last = size - 1;
+        return 1;
+    }
+
+    value = parseNumber(value, &a);
+    if (!value || *value++ != '-') {
+        return 0;
+    }
+
+    b = size - 1;
+    if (*value) {
+        value = parseNumber(value, &b);
+        if (!value || *value || b < a) {
+            return 0;
+        }
+    }
+
+    if (a >= size) {
+        return -1;
+    }
+
+    *first = a;
+    *last = (b < size) ? b : size - 1;
+    return 1;
+}
+
+static const char* statusReason(int status)
+{
+    switch (status) {
+    case 200: return "OK";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 416: return "Range Not Satisfiable";
+    default:  return "Internal Server Error";
+    }
+}
+
+// fields are the additional header fields, each one terminated by \r\n
+static int sendHeader(int sock, Worker* worker, int status, const char* fields, int keepAlive)
+{
+    int length = snprintf((char*) worker->buffer, FILE_BUFFER_SIZE, "HTTP/1.1 %d %s\r\nServer: recovery_menu\r\n%sConnection: %s\r\n\r\n",
+        status, statusReason(status), fields, keepAlive ? "keep-alive" : "close");
+    return server_send_all_buffer(sock, worker->buffer, length);
+}
+
+static int sendError(int sock, Worker* worker, int status, int keepAlive)
+{
+    if (sendHeader(sock, worker, status, (status == 405) ? "Allow: GET, HEAD\r\nContent-Length: 0\r\n" : "Content-Length: 0\r\n", keepAlive) < 0) {
+        return -1;
+    }
+
+    return keepAlive;
+}
+
+static void chunkFlush(ChunkWriter* writer)
+{
+    if (!writer->length || writer->error) {
+        return;
+    }
+
+    if (!writer->chunked) {
+        if (server_send_all_buffer(writer->sock, writer->buffer + CHUNK_HEADER_SIZE, writer->length) < 0) {
+            writer->error = 1;
+        }
+        writer->length = 0;
+        return;
+    }
+
+    char size[CHUNK_HEADER_SIZE];
+    int sizeLength = snprintf(size, sizeof(size), "%lx\r\n", writer->length);
+    uint8_t* start = writer->buffer + CHUNK_HEADER_SIZE - sizeLength;
+    memcpy(start, size, sizeLength);
+    memcpy(writer->buffer + CHUNK_HEADER_SIZE + writer->length, "\r\n", CHUNK_TRAILER_SIZE);
+
+    if (server_send_all_buffer(writer->sock, start, sizeLength + writer->length + CHUNK_TRAILER_SIZE) < 0) {
+        writer->error = 1;
+    }
+    writer->length = 0;
+}
+
+static void chunkPutc(ChunkWriter* writer, char c)
+{
+    if (writer->length == FILE_BUFFER_SIZE - CHUNK_HEADER_SIZE - CHUNK_TRAILER_SIZE) {
+        chunkFlush(writer);
+    }
+
+    writer->buffer[CHUNK_HEADER_SIZE + writer->length++] = c;
+}
+
+static void chunkPuts(ChunkWriter* writer, const char* str)
+{
+    while (*str) {
+        chunkPutc(writer, *str++);
+    }
+}
+
+// writes str escaped for html text and attributes
+static void chunkPutsHtml(ChunkWriter* writer, const char* str)
+{
+    for (; *str; str++) {
+        switch (*str) {
+        case '&': chunkPuts(writer, "&amp;"); break;
+        case '<': chunkPuts(writer, "&lt;"); break;
+        case '>': chunkPuts(writer, "&gt;"); break;
+        case '"': chunkPuts(writer, "&quot;"); break;
+        default:  chunkPutc(writer, *str); break;
+        }
+    }
+}
+
+// writes str percent-encoded for use in a url
+static void chunkPutsUrl(ChunkWriter* writer, const char* str)
+{
+    static const char hex[] = "0123456789ABCDEF";
+
+    for (; *str; str++) {
+        char c = *str;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+            c == '-' || c == '.' || c == '_' || c == '~') {
+            chunkPutc(writer, c);
+        } else {
+            chunkPutc(writer, '%');
+            chunkPutc(writer, hex[(uint8_t) c >> 4]);
+            chunkPutc(writer, hex[c & 0xf]);
+        }
+    }
+}
+
+static void chunkPutEntry(ChunkWriter* writer, const char* name, int isDirectory, uint32_t size)
+{
+    chunkPuts(writer, "<a href=\"");
+    chunkPutsUrl(writer, name);
+    chunkPuts(writer, isDirectory ? "/\">" : "\">");
+    chunkPutsHtml(writer, name);
+    chunkPuts(writer, isDirectory ? "/</a>\n" : "</a>");
+
+    if (!isDirectory) {
+        char sizeString[16];
+        snprintf(sizeString, sizeof(sizeString), " %lu\n", size);
+        chunkPuts(writer, sizeString);
+    }
+}
+
+// lists the volumes if dirHandle is negative
+static int sendListing(int sock, Worker* worker, const char* target, int dirHandle, int head, int chunked, int keepAlive)
+{
+    // without chunked encoding the end of the connection is the end of the listing
+    if (!chunked) {
+        keepAlive = 0;
+    }
+
+    const char* fields = chunked ? "Content-Type: text/html; charset=utf-8\r\nTransfer-Encoding: chunked\r\n" : "Content-Type: text/html; charset=utf-8\r\n";
+    if (sendHeader(sock, worker, 200, fields, keepAlive) < 0) {
+        return -1;
+    }
+    if (head) {
+        return keepAlive;
+    }
+
+    ChunkWriter writer = { sock, worker->buffer, 0, chunked, 0 };
+    chunkPuts(&writer, "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>Index of ");
+    chunkPutsHtml(&writer, target);
+    chunkPuts(&writer, "</title></head><body><h1>Index of ");
+    chunkPutsHtml(&writer, target);
+    chunkPuts(&writer, "</h1><pre>\n");
+
+    if (dirHandle < 0) {
+        for (uint32_t i = 0; i < sizeof(volumes) / sizeof(volumes[0]); i++) {
+            chunkPutEntry(&writer, volumes[i].name, 1, 0);
+        }
+    } else {
+        chunkPuts(&writer, "<a href=\"../\">../</a>\n");
+
+        FSDirectoryEntry entry;
+        while (!writer.error && FSA_ReadDir(fsaHandle, dirHandle, &entry) >= 0) {
+            entry.name[sizeof(entry.name) - 1] = '\0';
+            chunkPutEntry(&writer, entry.name, entry.stat.flags & DIR_ENTRY_IS_DIRECTORY, entry.stat.size);
+        }
+    }
+
+    chunkPuts(&writer, "</pre></body></html>\n");
+    chunkFlush(&writer);
+    if (writer.error) {
+        return -1;
+    }
+
+    if (chunked) {
+        // last chunk
+        memcpy(worker->buffer, "0\r\n\r\n", 5);
+        if (server_send_all_buffer(sock, worker->buffer, 5) < 0) {
+            return -1;
+        }
+    }
+
+    return keepAlive;
+}
+
+static int sendFile(int sock, Worker* worker, int fileHandle, const char* range, int head, int keepAlive)
+{
+    FSStat stat;
+    if (FSA_StatFile(fsaHandle, fileHandle, &stat) < 0) {
+        return sendError(sock, worker, 500, keepAlive);
+    }
+
+    uint32_t first = 0;
+    uint32_t last = stat.size - 1;
+    int res = range ? parseRange(range, stat.size, &first, &last) : 0;
+
+    char fields[0xa0];
+    if (res < 0) {
+        snprintf(fields, sizeof(fields), "Content-Range: bytes */%lu\r\nContent-Length: 0\r\n", stat.size);
+        return (sendHeader(sock, worker, 416, fields, keepAlive) < 0) ? -1 : keepAlive;
+    }
+
+    uint32_t length = stat.size ? last - first + 1 : 0;
+    int pos = snprintf(fields, sizeof(fields), "Content-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\nContent-Length: %lu\r\n", length);
+    if (res > 0) {
+        snprintf(fields + pos, sizeof(fields) - pos, "Content-Range: bytes %lu-%lu/%lu\r\n", first, last, stat.size);
+    }
+
+    if (sendHeader(sock, worker, (res > 0) ? 206 : 200, fields, keepAlive) < 0) {
+        return -1;
+    }
+    if (head || !length) {
+        return keepAlive;
+    }
+
+    if (first && FSA_SetPosFile(fsaHandle, fileHandle, first) < 0) {
+        return -1;
+    }
+
+    while (length) {
+        uint32_t chunk = (length < FILE_BUFFER_SIZE) ? length : FILE_BUFFER_SIZE;
+        int ret = FSA_ReadFile(fsaHandle, worker->buffer, 1, chunk, fileHandle, 0);
+        // the header promised more data, so the connection has to be closed
+        if (ret <= 0 || server_send_all_buffer(sock, worker->buffer, ret) < 0) {
+            return -1;
+        }
+
+        length -= ret;
+    }
+
+    return keepAlive;
+}
+
+/*
+ * Translates the request target into an fsa path in worker->path.
+ * Returns 1 for the list of volumes, 0 for a path, or -1 if the target is invalid or doesn't exist.
+ */
+static int resolvePath(Worker* worker, const char* target)
+{
+    if (*target++ != '/') {
+        return -1;
+    }
+    if (!*target) {
+        return 1;
+    }
+
+    const Volume* volume = NULL;
+    for (uint32_t i = 0; i < sizeof(volumes) / sizeof(volumes[0]); i++) {
+        const char* rest = matchPrefix(target, volumes[i].name);
+        if (rest && (*rest == '/' || !*rest)) {
+            volume = &volumes[i];
+            target = rest;
+            break;
+        }
+    }
+    if (!volume) {
+        return -1;
+    }
+
+    uint32_t length = strnlen(volume->path, MAX_PATH_LENGTH);
+    memcpy(worker->path, volume->path, length);
+
+    while (*target) {
+        if (length == MAX_PATH_LENGTH - 1) {
+            return -1;
+        }
+
+        char c = *target++;
+        if (c == '%') {
+            int hi = hexValue(target[0]);
+            int lo = (hi >= 0) ? hexValue(target[1]) : -1;
+            if (lo < 0 || (hi == 0 && lo == 0)) {
+                return -1;
+            }
+            c = (hi << 4) | lo;
+            target += 2;
+        }
+        worker->path[length++] = c;
+    }
+    worker->path[length] = '\0';
+
+    // don't let anyone escape the volume
+    for (uint32_t i = 0; i + 2 < length; i++) {
+        if (worker->path[i] == '/' && worker->path[i + 1] == '.' && worker->path[i + 2] == '.' &&
+            (worker->path[i + 3] == '/' || worker->path[i + 3] == '\0')) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// handles the request in worker->request, returns 1 to keep the connection alive, 0 to close it, or -1 on errors
+static int handleRequest(int sock, Worker* worker)
+{
+    char* method = worker->request;
+    char* target = NULL;
+    char* version = NULL;
+    const char* range = NULL;
+    int keepAlive = 0;
+
+    // split the request into lines and the request line into its parts
+    char* line = method;
+    for (char* p = method; *p; p++) {
+        if (*p == ' ' && line == method && !version) {
+            *p = '\0';
+            if (!target) {
+                target = p + 1;
+            } else {
+                version = p + 1;
+                keepAlive = !strncmp(version, "HTTP/1.1", 8);
+            }
+        } else if (*p == '\r' || *p == '\n') {
+            *p = '\0';
+            if (line != method) {
+                const char* value;
+                if ((value = matchPrefix(line, "range:"))) {
+                    while (*value == ' ') value++;
+                    range = value;
+                } else if ((value = matchPrefix(line, "connection:"))) {
+                    while (*value == ' ') value++;
+                    if (matchPrefix(value, "close")) {
+                        keepAlive = 0;
+                    } else if (matchPrefix(value, "keep-alive")) {
+                        keepAlive = 1;
+                    }
+                }
+            }
+            line = p + 1;
+        }
+    }
+
+    if (!version) {
+        return sendError(sock, worker, 400, 0);
+    }
+
+    // HTTP/1.0 clients don't understand chunked encoding
+    int chunked = !strncmp(version, "HTTP/1.1", 8);
+    int head = !strncmp(method, "HEAD", 5);
+    if (!head && strncmp(method, "GET", 4) != 0) {
+        return sendError(sock, worker, 405, 0);
+    }
+
+    // ignore the query
+    for (char* p = target; *p; p++) {
+        if (*p == '?') {
+            *p = '\0';
+            break;
+        }
+    }
+
+    int res = resolvePath(worker, target);
+    if (res < 0) {
+        return sendError(sock, worker, 404, keepAlive);
+    }
+    if (res > 0) {
+        return sendListing(sock, worker, target, -1, head, chunked, keepAlive);
+    }
+
+    int handle;
+    if (FSA_OpenDir(fsaHandle, worker->path, &handle) >= 0) {
+        uint32_t targetLength = strnlen(target, REQUEST_BUFFER_SIZE);
+        if (target[targetLength - 1] != '/') {
+            // relative links in the listing need the trailing slash
+            FSA_CloseDir(fsaHandle, handle);
+            // the target can be long, so the fields are built in the second half of the buffer
+            char* fields = (char*) worker->buffer + FILE_BUFFER_SIZE / 2;
+            snprintf(fields, FILE_BUFFER_SIZE / 2, "Location: %s/\r\nContent-Length: 0\r\n", target);
+            return (sendHeader(sock, worker, 301, fields, keepAlive) < 0) ? -1 : keepAlive;
+        }
+
+        res = sendListing(sock, worker, target, handle, head, chunked, keepAlive);
+        FSA_CloseDir(fsaHandle, handle);
+        return res;
+    }
+
+    if (FSA_OpenFile(fsaHandle, worker->path, "r", &handle) < 0) {
+        return sendError(sock, worker, 404, keepAlive);
+    }
+
+    res = sendFile(sock, worker, handle, range, head, keepAlive);
+    FSA_CloseFile(fsaHandle, handle);
+    return res;
+}
+
+static char* findHeaderEnd(char* data, uint32_t length)
+{
+    for (uint32_t i = 3; i < length; i++) {
+        if (data[i] == '\n' && data[i - 1] == '\r' && data[i - 2] == '\n' && data[i - 3] == '\r') {
+            return data + i + 1;
+        }
+    }
+
+    return NULL;
+}
+
+static void serverClientHandler(int sock, Worker* worker)
+{
+    worker->requestLength = 0;
+
+    while (1) {
+        char* end;
+        while (!(end = findHeaderEnd(worker->request, worker->requestLength))) {
+            if (worker->requestLength == REQUEST_BUFFER_SIZE - 1) {
+                sendError(sock, worker, 400, 0);
+                return;
+            }
+
+            if (server_wait_readable(sock, &pool.running, KEEPALIVE_POLLS) <= 0) {
+                return;
+            }
+
+            int ret = recv(sock, worker->request + worker->requestLength, REQUEST_BUFFER_SIZE - 1 - worker->requestLength, 0);
+            if (ret <= 0) {
+                return;
+            }
+            worker->requestLength += ret;
+        }
+
+        // terminate the header, requests don't have a body so anything after it is the next request
+        uint32_t headerLength = end - worker->request;
+        end[-1] = '\0';
+
+        if (handleRequest(sock, worker) <= 0) {
+            return;
+        }
+
+        worker->requestLength -= headerLength;
+        memmove(worker->request, end, worker->requestLength);
+    }
+}
+
+static void handleClient(int sock, uint32_t index)
+{
+    serverClientHandler(sock, &workers[index]);
+}
+
+// browsers retry after a moment
+static void rejectClient(int sock)
+{
+    send(sock, busyResponse, sizeof(busyResponse) - 1, 0);
+}
+
+static const ServerConfig serverConfig = {
+    .port = HTTP_PORT,
+    .name = "httpserver",
+    .workerNames = workerNames,
+    .numWorkers = HTTP_MAX_CLIENTS,
+    .workerStackSize = WORKER_STACK_SIZE,
+    .handleClient = handleClient,
+    .rejectClient = rejectClient,
+};
+
+static void destroyWorkers(void)
+{
+    for (int i = 0; i < HTTP_MAX_CLIENTS; i++) {
+        Worker* worker = &workers[i];
+
+        if (worker->request) {
+            IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, worker->request);
+        }
+
+        if (worker->buffer) {
+            socketFreeBuffer(worker->buffer);
+        }
+    }
+
+    IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, workers);
+    workers = NULL;
+}
+
+static int createWorkers(void)
+{
+    workers = IOS_HeapAlloc(LOCAL_PROCESS_HEAP_ID, HTTP_MAX_CLIENTS * sizeof(Worker));
+    if (!workers) {
+        return -1;
+    }
+
+    int res = 0;
+    for (int i = 0; i < HTTP_MAX_CLIENTS; i++) {
+        Worker* worker = &workers[i];
+        worker->request = IOS_HeapAlloc(LOCAL_PROCESS_HEAP_ID, REQUEST_BUFFER_SIZE);
+        worker->buffer = socketAllocBuffer(FILE_BUFFER_SIZE);
+        if (!worker->request || !worker->buffer) {
+            res = -1;
+        }
+    }
+
+    if (res < 0) {
+        destroyWorkers();
+    }
+
+    return res;
+}
+
+int httpserver_init(void)
+{
+    if (pool.threadId >= 0) {
+        httpserver_deinit();
+    }
+
+    if (createWorkers() < 0) {
+        return -1;
+    }
+
+    if (server_pool_start(&pool, &serverConfig) < 0) {
+        destroyWorkers();
+        return -1;
+    }
+
+    return 0;
+}
+
+void httpserver_deinit(void)
+{
+    // the workers are only freed once the pool is done with them
+    server_pool_deinit(&pool);
+
+    if (workers) {
+        destroyWorkers();
+    }
+}
+
+#endif /* HTTPSERVER */
@@ -0,0 +1,11 @@
+#pragma once
+
+#define HTTP_PORT 80
+
+/**
+ * Start serving directory listings and downloads of the sd, slc and mlc volumes over HTTP.
+ * @return 0 on success, -1 if out of memory
+ */
+int httpserver_init(void);
+
+void httpserver_deinit(void);
@@ -146,6 +146,7 @@ typedef enum {
 int IOS_CreateThread(int (*fun)(void* arg), void* arg, void* stack_top, uint32_t stacksize, int priority, IOS_ThreadFlags flags);
 int IOS_JoinThread(int threadid, int* retval);
 int IOS_CancelThread(int threadid, int return_value);
+int IOS_GetCurrentThreadId(void);
 int IOS_StartThread(int threadid);
 int IOS_GetThreadPriority(int threadid);
 
@@ -228,3 +229,8 @@ typedef struct IOSCEccSignedCert {
 } IOSCEccSignedCert;
 
 int IOSC_GetDeviceCertificate(IOSCEccSignedCert* certificate, uint32_t certSize);
+
+#ifdef PERFSTATS
+// wraps the heap and ipc functions above
+#include "perfstats.h"
+#endif /* PERFSTATS */
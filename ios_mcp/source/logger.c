@@ -0,0 +1,291 @@
+#include "logger.h"
+#include "imports.h"
+#include "utils.h"
+#include "menu.h"
+#include "fsa.h"
+#include "socket.h"
+#include "stackmon.h"
+
+#include <string.h>
+
+#define LOGGER_STACK_SIZE 0x400
+#define LOGGER_BUFFER_SIZE 0x400
+// drain every 50ms
+#define LOGGER_DRAIN_INTERVAL (50 * 1000)
+// every serial write keeps the kernel busy for ~1ms per character
+#define LOGGER_SERIAL_CHUNK_SIZE 8
+
+#define LOGGER_SD_PATH "/vol/storage_recovsd/recovery_menu.log"
+
+enum {
+    LOGGER_MESSAGE_STOP_THREAD,
+    LOGGER_MESSAGE_DRAIN,
+    LOGGER_MESSAGE_SYNC,
+};
+
+typedef struct {
+    int (*open)(void);
+    void (*close)(void);
+    int (*write)(const char* buf, uint32_t len);
+} LoggerSinkOps;
+
+static int loggerThreadHandle = -1;
+static uint8_t* loggerThreadStack = NULL;
+static char* loggerBuffer = NULL;
+static uint32_t loggerMessageQueueBuf[0x8];
+static int loggerMessageQueue = -1;
+// the logger thread answers LOGGER_MESSAGE_SYNC here
+static uint32_t loggerSyncQueueBuf[0x1];
+static int loggerSyncQueue = -1;
+static int loggerTimer = -1;
+
+// sinks requested by other threads, only opened and closed by the logger thread
+static volatile uint32_t requestedSinks = 0;
+static uint32_t openSinks = 0;
+
+static int sdFileHandle = -1;
+static int udpSocket = -1;
+
+static int serialWrite(const char* buf, uint32_t len)
+{
+    while (len) {
+        uint32_t chunk = (len < LOGGER_SERIAL_CHUNK_SIZE) ? len : LOGGER_SERIAL_CHUNK_SIZE;
+        kernWriteSerial(buf, chunk);
+        buf += chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+static int sdOpen(void)
+{
+    return FSA_OpenFile(fsaHandle, LOGGER_SD_PATH, "a", &sdFileHandle);
+}
+
+static void sdClose(void)
+{
+    FSA_CloseFile(fsaHandle, sdFileHandle);
+    sdFileHandle = -1;
+}
+
+static int sdWrite(const char* buf, uint32_t len)
+{
+    // loggerBuffer is allocated for IPC, so it can be passed to FSA directly
+    int res = FSA_WriteFile(fsaHandle, (void*) buf, 1, len, sdFileHandle, 0);
+    return (res == len) ? 0 : -1;
+}
+
+static int udpOpen(void)
+{
+    udpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (udpSocket < 0) {
+        return udpSocket;
+    }
+
+    int enable = 1;
+    int res = setsockopt(udpSocket, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable));
+    if (res < 0) {
+        closesocket(udpSocket);
+        udpSocket = -1;
+        return res;
+    }
+
+    return 0;
+}
+
+static void udpClose(void)
+{
+    closesocket(udpSocket);
+    udpSocket = -1;
+}
+
+static int udpWrite(const char* buf, uint32_t len)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = LOGGER_UDP_PORT;
+    addr.sin_addr.s_addr = INADDR_BROADCAST;
+
+    int res = sendto(udpSocket, buf, len, 0, (struct sockaddr*) &addr, sizeof(addr));
+    return (res < 0) ? res : 0;
+}
+
+static const LoggerSinkOps sinkOps[LOGGER_SINK_COUNT] = {
+    [LOGGER_SINK_SERIAL] = { NULL,   NULL,     serialWrite },
+    [LOGGER_SINK_SD]     = { sdOpen, sdClose,  sdWrite },
+    [LOGGER_SINK_UDP]    = { udpOpen, udpClose, udpWrite },
+};
+
+static void updateSinks(void)
+{
+    uint32_t requested = requestedSinks;
+
+    for (int i = 0; i < LOGGER_SINK_COUNT; i++) {
+        uint32_t mask = 1u << i;
+        if ((requested & mask) && !(openSinks & mask)) {
+            if (!sinkOps[i].open || sinkOps[i].open() >= 0) {
+                openSinks |= mask;
+            } else {
+                // don't retry a sink which can't be opened
+                requestedSinks &= ~mask;
+            }
+        } else if (!(requested & mask) && (openSinks & mask)) {
+            if (sinkOps[i].close) {
+                sinkOps[i].close();
+            }
+            openSinks &= ~mask;
+        }
+    }
+}
+
+static void drainLog(void)
+{
+    updateSinks();
+
+    int len;
+    while ((len = kernReadLog(loggerBuffer, LOGGER_BUFFER_SIZE)) > 0) {
+        for (int i = 0; i < LOGGER_SINK_COUNT; i++) {
+            if (!(openSinks & (1u << i))) {
+                continue;
+            }
+
+            if (sinkOps[i].write(loggerBuffer, len) < 0) {
+                // drop sinks which fail, e.g. if the SD was removed
+                requestedSinks &= ~(1u << i);
+            }
+        }
+
+        updateSinks();
+    }
+}
+
+static int loggerThread(void* arg)
+{
+    while (1) {
+        // Blocking wait for messages
+        uint32_t message;
+        if (IOS_ReceiveMessage(loggerMessageQueue, &message, IOS_MESSAGE_FLAGS_NONE) < 0) {
+            return 0;
+        }
+
+        if (message == LOGGER_MESSAGE_STOP_THREAD) {
+            // write out everything that is left and close all sinks
+            drainLog();
+            requestedSinks = 0;
+            updateSinks();
+            return 0;
+        }
+
+        drainLog();
+
+        if (message == LOGGER_MESSAGE_SYNC) {
+            IOS_SendMessage(loggerSyncQueue, 0, IOS_MESSAGE_FLAGS_NONE);
+        }
+    }
+}
+
+int logger_init(void)
+{
+    if (loggerThreadHandle >= 0) {
+        return 0;
+    }
+
+    loggerBuffer = IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, LOGGER_BUFFER_SIZE, 0x40);
+    loggerThreadStack = IOS_HeapAllocAligned(LOCAL_PROCESS_HEAP_ID, LOGGER_STACK_SIZE, 0x20);
+    if (!loggerBuffer || !loggerThreadStack) {
+        logger_deinit();
+        return -1;
+    }
+
+    loggerMessageQueue = IOS_CreateMessageQueue(loggerMessageQueueBuf, sizeof(loggerMessageQueueBuf) / 4);
+    loggerSyncQueue = IOS_CreateMessageQueue(loggerSyncQueueBuf, sizeof(loggerSyncQueueBuf) / 4);
+    if (loggerMessageQueue < 0 || loggerSyncQueue < 0) {
+        logger_deinit();
+        return -1;
+    }
+
+    requestedSinks = 1u << LOGGER_SINK_SERIAL;
+
+    stackmon_register("logger", loggerThreadStack, LOGGER_STACK_SIZE);
+
+    // run below the menu thread, logging should never hold up anything else
+    loggerThreadHandle = IOS_CreateThread(loggerThread, NULL, loggerThreadStack + LOGGER_STACK_SIZE, LOGGER_STACK_SIZE, IOS_GetThreadPriority(0) - 0x20, IOS_THREAD_FLAGS_NONE);
+    if (loggerThreadHandle < 0 || IOS_StartThread(loggerThreadHandle) < 0) {
+        logger_deinit();
+        return -1;
+    }
+
+    loggerTimer = IOS_CreateTimer(LOGGER_DRAIN_INTERVAL, LOGGER_DRAIN_INTERVAL, loggerMessageQueue, LOGGER_MESSAGE_DRAIN);
+    if (loggerTimer < 0) {
+        logger_deinit();
+        return -1;
+    }
+
+    return 0;
+}
+
+int logger_deinit(void)
+{
+    if (loggerTimer >= 0) {
+        IOS_DestroyTimer(loggerTimer);
+        loggerTimer = -1;
+    }
+
+    // Tell thread to flush, stop and wait
+    if (loggerThreadHandle >= 0) {
+        IOS_SendMessage(loggerMessageQueue, LOGGER_MESSAGE_STOP_THREAD, IOS_MESSAGE_FLAGS_NONE);
+        IOS_JoinThread(loggerThreadHandle, NULL);
+        loggerThreadHandle = -1;
+    }
+
+    if (loggerMessageQueue >= 0) {
+        IOS_DestroyMessageQueue(loggerMessageQueue);
+        loggerMessageQueue = -1;
+    }
+
+    if (loggerSyncQueue >= 0) {
+        IOS_DestroyMessageQueue(loggerSyncQueue);
+        loggerSyncQueue = -1;
+    }
+
+    if (loggerThreadStack) {
+        stackmon_unregister(loggerThreadStack);
+        IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, loggerThreadStack);
+        loggerThreadStack = NULL;
+    }
+
+    if (loggerBuffer) {
+        IOS_HeapFree(CROSS_PROCESS_HEAP_ID, loggerBuffer);
+        loggerBuffer = NULL;
+    }
+
+    return 0;
+}
+
+void logger_enable_sink(LoggerSink sink, int enable)
+{
+    if (enable) {
+        requestedSinks |= 1u << sink;
+    } else {
+        requestedSinks &= ~(1u << sink);
+    }
+}
+
+int logger_sink_enabled(LoggerSink sink)
+{
+    return (requestedSinks >> sink) & 1;
+}
+
+void logger_sync(void)
+{
+    if (loggerThreadHandle < 0) {
+        return;
+    }
+
+    IOS_SendMessage(loggerMessageQueue, LOGGER_MESSAGE_SYNC, IOS_MESSAGE_FLAGS_NONE);
+
+    uint32_t message;
+    IOS_ReceiveMessage(loggerSyncQueue, &message, IOS_MESSAGE_FLAGS_NONE);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    // bit-banged serial on the debug pin
+    LOGGER_SINK_SERIAL,
+    // recovery_menu.log on the root of the SD Card
+    LOGGER_SINK_SD,
+    // UDP broadcast, requires the network to be initialized
+    LOGGER_SINK_UDP,
+
+    LOGGER_SINK_COUNT,
+} LoggerSink;
+
+#define LOGGER_UDP_PORT 4405
+
+int logger_init(void);
+
+int logger_deinit(void);
+
+void logger_enable_sink(LoggerSink sink, int enable);
+
+/**
+ * Whether a sink is enabled, sinks which failed to open or write have been disabled by the logger.
+ */
+int logger_sink_enabled(LoggerSink sink);
+
+/**
+ * Wait until the logger thread has drained the log and opened or closed the sinks changed
+ * with logger_enable_sink. Must not be called from the logger thread.
+ */
+void logger_sync(void);
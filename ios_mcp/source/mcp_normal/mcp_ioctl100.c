@@ -1,5 +1,6 @@
 #include "imports.h"
 #include "menu.h"
+#include "stackmon.h"
 
 static int threadStarted = 0;
 static uint8_t threadStack[0x1000] __attribute__((aligned(0x20)));
@@ -10,6 +11,7 @@ int MCP_ioctl100_patch(void* msg)
 
     // start the menu thread
     if (!threadStarted) {
+        stackmon_register("menu", threadStack, sizeof(threadStack));
         int tid = IOS_CreateThread(menuThread, NULL, threadStack + sizeof(threadStack), sizeof(threadStack), IOS_GetThreadPriority(0), IOS_THREAD_FLAGS_DETACHED);
         if (tid > 0) {
             IOS_StartThread(tid);
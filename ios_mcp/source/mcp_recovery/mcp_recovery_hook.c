@@ -1,5 +1,6 @@
 #include "imports.h"
 #include "menu.h"
+#include "stackmon.h"
 
 #include <string.h>
 
@@ -12,6 +13,7 @@ void* MCP_recovery_ioctl_memcpy_hook(void* dst, void* src, uint32_t size)
 
     // start the menu thread
     if (!threadStarted) {
+        stackmon_register("menu", threadStack, sizeof(threadStack));
         int tid = IOS_CreateThread(menuThread, NULL, threadStack + sizeof(threadStack), sizeof(threadStack), IOS_GetThreadPriority(0), 1);
         if (tid > 0) {
             IOS_StartThread(tid);
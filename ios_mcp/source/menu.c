@@ -23,7 +23,11 @@
 #include "fsa.h"
 #include "socket.h"
 #include "netconf.h"
+#include "netdb.h"
 #include "mcp_misc.h"
+#include "logger.h"
+#include "trace.h"
+#include "perfstats.h"
 
 #include <stdarg.h>
 #include <string.h>
@@ -40,16 +44,34 @@ int fsaHandle = -1;
 static const Menu mainMenuOptions[] = {
     {"Set Coldboot Title",          {.callback = option_SetColdbootTitle}},
     {"Dump Syslogs",                {.callback = option_DumpSyslogs}},
+    {"Stream Syslogs",              {.callback = option_StreamSyslogs}},
     {"Dump OTP + SEEPROM",          {.callback = option_DumpOtpAndSeeprom}},
     {"Load Network Configuration",  {.callback = option_LoadNetConf}},
     {"Start wupserver",             {.callback = option_StartWupserver}},
+#ifdef NBD
+    {"Serve Storage over Network",  {.callback = option_ServeStorage}},
+#endif
+#ifdef HTTPSERVER
+    {"Start HTTP File Server",      {.callback = option_StartHttpServer}},
+#endif
+#ifdef NETBENCH
+    {"Network Benchmark",           {.callback = option_NetworkBenchmark}},
+#endif
     {"Pair Gamepad",                {.callback = option_PairDRC}},
+    {"Fetch Files over TFTP",       {.callback = option_FetchTftp}},
     {"Install WUP",                 {.callback = option_InstallWUP}},
     {"Edit Parental Controls",      {.callback = option_EditParental}},
     {"Debug System Region",         {.callback = option_DebugSystemRegion}},
     {"System Information",          {.callback = option_SystemInformation}},
+    {"Diagnostics",                 {.callback = option_Diagnostics}},
     {"Submit System Data",          {.callback = option_SubmitSystemData}},
     {"Load BOOT1 payload",          {.callback = option_LoadBoot1Payload}},
+#ifdef TRACE
+    {"Dump Trace",                  {.callback = option_DumpTrace}},
+#endif
+#ifdef PROFILER
+    {"Profiler",                    {.callback = option_Profiler}},
+#endif
     {"Shutdown",                    {.callback = option_Shutdown}},
 };
 
@@ -75,6 +97,32 @@ static void drawBars(const char* title)
     gfx_print(SCREEN_WIDTH - 16, SCREEN_HEIGHT - CHAR_SIZE_DRC_Y - 4, GfxPrintFlag_AlignRight, "POWER: Choose");
 }
 
+/**
+ * Handle the EJECT + POWER combo toggling the performance HUD and keep it updated.
+ * The HUD is only toggled when the combo is newly pressed compared to cur_flag.
+ * @return non-zero while the combo is held or released and the flag should not be handled further
+ */
+static int handleHud(uint8_t flag, uint8_t cur_flag)
+{
+#ifdef PERFSTATS
+    const uint8_t combo = SYSTEM_EVENT_FLAG_EJECT_BUTTON | SYSTEM_EVENT_FLAG_POWER_BUTTON;
+    if ((flag & combo) == combo) {
+        if ((cur_flag & combo) != combo) {
+            perfstats_toggle_hud();
+        }
+        return 1;
+    }
+
+    // releasing one button of the combo before the other isn't a press of the other one
+    if ((cur_flag & combo) == combo && (flag & combo)) {
+        return 1;
+    }
+
+    perfstats_update_hud(0);
+#endif /* PERFSTATS */
+    return 0;
+}
+
 /**
  * Draw a single menu item. Called by drawMenu().
  * @param menuItem Menu item
@@ -126,6 +174,9 @@ int drawMenu(const char* title, const Menu* menu, size_t count,
     if (selected < 0 || selected >= count)
         selected = 0;
 
+    uint64_t redraw_start;
+    IOS_GetAbsTime64(&redraw_start);
+
     // draw the full menu
     if (!(flags & MenuFlag_NoClearScreen)) {
         gfx_clear(COLOR_BACKGROUND);
@@ -150,7 +201,9 @@ int drawMenu(const char* title, const Menu* menu, size_t count,
     uint8_t flag = 0;
     while (1) {
         SMC_ReadSystemEventFlag(&flag);
-        if (cur_flag != flag) {
+        if (handleHud(flag, cur_flag)) {
+            cur_flag = flag;
+        } else if (cur_flag != flag) {
             if (flag & SYSTEM_EVENT_FLAG_EJECT_BUTTON) {
                 setNotificationLED(NOTIF_LED_OFF, 250);
                 prev_selected = selected;
@@ -166,6 +219,10 @@ int drawMenu(const char* title, const Menu* menu, size_t count,
         }
 
         if (redraw) {
+            if (prev_selected >= 0) {
+                IOS_GetAbsTime64(&redraw_start);
+            }
+
             if (prev_selected != selected) {
                 // Redraw the previously selected menu item.
                 if (prev_selected >= 0) {
@@ -181,6 +238,11 @@ int drawMenu(const char* title, const Menu* menu, size_t count,
             gfx_set_font_color(COLOR_PRIMARY);
             drawBars(title);
             redraw = 0;
+
+            uint64_t redraw_end;
+            IOS_GetAbsTime64(&redraw_end);
+            perfstats_set_redraw_time((uint32_t) (redraw_end - redraw_start));
+            perfstats_update_hud(1);
         }
     }
 }
@@ -203,7 +265,9 @@ void waitButtonInput(void)
 
     while (1) {
         SMC_ReadSystemEventFlag(&flag);
-        if (cur_flag != flag) {
+        if (handleHud(flag, cur_flag)) {
+            cur_flag = flag;
+        } else if (cur_flag != flag) {
             if ((flag & SYSTEM_EVENT_FLAG_EJECT_BUTTON) || (flag & SYSTEM_EVENT_FLAG_POWER_BUTTON)) {
                 setNotificationLED(NOTIF_LED_OFF, 250);
                 return;
@@ -236,6 +300,11 @@ void printf_error(int index, const char *format, ...)
     print_error(index, buffer);
 }
 
+// in milliseconds
+#define NETWORK_WAIT_TIMEOUT    5000
+#define NETWORK_POLL_MIN_DELAY  10
+#define NETWORK_POLL_MAX_DELAY  320
+
 /**
  * Initialize the network configuration.
  * @param index [in/out] Starting (and ending) Y position.
@@ -252,10 +321,17 @@ int initNetconf(uint32_t* index)
         return res;
     }
 
-    gfx_printf(16, *index, 0, "Waiting for network connection... %ds", 5);
+    int secondsLeft = NETWORK_WAIT_TIMEOUT / 1000;
+    gfx_printf(16, *index, 0, "Waiting for network connection... %ds", secondsLeft);
+
+    // the link is usually up within a few milliseconds (especially with a static address),
+    // so start polling quickly and back off while waiting longer
+    uint64_t startTime, curTime;
+    IOS_GetAbsTime64(&startTime);
+    uint32_t pollDelay = NETWORK_POLL_MIN_DELAY;
 
     NetConfInterfaceTypeEnum interface = 0xff;
-    for (int i = 0; i < 5; i++) {
+    while (1) {
         if (netconf_get_if_linkstate(NET_CFG_INTERFACE_TYPE_WIFI) == NET_CFG_LINK_STATE_UP) {
             interface = NET_CFG_INTERFACE_TYPE_WIFI;
             break;
@@ -266,8 +342,22 @@ int initNetconf(uint32_t* index)
             break;
         }
 
-        usleep(1000 * 1000);
-        gfx_printf(16, *index, GfxPrintFlag_ClearBG, "Waiting for network connection... %ds", 4 - i);
+        IOS_GetAbsTime64(&curTime);
+        uint32_t elapsed = (uint32_t) (curTime - startTime) / 1000;
+        if (elapsed >= NETWORK_WAIT_TIMEOUT) {
+            break;
+        }
+
+        int seconds = (NETWORK_WAIT_TIMEOUT - elapsed + 999) / 1000;
+        if (seconds != secondsLeft) {
+            secondsLeft = seconds;
+            gfx_printf(16, *index, GfxPrintFlag_ClearBG, "Waiting for network connection... %ds", secondsLeft);
+        }
+
+        usleep(pollDelay * 1000);
+        if (pollDelay < NETWORK_POLL_MAX_DELAY) {
+            pollDelay *= 2;
+        }
     }
 
     *index += CHAR_SIZE_DRC_Y;
@@ -297,9 +387,81 @@ int initNetconf(uint32_t* index)
         return res;
     }
 
+    // lookups still work without the cache, so a failure isn't fatal
+    netdb_init();
+
+    // start broadcasting logs now that the network is up
+    logger_enable_sink(LOGGER_SINK_UDP, 1);
+
     return 0;
 }
 
+/**
+ * Read a value from network.cfg on the SD Card.
+ * @param key Name of the key, without the '='
+ * @param value Buffer for the value, left unchanged if the key isn't set
+ * @param size Size of the buffer, longer values are ignored
+ * @return 1 if the key was found; 0 if not; negative on error.
+ */
+int readNetworkConfig(const char* key, char* value, uint32_t size)
+{
+    int cfgHandle;
+    int res = FSA_OpenFile(fsaHandle, "/vol/storage_recovsd/network.cfg", "r", &cfgHandle);
+    if (res < 0) {
+        return res;
+    }
+
+    FSStat stat;
+    res = FSA_StatFile(fsaHandle, cfgHandle, &stat);
+    if (res < 0) {
+        FSA_CloseFile(fsaHandle, cfgHandle);
+        return res;
+    }
+
+    char* cfgBuffer = (char*) IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, stat.size + 1, 0x40);
+    if (!cfgBuffer) {
+        FSA_CloseFile(fsaHandle, cfgHandle);
+        return -1;
+    }
+
+    res = FSA_ReadFile(fsaHandle, cfgBuffer, 1, stat.size, cfgHandle, 0);
+    FSA_CloseFile(fsaHandle, cfgHandle);
+    if (res != stat.size) {
+        IOS_HeapFree(CROSS_PROCESS_HEAP_ID, cfgBuffer);
+        return (res < 0) ? res : -1;
+    }
+    cfgBuffer[stat.size] = '\n';
+
+    uint32_t keyLength = strnlen(key, 0x40);
+    const char* line = cfgBuffer;
+    res = 0;
+    for (uint32_t i = 0; i <= stat.size; i++) {
+        if (cfgBuffer[i] != '\n') {
+            continue;
+        }
+
+        uint32_t end = i;
+        if (end > 0 && cfgBuffer[end - 1] == '\r') {
+            end--;
+        }
+
+        if (strncmp(line, key, keyLength) == 0 && line[keyLength] == '=') {
+            line += keyLength + 1;
+            uint32_t length = (cfgBuffer + end) - line;
+            if (length < size) {
+                memcpy(value, line, length);
+                value[length] = '\0';
+                res = 1;
+            }
+        }
+
+        line = cfgBuffer + i + 1;
+    }
+
+    IOS_HeapFree(CROSS_PROCESS_HEAP_ID, cfgBuffer);
+    return res;
+}
+
 /**
  * Get region code information.
  * @param productArea_id Product area ID: 0-6
@@ -339,6 +501,9 @@ static void option_Shutdown(void)
         FSA_FlushVolume(fsaHandle, "/vol/storage_mlc01");
         FSA_FlushVolume(fsaHandle, "/vol/system");
 
+        // write out and close the log file
+        logger_deinit();
+
         // unmount sd
         FSA_Unmount(fsaHandle, "/vol/storage_recovsd", 2);
 
@@ -368,6 +533,15 @@ int menuThread(void* arg)
     // Initialize utils
     initializeUtils();
 
+    // Allocate the trace buffer (no-op unless built with TRACE=1)
+    trace_init();
+
+    // Start tracking heap and ipc usage (no-op unless built with PERFSTATS=1)
+    perfstats_init();
+
+    // Start draining the kernel log buffer
+    logger_init();
+
 #if defined(DC_INIT)
     // (re-)init the graphics subsystem
     GFX_SubsystemInit(0);
@@ -410,6 +584,8 @@ int menuThread(void* arg)
         int res = FSA_Mount(fsaHandle, "/dev/sdcard01", "/vol/storage_recovsd", 2, NULL, 0);
         if (res < 0) {
             printf("Failed to mount SD: %x\n", res);
+        } else {
+            logger_enable_sink(LOGGER_SINK_SD, 1);
         }
     } else {
         printf("Failed to open FSA: %x\n", fsaHandle);
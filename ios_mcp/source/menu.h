@@ -82,6 +82,15 @@ void printf_error(int index, const char *format, ...);
  */
 int initNetconf(uint32_t* index);
 
+/**
+ * Read a value from network.cfg on the SD Card.
+ * @param key Name of the key, without the '='
+ * @param value Buffer for the value, left unchanged if the key isn't set
+ * @param size Size of the buffer, longer values are ignored
+ * @return 1 if the key was found; 0 if not; negative on error.
+ */
+int readNetworkConfig(const char* key, char* value, uint32_t size);
+
 /* Region code string table */
 static const char region_tbl[7][4] = {
     "JPN", "USA", "EUR", "AUS",
@@ -0,0 +1,661 @@
+#include <string.h>
+#include <unistd.h>
+#include "imports.h"
+#include "socket.h"
+#include "nbd.h"
+#include "server.h"
+#include "stackmon.h"
+#include "fsa.h"
+#include "menu.h"
+
+#ifdef NBD
+
+/*
+ * Network block device server, see https://github.com/NetworkBlockDevice/nbd/blob/master/doc/proto.md
+ * Implements the fixed newstyle handshake with NBD_OPT_EXPORT_NAME, NBD_OPT_INFO and NBD_OPT_GO,
+ * there is only one export so its name is ignored. Replies are always simple replies.
+ *
+ * Device accesses go through a window of CACHE_SIZE bytes:
+ * a read that misses the window reloads it starting at the requested sector, which reads ahead for
+ * sequential reads. Writes are collected in the window and written back with a single FSA_RawWrite
+ * once an access leaves the window, or the client flushes or disconnects.
+ * Unaligned writes read the affected sectors first, whole sectors are written without reading them.
+ */
+
+#define NBD_MAGIC               0x4e42444d41474943ull // "NBDMAGIC"
+#define NBD_IHAVEOPT            0x49484156454f5054ull // "IHAVEOPT"
+#define NBD_OPTION_REPLY_MAGIC  0x0003e889045565a9ull
+#define NBD_REQUEST_MAGIC       0x25609513
+#define NBD_SIMPLE_REPLY_MAGIC  0x67446698
+
+// handshake flags
+#define NBD_FLAG_FIXED_NEWSTYLE (1 << 0)
+#define NBD_FLAG_NO_ZEROES      (1 << 1)
+
+// transmission flags
+#define NBD_FLAG_HAS_FLAGS      (1 << 0)
+#define NBD_FLAG_READ_ONLY      (1 << 1)
+#define NBD_FLAG_SEND_FLUSH     (1 << 2)
+#define NBD_FLAG_SEND_FUA       (1 << 3)
+
+#define NBD_OPT_EXPORT_NAME     1
+#define NBD_OPT_ABORT           2
+#define NBD_OPT_INFO            6
+#define NBD_OPT_GO              7
+
+#define NBD_REP_ACK             1
+#define NBD_REP_INFO            3
+#define NBD_REP_ERR_UNSUP       0x80000001
+
+#define NBD_INFO_EXPORT         0
+#define NBD_INFO_BLOCK_SIZE     3
+
+#define NBD_CMD_READ            0
+#define NBD_CMD_WRITE           1
+#define NBD_CMD_DISC            2
+#define NBD_CMD_FLUSH           3
+
+#define NBD_CMD_FLAG_FUA        (1 << 0)
+
+#define NBD_EPERM               1
+#define NBD_EIO                 5
+#define NBD_EINVAL              22
+
+#define NBD_REQUEST_SIZE        28
+#define NBD_REPLY_SIZE          16
+// largest request payload announced to clients, writes are streamed into the window so this is not a buffer size
+#define NBD_MAX_PAYLOAD         0x2000000
+
+#define SERVER_STACK_SIZE 0x600
+#define CACHE_SIZE 0x10000
+#define IO_BUFFER_SIZE 0x200
+// replies are built here, so they don't overlap the request while it is still being parsed
+#define IO_BUFFER_REPLY_OFFSET 0x40
+
+// device info type returning the sector count (u64 at 0x08) and sector size (u32 at 0x10)
+#define DEVICE_INFO_TYPE 4
+#define DEVICE_INFO_SIZE 0x28
+
+typedef struct {
+    int handle;
+    int readOnly;
+    uint32_t sectorSize;
+    uint32_t sectorShift;
+    uint64_t numSectors;
+
+    // the window, cacheSectors sectors starting at cacheStart are valid
+    uint8_t* cache;
+    uint64_t cacheStart;
+    uint32_t cacheSectors;
+    // sectors of the window that need to be written back, relative to cacheStart, dirtyEnd is 0 if none
+    uint32_t dirtyStart;
+    uint32_t dirtyEnd;
+} Device;
+
+static Device device = { .handle = -1 };
+
+static volatile int serverRunning = 0;
+// socket of the client currently served, -1 if idle
+static volatile int clientSocket = -1;
+static int threadId = -1;
+static uint8_t* threadStack = NULL;
+static uint8_t* ioBuffer = NULL;
+
+// the protocol is big-endian, which happens to be native on the console
+static uint16_t getBE16(const uint8_t* p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t getBE32(const uint8_t* p)
+{
+    return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint64_t getBE64(const uint8_t* p)
+{
+    return ((uint64_t) getBE32(p) << 32) | getBE32(p + 4);
+}
+
+static void putBE16(uint8_t* p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value;
+}
+
+static void putBE32(uint8_t* p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static void putBE64(uint8_t* p, uint64_t value)
+{
+    putBE32(p, value >> 32);
+    putBE32(p + 4, value);
+}
+
+// receives into the window, without copying where whole cache lines are received
+static int recvCache(int sock, uint8_t* data, uint32_t length)
+{
+    while (length) {
+        int ret;
+        if (!((uintptr_t) data & 0x3f) && length >= 0x40) {
+            const struct iovec iov = { data, length & ~0x3f };
+            ret = recvv(sock, &iov, 1, 0);
+        } else {
+            ret = recv(sock, data, (length < 0x40) ? length : 0x40 - ((uintptr_t) data & 0x3f), 0);
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+
+        data += ret;
+        length -= ret;
+    }
+
+    return 0;
+}
+
+// skips over the payload of a rejected request
+static int drain(int sock, uint32_t length)
+{
+    while (length) {
+        uint32_t chunk = (length < IO_BUFFER_REPLY_OFFSET) ? length : IO_BUFFER_REPLY_OFFSET;
+        if (server_recv_all(sock, ioBuffer, chunk) < 0) {
+            return -1;
+        }
+        length -= chunk;
+    }
+
+    return 0;
+}
+
+static int cacheContains(uint64_t sector)
+{
+    return sector >= device.cacheStart && sector - device.cacheStart < device.cacheSectors;
+}
+
+static int cacheFlush(void)
+{
+    if (!device.dirtyEnd) {
+        return 0;
+    }
+
+    int res = FSA_RawWrite(fsaHandle, device.cache + (device.dirtyStart << device.sectorShift), device.sectorSize,
+        device.dirtyEnd - device.dirtyStart, device.cacheStart + device.dirtyStart, device.handle);
+    device.dirtyStart = 0;
+    device.dirtyEnd = 0;
+    return (res < 0) ? res : 0;
+}
+
+// moves the window to start at sector and fills it
+static int cacheLoad(uint64_t sector)
+{
+    int res = cacheFlush();
+    if (res < 0) {
+        return res;
+    }
+
+    uint32_t count = CACHE_SIZE >> device.sectorShift;
+    if (device.numSectors - sector < count) {
+        count = device.numSectors - sector;
+    }
+
+    device.cacheStart = sector;
+    device.cacheSectors = 0;
+    res = FSA_RawRead(fsaHandle, device.cache, device.sectorSize, count, sector, device.handle);
+    if (res < 0) {
+        return res;
+    }
+
+    device.cacheSectors = count;
+    return 0;
+}
+
+static void cacheMarkDirty(uint32_t first, uint32_t end)
+{
+    if (!device.dirtyEnd) {
+        device.dirtyStart = first;
+        device.dirtyEnd = end;
+        return;
+    }
+
+    // clean sectors in between are valid as well, so they are simply written back along with the rest
+    if (first < device.dirtyStart) {
+        device.dirtyStart = first;
+    }
+    if (end > device.dirtyEnd) {
+        device.dirtyEnd = end;
+    }
+}
+
+static int sendReply(int sock, uint8_t* reply, uint32_t error)
+{
+    putBE32(reply + 4, error);
+    return server_send_all(sock, reply, NBD_REPLY_SIZE);
+}
+
+// sends the reply followed by length bytes from offset, the window has to contain offset
+static int sendRead(int sock, uint8_t* reply, uint64_t offset, uint32_t length)
+{
+    uint32_t replyLeft = NBD_REPLY_SIZE;
+    putBE32(reply + 4, 0);
+
+    while (length || replyLeft) {
+        struct iovec iov[2];
+        int count = 0;
+
+        if (replyLeft) {
+            iov[count].iov_base = reply + NBD_REPLY_SIZE - replyLeft;
+            iov[count].iov_len = replyLeft;
+            count++;
+        }
+
+        if (length) {
+            uint64_t sector = offset >> device.sectorShift;
+            // the reply is already on its way, so device errors can only be reported by disconnecting
+            if (!cacheContains(sector) && cacheLoad(sector) < 0) {
+                return -1;
+            }
+
+            uint32_t pos = ((sector - device.cacheStart) << device.sectorShift) + (offset & (device.sectorSize - 1));
+            uint32_t chunk = (device.cacheSectors << device.sectorShift) - pos;
+            iov[count].iov_base = device.cache + pos;
+            iov[count].iov_len = (length < chunk) ? length : chunk;
+            count++;
+        }
+
+        int ret = sendv(sock, iov, count, 0);
+        if (ret <= 0) {
+            return -1;
+        }
+
+        if (replyLeft) {
+            uint32_t sent = ((uint32_t) ret < replyLeft) ? (uint32_t) ret : replyLeft;
+            replyLeft -= sent;
+            ret -= sent;
+        }
+        offset += ret;
+        length -= ret;
+    }
+
+    return 0;
+}
+
+// receives the payload of a write into the window, returns an nbd error or -1 if the connection is lost
+static int recvWrite(int sock, uint64_t offset, uint32_t length)
+{
+    const uint32_t capacity = CACHE_SIZE >> device.sectorShift;
+
+    while (length) {
+        uint64_t sector = offset >> device.sectorShift;
+        uint32_t within = offset & (device.sectorSize - 1);
+
+        if (!cacheContains(sector)) {
+            int res = 0;
+            if (within || length < device.sectorSize) {
+                // only part of the sector is written, the rest of it has to be read first
+                res = cacheLoad(sector);
+            } else {
+                // continue a sequential write in the window if there is room, otherwise start over
+                if (sector != device.cacheStart + device.cacheSectors || device.cacheSectors == capacity) {
+                    res = cacheFlush();
+                    device.cacheStart = sector;
+                    device.cacheSectors = 0;
+                }
+
+                // these sectors are overwritten entirely, so the window grows without reading them
+                uint32_t count = capacity - device.cacheSectors;
+                if ((length >> device.sectorShift) < count) {
+                    count = length >> device.sectorShift;
+                }
+                device.cacheSectors += count;
+            }
+
+            if (res < 0) {
+                device.cacheSectors = 0;
+                return (drain(sock, length) < 0) ? -1 : NBD_EIO;
+            }
+        }
+
+        uint32_t first = sector - device.cacheStart;
+        uint32_t pos = (first << device.sectorShift) + within;
+        uint32_t chunk = (device.cacheSectors << device.sectorShift) - pos;
+        if (length < chunk) {
+            chunk = length;
+        }
+
+        if (recvCache(sock, device.cache + pos, chunk) < 0) {
+            return -1;
+        }
+        cacheMarkDirty(first, (pos + chunk + device.sectorSize - 1) >> device.sectorShift);
+
+        offset += chunk;
+        length -= chunk;
+    }
+
+    return 0;
+}
+
+static int sendOptionReply(int sock, uint32_t option, uint32_t type, const uint8_t* data, uint32_t length)
+{
+    uint8_t* buf = ioBuffer;
+    putBE64(buf, NBD_OPTION_REPLY_MAGIC);
+    putBE32(buf + 8, option);
+    putBE32(buf + 12, type);
+    putBE32(buf + 16, length);
+    memcpy(buf + 20, data, length);
+    return server_send_all(sock, buf, 20 + length);
+}
+
+static uint16_t transmissionFlags(void)
+{
+    return NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH | NBD_FLAG_SEND_FUA | (device.readOnly ? NBD_FLAG_READ_ONLY : 0);
+}
+
+// returns 0 once the client entered the transmission phase
+static int handshake(int sock)
+{
+    uint8_t* buf = ioBuffer;
+    const uint64_t size = device.numSectors << device.sectorShift;
+
+    putBE64(buf, NBD_MAGIC);
+    putBE64(buf + 8, NBD_IHAVEOPT);
+    putBE16(buf + 16, NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES);
+    if (server_send_all(sock, buf, 18) < 0 || server_recv_all(sock, buf, 4) < 0) {
+        return -1;
+    }
+    uint32_t clientFlags = getBE32(buf);
+
+    while (server_wait_readable(sock, &serverRunning, 0) > 0) {
+        if (server_recv_all(sock, buf, 16) < 0 || getBE64(buf) != NBD_IHAVEOPT) {
+            return -1;
+        }
+        uint32_t option = getBE32(buf + 8);
+        uint32_t length = getBE32(buf + 12);
+
+        // neither the export name nor the requested infos matter, everything is always sent
+        if (drain(sock, length) < 0) {
+            return -1;
+        }
+
+        switch (option) {
+        case NBD_OPT_EXPORT_NAME: {
+            // [size][transmission flags] and 124 zero bytes unless the client asked to leave them out
+            uint32_t replyLength = (clientFlags & NBD_FLAG_NO_ZEROES) ? 10 : 134;
+            memset(buf, 0, replyLength);
+            putBE64(buf, size);
+            putBE16(buf + 8, transmissionFlags());
+            return server_send_all(sock, buf, replyLength);
+        }
+        case NBD_OPT_INFO:
+        case NBD_OPT_GO: {
+            uint8_t info[14];
+            putBE16(info, NBD_INFO_EXPORT);
+            putBE64(info + 2, size);
+            putBE16(info + 10, transmissionFlags());
+            if (sendOptionReply(sock, option, NBD_REP_INFO, info, 12) < 0) {
+                return -1;
+            }
+
+            // the window makes any access work, but whole sectors avoid read-modify-write
+            putBE16(info, NBD_INFO_BLOCK_SIZE);
+            putBE32(info + 2, device.sectorSize);
+            putBE32(info + 6, CACHE_SIZE);
+            putBE32(info + 10, NBD_MAX_PAYLOAD);
+            if (sendOptionReply(sock, option, NBD_REP_INFO, info, 14) < 0 ||
+                sendOptionReply(sock, option, NBD_REP_ACK, NULL, 0) < 0) {
+                return -1;
+            }
+
+            if (option == NBD_OPT_GO) {
+                return 0;
+            }
+            break;
+        }
+        case NBD_OPT_ABORT:
+            sendOptionReply(sock, option, NBD_REP_ACK, NULL, 0);
+            return -1;
+        default:
+            if (sendOptionReply(sock, option, NBD_REP_ERR_UNSUP, NULL, 0) < 0) {
+                return -1;
+            }
+            break;
+        }
+    }
+
+    return -1;
+}
+
+static void serveClient(int sock)
+{
+    const uint64_t size = device.numSectors << device.sectorShift;
+    uint8_t* request = ioBuffer;
+    uint8_t* reply = ioBuffer + IO_BUFFER_REPLY_OFFSET;
+
+    if (handshake(sock) < 0) {
+        return;
+    }
+
+    while (server_wait_readable(sock, &serverRunning, 0) > 0) {
+        if (server_recv_all(sock, request, NBD_REQUEST_SIZE) < 0 || getBE32(request) != NBD_REQUEST_MAGIC) {
+            return;
+        }
+
+        uint16_t flags = getBE16(request + 4);
+        uint16_t type = getBE16(request + 6);
+        uint64_t offset = getBE64(request + 16);
+        uint32_t length = getBE32(request + 24);
+        int inRange = offset <= size && length <= size - offset;
+
+        // [magic][error][handle], the handle is echoed back as is
+        putBE32(reply, NBD_SIMPLE_REPLY_MAGIC);
+        memcpy(reply + 8, request + 8, 8);
+
+        uint32_t error = 0;
+        switch (type) {
+        case NBD_CMD_READ:
+            if (!inRange) {
+                error = NBD_EINVAL;
+                break;
+            }
+
+            // errors before the reply was sent can still be reported
+            if (length && !cacheContains(offset >> device.sectorShift) && cacheLoad(offset >> device.sectorShift) < 0) {
+                error = NBD_EIO;
+                break;
+            }
+
+            if (sendRead(sock, reply, offset, length) < 0) {
+                return;
+            }
+            continue;
+        case NBD_CMD_WRITE: {
+            if (device.readOnly || !inRange) {
+                error = device.readOnly ? NBD_EPERM : NBD_EINVAL;
+                if (drain(sock, length) < 0) {
+                    return;
+                }
+                break;
+            }
+
+            int res = recvWrite(sock, offset, length);
+            if (res < 0) {
+                return;
+            }
+            error = res;
+
+            if (!error && (flags & NBD_CMD_FLAG_FUA) && cacheFlush() < 0) {
+                error = NBD_EIO;
+            }
+            break;
+        }
+        case NBD_CMD_FLUSH:
+            if (cacheFlush() < 0) {
+                error = NBD_EIO;
+            }
+            break;
+        case NBD_CMD_DISC:
+            return;
+        default:
+            error = NBD_EINVAL;
+            break;
+        }
+
+        if (sendReply(sock, reply, error) < 0) {
+            return;
+        }
+    }
+}
+
+static void serverListenClients(void)
+{
+    int serverSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (serverSocket < 0) {
+        return;
+    }
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+
+    server.sin_family = AF_INET;
+    server.sin_port = NBD_PORT;
+    server.sin_addr.s_addr = 0;
+
+    if (bind(serverSocket, (struct sockaddr*) &server, sizeof(server)) < 0 || listen(serverSocket, 1) < 0) {
+        closesocket(serverSocket);
+        return;
+    }
+
+    while (server_wait_readable(serverSocket, &serverRunning, 0) > 0) {
+        int csock = accept(serverSocket, NULL, NULL);
+        if (csock < 0) {
+            break;
+        }
+
+        clientSocket = csock;
+        serveClient(csock);
+
+        // write back whatever the client left in the window, and don't trust the window for the next one
+        cacheFlush();
+        device.cacheSectors = 0;
+
+        clientSocket = -1;
+        closesocket(csock);
+    }
+
+    closesocket(serverSocket);
+}
+
+static int nbd_thread(void* arg)
+{
+    while (serverRunning) {
+        serverListenClients();
+        if (serverRunning) {
+            usleep(1000 * 1000);
+        }
+    }
+
+    return 0;
+}
+
+int nbd_init(const char* path, int readOnly, uint64_t* outSize)
+{
+    if (threadId >= 0) {
+        nbd_deinit();
+    }
+
+    uint32_t info[DEVICE_INFO_SIZE / 4];
+    int res = FSA_GetDeviceInfo(fsaHandle, path, DEVICE_INFO_TYPE, info);
+    if (res < 0) {
+        return res;
+    }
+
+    // the window is addressed with shifts, which also avoids 64-bit divisions
+    uint32_t sectorSize = info[0x10 / 4];
+    uint32_t sectorShift = 0;
+    while (sectorShift < 16 && (1u << sectorShift) < sectorSize) {
+        sectorShift++;
+    }
+    if ((1u << sectorShift) != sectorSize) {
+        return -1;
+    }
+
+    memset(&device, 0, sizeof(device));
+    device.handle = -1;
+    device.readOnly = readOnly;
+    device.sectorSize = sectorSize;
+    device.sectorShift = sectorShift;
+    device.numSectors = ((uint64_t) info[0x08 / 4] << 32) | info[0x0c / 4];
+
+    res = FSA_RawOpen(fsaHandle, path, &device.handle);
+    if (res < 0) {
+        device.handle = -1;
+        return res;
+    }
+
+    // read from and written to by the fsa and the socket driver directly
+    device.cache = socketAllocBuffer(CACHE_SIZE);
+    ioBuffer = socketAllocBuffer(IO_BUFFER_SIZE);
+    threadStack = IOS_HeapAllocAligned(LOCAL_PROCESS_HEAP_ID, SERVER_STACK_SIZE, 0x20);
+    if (!device.cache || !ioBuffer || !threadStack) {
+        nbd_deinit();
+        return -1;
+    }
+
+    stackmon_register("nbd", threadStack, SERVER_STACK_SIZE);
+    serverRunning = 1;
+    threadId = IOS_CreateThread(nbd_thread, NULL, threadStack + SERVER_STACK_SIZE, SERVER_STACK_SIZE, IOS_GetThreadPriority(0), IOS_THREAD_FLAGS_NONE);
+    if (threadId < 0 || IOS_StartThread(threadId) < 0) {
+        nbd_deinit();
+        return -1;
+    }
+
+    if (outSize) {
+        *outSize = device.numSectors << device.sectorShift;
+    }
+
+    return 0;
+}
+
+void nbd_deinit(void)
+{
+    serverRunning = 0;
+
+    // the listener notices this within SERVER_POLL_TIMEOUT, but the client might be in the middle of a transfer
+    int sock = clientSocket;
+    if (sock >= 0) {
+        shutdown(sock, SHUT_RDWR);
+    }
+
+    if (threadId >= 0) {
+        IOS_JoinThread(threadId, NULL);
+        threadId = -1;
+    }
+
+    if (threadStack) {
+        stackmon_unregister(threadStack);
+        IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, threadStack);
+        threadStack = NULL;
+    }
+
+    if (device.handle >= 0) {
+        FSA_RawClose(fsaHandle, device.handle);
+        device.handle = -1;
+    }
+
+    if (device.cache) {
+        socketFreeBuffer(device.cache);
+        device.cache = NULL;
+    }
+
+    if (ioBuffer) {
+        socketFreeBuffer(ioBuffer);
+        ioBuffer = NULL;
+    }
+}
+
+#endif /* NBD */
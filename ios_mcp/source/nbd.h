@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+#define NBD_PORT 10809
+
+/**
+ * Export a raw device (e.g. "/dev/mlc01") over the network block device protocol.
+ * Only one client is served at a time.
+ * @param device Device path passed to FSA_RawOpen
+ * @param readOnly Reject writes from clients
+ * @param outSize [out] Size of the export in bytes
+ * @return 0 on success, negative FSA error, or -1 if the device or memory is unsuitable
+ */
+int nbd_init(const char* device, int readOnly, uint64_t* outSize);
+
+void nbd_deinit(void);
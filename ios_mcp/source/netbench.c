@@ -0,0 +1,279 @@
+#include <string.h>
+#include "imports.h"
+#include "socket.h"
+#include "netbench.h"
+
+#ifdef NETBENCH
+
+/*
+ * Throughput and round trip tests against tools/netbench_peer.py.
+ * Every test connects to the TCP port of the peer and sends a request, all numbers are big endian:
+ *   uint32_t magic, test, size, seconds
+ * What follows depends on the test:
+ * - TCP send: the console sends for the duration of the test and shuts its side of the connection down,
+ *   the peer answers with the number of bytes it received (uint32_t).
+ * - TCP recv: the peer sends for the duration of the test and closes the connection.
+ * - UDP send: the console sends datagrams of size bytes to the UDP port of the peer, each starting with a
+ *   sequence number (uint32_t). Then it shuts the TCP connection down and the peer answers with the number
+ *   of datagrams and bytes it received (2x uint32_t).
+ * - UDP echo: the peer sends every datagram back until the TCP connection is shut down.
+ */
+
+// in milliseconds
+#define NETBENCH_TIMEOUT        3000
+#define NETBENCH_ECHO_TIMEOUT   500
+
+typedef struct {
+    uint32_t magic;
+    uint32_t test;
+    uint32_t size;
+    uint32_t seconds;
+} NetbenchRequest;
+
+static uint32_t timeSince(uint64_t start)
+{
+    uint64_t now;
+    IOS_GetAbsTime64(&now);
+    return (uint32_t) (now - start);
+}
+
+static void addToTimeline(NetbenchResult* result, uint32_t elapsed, uint32_t bytes)
+{
+    // the last call of a test can end a bit after its duration
+    uint32_t second = elapsed / 1000000;
+    if (second >= result->seconds) {
+        second = result->seconds - 1;
+    }
+    result->timeline[second] += bytes;
+}
+
+static int receiveAll(int sock, void* buf, uint32_t size)
+{
+    uint8_t* data = buf;
+    while (size) {
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        int ret = poll(&pfd, 1, NETBENCH_TIMEOUT);
+        if (ret <= 0) {
+            return (ret == 0) ? NETBENCH_ERROR_TIMEOUT : NETBENCH_ERROR_SOCKET;
+        }
+
+        ret = recv(sock, data, size, 0);
+        if (ret <= 0) {
+            return (ret == 0) ? NETBENCH_ERROR_PEER : NETBENCH_ERROR_SOCKET;
+        }
+        data += ret;
+        size -= ret;
+    }
+
+    return 0;
+}
+
+static int tcpSend(int sock, NetbenchApi api, uint8_t* buffer, uint32_t size, NetbenchResult* result)
+{
+    const struct iovec iov = { buffer, size };
+    uint64_t start;
+    IOS_GetAbsTime64(&start);
+
+    uint32_t elapsed = 0;
+    while (elapsed < result->seconds * 1000000) {
+        int ret = (api == NETBENCH_API_VECTOR) ? sendv(sock, &iov, 1, 0) : send(sock, buffer, size, 0);
+        if (ret <= 0) {
+            return NETBENCH_ERROR_SOCKET;
+        }
+
+        elapsed = timeSince(start);
+        addToTimeline(result, elapsed, ret);
+    }
+
+    // the peer answers once it received everything
+    shutdown(sock, SHUT_WR);
+    int res = receiveAll(sock, &result->bytes, sizeof(result->bytes));
+    result->time = timeSince(start);
+    return res;
+}
+
+static int tcpRecv(int sock, NetbenchApi api, uint8_t* buffer, uint32_t size, NetbenchResult* result)
+{
+    const struct iovec iov = { buffer, size };
+    uint64_t start;
+    IOS_GetAbsTime64(&start);
+
+    while (1) {
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        int ret = poll(&pfd, 1, NETBENCH_TIMEOUT);
+        if (ret <= 0) {
+            return (ret == 0) ? NETBENCH_ERROR_TIMEOUT : NETBENCH_ERROR_SOCKET;
+        }
+
+        ret = (api == NETBENCH_API_VECTOR) ? recvv(sock, &iov, 1, 0) : recv(sock, buffer, size, 0);
+        if (ret < 0) {
+            return NETBENCH_ERROR_SOCKET;
+        }
+        // the peer closes the connection at the end of the test
+        if (ret == 0) {
+            return 0;
+        }
+
+        result->time = timeSince(start);
+        result->bytes += ret;
+        addToTimeline(result, result->time, ret);
+    }
+}
+
+static int udpSend(int sock, int udp, const struct sockaddr_in* peer, NetbenchApi api, uint8_t* buffer, uint32_t size, NetbenchResult* result)
+{
+    const struct iovec iov = { buffer, size };
+    uint64_t start;
+    IOS_GetAbsTime64(&start);
+
+    uint32_t elapsed = 0;
+    while (elapsed < result->seconds * 1000000) {
+        *(uint32_t*) buffer = result->sent;
+        int ret = (api == NETBENCH_API_VECTOR) ? sendv(udp, &iov, 1, 0)
+            : sendto(udp, buffer, size, 0, (const struct sockaddr*) peer, sizeof(*peer));
+        if (ret < 0) {
+            return NETBENCH_ERROR_SOCKET;
+        }
+
+        result->sent++;
+        elapsed = timeSince(start);
+        addToTimeline(result, elapsed, ret);
+    }
+    result->time = elapsed;
+
+    shutdown(sock, SHUT_WR);
+    uint32_t counts[2];
+    int res = receiveAll(sock, counts, sizeof(counts));
+    result->received = counts[0];
+    result->bytes = counts[1];
+    return res;
+}
+
+static int udpEcho(int udp, uint8_t* buffer, uint32_t size, NetbenchResult* result)
+{
+    uint32_t total = 0;
+    result->rttMin = 0xffffffff;
+
+    for (uint32_t i = 0; i < NETBENCH_ECHO_COUNT; i++) {
+        uint64_t start;
+        IOS_GetAbsTime64(&start);
+
+        *(uint32_t*) buffer = i;
+        if (send(udp, buffer, size, 0) < 0) {
+            return NETBENCH_ERROR_SOCKET;
+        }
+        result->sent++;
+
+        uint32_t elapsed;
+        while ((elapsed = timeSince(start)) < NETBENCH_ECHO_TIMEOUT * 1000) {
+            struct pollfd pfd = { udp, POLLIN, 0 };
+            int ret = poll(&pfd, 1, NETBENCH_ECHO_TIMEOUT - elapsed / 1000);
+            if (ret < 0) {
+                return NETBENCH_ERROR_SOCKET;
+            }
+            if (ret == 0) {
+                break;
+            }
+
+            ret = recv(udp, buffer, size, 0);
+            if (ret < 0) {
+                return NETBENCH_ERROR_SOCKET;
+            }
+
+            // late answers to earlier datagrams are ignored
+            if (ret >= 4 && *(uint32_t*) buffer == i) {
+                elapsed = timeSince(start);
+                if (elapsed < result->rttMin) result->rttMin = elapsed;
+                if (elapsed > result->rttMax) result->rttMax = elapsed;
+                total += elapsed;
+                result->received++;
+                break;
+            }
+        }
+    }
+
+    if (result->received) {
+        result->rttAvg = total / result->received;
+    } else {
+        result->rttMin = 0;
+    }
+
+    return 0;
+}
+
+int netbench_run(uint32_t address, NetbenchTest test, NetbenchApi api, uint32_t size, uint32_t seconds, NetbenchResult* result)
+{
+    memset(result, 0, sizeof(*result));
+    result->seconds = (seconds < 1) ? 1 : (seconds > NETBENCH_MAX_SECONDS) ? NETBENCH_MAX_SECONDS : seconds;
+
+    // the sequence numbers need 4 bytes
+    if (size < 4) {
+        size = 4;
+    }
+
+    uint8_t* buffer = socketAllocBuffer(size);
+    if (!buffer) {
+        return NETBENCH_ERROR_MEMORY;
+    }
+    // don't send whatever was left on the heap
+    memset(buffer, 0, size);
+
+    struct sockaddr_in peer;
+    memset(&peer, 0, sizeof(peer));
+    peer.sin_family = AF_INET;
+    peer.sin_port = NETBENCH_PORT;
+    peer.sin_addr.s_addr = address;
+
+    int udp = -1;
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    int res = NETBENCH_ERROR_SOCKET;
+    if (sock < 0 || connect(sock, (struct sockaddr*) &peer, sizeof(peer)) < 0) {
+        goto done;
+    }
+
+    if (test == NETBENCH_TEST_UDP_SEND || test == NETBENCH_TEST_UDP_ECHO) {
+        udp = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (udp < 0) {
+            goto done;
+        }
+
+        // sendv() and recv() need a connected socket
+        if ((api == NETBENCH_API_VECTOR || test == NETBENCH_TEST_UDP_ECHO)
+            && connect(udp, (struct sockaddr*) &peer, sizeof(peer)) < 0) {
+            goto done;
+        }
+    }
+
+    const NetbenchRequest request = { NETBENCH_MAGIC, test, size, result->seconds };
+    if (send(sock, &request, sizeof(request), 0) != sizeof(request)) {
+        goto done;
+    }
+
+    switch (test) {
+    case NETBENCH_TEST_TCP_SEND:
+        res = tcpSend(sock, api, buffer, size, result);
+        break;
+    case NETBENCH_TEST_TCP_RECV:
+        res = tcpRecv(sock, api, buffer, size, result);
+        break;
+    case NETBENCH_TEST_UDP_SEND:
+        res = udpSend(sock, udp, &peer, api, buffer, size, result);
+        break;
+    case NETBENCH_TEST_UDP_ECHO:
+        res = udpEcho(udp, buffer, size, result);
+        shutdown(sock, SHUT_WR);
+        break;
+    }
+
+done:
+    if (udp >= 0) {
+        closesocket(udp);
+    }
+    if (sock >= 0) {
+        closesocket(sock);
+    }
+    socketFreeBuffer(buffer);
+    return res;
+}
+
+#endif /* NETBENCH */
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+
+// TCP and UDP port of the peer, tools/netbench_peer.py
+#define NETBENCH_PORT 5731
+// "WUNB"
+#define NETBENCH_MAGIC 0x57554e42
+
+#define NETBENCH_MAX_SECONDS 8
+// number of datagrams sent by NETBENCH_TEST_UDP_ECHO
+#define NETBENCH_ECHO_COUNT 32
+
+#define NETBENCH_ERROR_SOCKET   -1
+#define NETBENCH_ERROR_TIMEOUT  -2
+#define NETBENCH_ERROR_PEER     -3
+#define NETBENCH_ERROR_MEMORY   -5
+
+typedef enum {
+    // the console sends over TCP, the peer counts what arrives
+    NETBENCH_TEST_TCP_SEND = 1,
+    // the peer sends over TCP for the duration of the test
+    NETBENCH_TEST_TCP_RECV = 2,
+    // the console sends numbered datagrams, the peer counts what arrives
+    NETBENCH_TEST_UDP_SEND = 3,
+    // the peer echoes datagrams back, to measure the round trip time
+    NETBENCH_TEST_UDP_ECHO = 4,
+} NetbenchTest;
+
+typedef enum {
+    // send(), recv() and sendto(), which copy the data through a new IPC buffer for every call
+    NETBENCH_API_COPY,
+    // sendv() and recvv() on a socket buffer, UDP sockets are connected for sendv()
+    NETBENCH_API_VECTOR,
+} NetbenchApi;
+
+typedef struct {
+    // bytes which arrived at the receiver and how long that took in microseconds
+    uint32_t bytes;
+    uint32_t time;
+    // bytes sent or received by the console in every second of the test
+    uint32_t timeline[NETBENCH_MAX_SECONDS];
+    uint32_t seconds;
+
+    // datagrams sent, and received by the peer or echoed back
+    uint32_t sent;
+    uint32_t received;
+    // round trip times of echoed datagrams in microseconds
+    uint32_t rttMin;
+    uint32_t rttAvg;
+    uint32_t rttMax;
+} NetbenchResult;
+
+/**
+ * Run a single test against a peer, every test uses its own TCP connection.
+ * @param size Size of every send or receive call, or of every datagram
+ * @param seconds Duration of the test, at most NETBENCH_MAX_SECONDS, not used for NETBENCH_TEST_UDP_ECHO
+ * @return 0 on success or a NETBENCH_ERROR_* code
+ */
+int netbench_run(uint32_t address, NetbenchTest test, NetbenchApi api, uint32_t size, uint32_t seconds, NetbenchResult* result);
@@ -57,66 +57,235 @@ struct dns_ioctlv {
 };
 static_assert(sizeof(struct dns_ioctlv) == 0x480, "dns_ioctlv: different size than expected");
 
-static int do_dns_query(const char* name, uint8_t type, uint32_t addr, uint32_t ttl, struct dns_querys* query)
+// the resolver only reports when the answer expires, in its own ticks
+#define DNS_TICKS_PER_SECOND    1000
+// the ttl is kept within these bounds, in seconds
+#define DNS_CACHE_MIN_TTL       30
+#define DNS_CACHE_MAX_TTL       600
+#define DNS_CACHE_ENTRIES       8
+
+typedef struct {
+    char name[sizeof(((struct dns_query_params*) 0)->name)];
+    uint32_t addresses[NETDB_MAX_ADDRESSES];
+    uint32_t count;
+    // IOS_GetAbsTime64 time in microseconds, 0 for unused entries
+    uint64_t expires;
+} DnsCacheEntry;
+
+static DnsCacheEntry* cache = NULL;
+
+// a message queue with a single message acts as the lock
+static uint32_t lockMessageQueueBuf[1];
+static int lockMessageQueue = -1;
+
+static void lock(void)
+{
+    uint32_t msg;
+    IOS_ReceiveMessage(lockMessageQueue, &msg, IOS_MESSAGE_FLAGS_NONE);
+}
+
+static void unlock(void)
+{
+    IOS_SendMessage(lockMessageQueue, 0, IOS_MESSAGE_FLAGS_NONE);
+}
+
+// returns the number of addresses of the A records of name and how long they can be cached
+static int do_dns_query(const char* name, uint32_t* addresses, uint32_t maxAddresses, uint32_t* ttl)
 {
     struct dns_ioctlv* ioctlv = IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, sizeof(struct dns_ioctlv), 0x40);
     if (!ioctlv) {
-        return -1;
+        return EAI_MEMORY;
     }
 
     memset(ioctlv, 0, sizeof(*ioctlv));
 
     strncpy(ioctlv->params.name, name, sizeof(ioctlv->params.name));
-    ioctlv->params.type = type;
-    ioctlv->params.ttl = ttl;
-    ioctlv->params.addr = addr;
+    ioctlv->params.type = 1;
 
     ioctlv->vecs[0].ptr = &ioctlv->params;
     ioctlv->vecs[0].len = sizeof(ioctlv->params);
     ioctlv->vecs[1].ptr = &ioctlv->query;
     ioctlv->vecs[1].len = sizeof(ioctlv->query);
 
-    int32_t res = IOS_Ioctlv(socketInit(), 0x26, 1, 1, ioctlv->vecs);
+    IOS_Ioctlv(socketInit(), 0x26, 1, 1, ioctlv->vecs);
 
-    memcpy(query, &ioctlv->query, sizeof(*query));
-    
-    // translate pointers
-    query->hostent.h_aliases = query->alist;
-    for (int i = 0; i < 2; i++) {
-        if (query->alist[i]) {
-            query->alist[i] = (char*) ((uint32_t) query + ((uint32_t) query->alist[i] - (uint32_t) query->query_ios_ptr));
-        }
+    const struct dns_querys* query = &ioctlv->query;
+    uint32_t count = (query->ipaddrs > 0) ? query->ipaddrs : 0;
+    if (count > maxAddresses) {
+        count = maxAddresses;
+    }
+    memcpy(addresses, query->ipaddr_list, count * sizeof(uint32_t));
+
+    *ttl = (query->expire_time - query->send_time) / DNS_TICKS_PER_SECOND;
+    if (query->expire_time <= query->send_time || *ttl < DNS_CACHE_MIN_TTL) {
+        *ttl = DNS_CACHE_MIN_TTL;
+    } else if (*ttl > DNS_CACHE_MAX_TTL) {
+        *ttl = DNS_CACHE_MAX_TTL;
     }
-    query->hostent.h_name = (char*) ((uint32_t) query + ((uint32_t) query->hostent.h_name - (uint32_t) query->query_ios_ptr));
 
     IOS_HeapFree(CROSS_PROCESS_HEAP_ID, ioctlv);
-    return res;
+    return count ? (int) count : EAI_NONAME;
 }
 
-struct hostent* gethostbyname(const char* name)
+const char* netdb_parse_address(const char* str, uint32_t* address)
 {
-    if (!name || name[0] == '\0') {
-        h_errno = 3;
-        return NULL;
+    uint32_t result = 0;
+    for (int i = 0; i < 4; i++) {
+        if (i > 0 && *str++ != '.') {
+            return NULL;
+        }
+
+        uint32_t part = 0;
+        const char* start = str;
+        while (*str >= '0' && *str <= '9' && str - start < 3) {
+            part = part * 10 + (*str++ - '0');
+        }
+        if (str == start || part > 255) {
+            return NULL;
+        }
+
+        result = (result << 8) | part;
     }
 
-    static struct dns_querys dns_entry;
-    do_dns_query(name, 1, 0, 0, &dns_entry);
-    if (!dns_entry.ipaddrs) {
-        h_errno = 1;
-        return NULL;
+    *address = result;
+    return str;
+}
+
+static int cache_lookup(const char* name, uint32_t* addresses, uint32_t maxAddresses)
+{
+    if (!cache) {
+        return 0;
+    }
+
+    uint64_t now;
+    IOS_GetAbsTime64(&now);
+
+    int count = 0;
+    lock();
+    for (int i = 0; i < DNS_CACHE_ENTRIES; i++) {
+        DnsCacheEntry* entry = &cache[i];
+        if (entry->expires > now && strncmp(entry->name, name, sizeof(entry->name)) == 0) {
+            count = (entry->count < maxAddresses) ? entry->count : maxAddresses;
+            memcpy(addresses, entry->addresses, count * sizeof(uint32_t));
+            break;
+        }
+    }
+    unlock();
+
+    return count;
+}
+
+static void cache_insert(const char* name, const uint32_t* addresses, uint32_t count, uint32_t ttl)
+{
+    if (!cache) {
+        return;
+    }
+
+    uint64_t now;
+    IOS_GetAbsTime64(&now);
+
+    lock();
+    // replace the entry of the same name or the one which expires first, unused and expired ones come first anyway
+    DnsCacheEntry* entry = &cache[0];
+    for (int i = 0; i < DNS_CACHE_ENTRIES; i++) {
+        if (strncmp(cache[i].name, name, sizeof(cache[i].name)) == 0) {
+            entry = &cache[i];
+            break;
+        }
+        if (cache[i].expires < entry->expires) {
+            entry = &cache[i];
+        }
+    }
+
+    strncpy(entry->name, name, sizeof(entry->name));
+    memcpy(entry->addresses, addresses, count * sizeof(uint32_t));
+    entry->count = count;
+    entry->expires = now + ttl * 1000000ull;
+    unlock();
+}
+
+int netdb_init(void)
+{
+    if (cache) {
+        return 0;
     }
 
-    dns_entry.hostent.h_addrtype = AF_INET;
-    dns_entry.hostent.h_length = 4;
-    dns_entry.hostent.h_addr_list = dns_entry.addrptrs;
+    lockMessageQueue = IOS_CreateMessageQueue(lockMessageQueueBuf, 1);
+    if (lockMessageQueue < 0) {
+        return lockMessageQueue;
+    }
+
+    DnsCacheEntry* entries = IOS_HeapAlloc(LOCAL_PROCESS_HEAP_ID, DNS_CACHE_ENTRIES * sizeof(DnsCacheEntry));
+    if (!entries) {
+        IOS_DestroyMessageQueue(lockMessageQueue);
+        lockMessageQueue = -1;
+        return -1;
+    }
+
+    memset(entries, 0, DNS_CACHE_ENTRIES * sizeof(DnsCacheEntry));
+    unlock();
+    cache = entries;
+    return 0;
+}
+
+int netdb_resolve(const char* name, uint32_t* addresses, uint32_t maxAddresses)
+{
+    if (!name || name[0] == '\0' || maxAddresses == 0) {
+        return EAI_NONAME;
+    }
 
-    int i;
-    for (i = 0; i < dns_entry.ipaddrs; i++) {
-        dns_entry.addrptrs[i] = (char*) &dns_entry.ipaddr_list[i];
+    uint32_t address;
+    const char* end = netdb_parse_address(name, &address);
+    if (end && *end == '\0') {
+        addresses[0] = address;
+        return 1;
     }
-    dns_entry.addrptrs[i] = NULL;
+
+    int count = cache_lookup(name, addresses, maxAddresses);
+    if (count > 0) {
+        return count;
+    }
+
+    // the query itself runs without the lock, it can take seconds
+    uint32_t found[NETDB_MAX_ADDRESSES];
+    uint32_t ttl;
+    count = do_dns_query(name, found, NETDB_MAX_ADDRESSES, &ttl);
+    if (count < 0) {
+        return count;
+    }
+
+    cache_insert(name, found, count, ttl);
+
+    if ((uint32_t) count > maxAddresses) {
+        count = maxAddresses;
+    }
+    memcpy(addresses, found, count * sizeof(uint32_t));
+    return count;
+}
+
+struct hostent* gethostbyname(const char* name)
+{
+    static uint32_t addresses[NETDB_MAX_ADDRESSES];
+    static char* addressList[NETDB_MAX_ADDRESSES + 1];
+    static struct hostent entry;
+
+    int count = netdb_resolve(name, addresses, NETDB_MAX_ADDRESSES);
+    if (count <= 0) {
+        h_errno = (!name || name[0] == '\0') ? 3 : 1;
+        return NULL;
+    }
+
+    for (int i = 0; i < count; i++) {
+        addressList[i] = (char*) &addresses[i];
+    }
+    addressList[count] = NULL;
+
+    entry.h_name = (char*) name;
+    entry.h_aliases = &addressList[count];
+    entry.h_addrtype = AF_INET;
+    entry.h_length = 4;
+    entry.h_addr_list = addressList;
 
     h_errno = 0;
-    return &dns_entry.hostent;
+    return &entry;
 }
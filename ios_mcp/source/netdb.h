@@ -16,4 +16,34 @@ struct hostent
 #define	h_addr h_addr_list[0]
 };
 
+// the most addresses returned for a name
+#define NETDB_MAX_ADDRESSES 4
+
+#define EAI_NONAME  -2
+#define EAI_MEMORY  -10
+
+/**
+ * Set up the resolver cache, without it every lookup is a query.
+ * @return 0 on success, negative on error
+ */
+int netdb_init(void);
+
+/**
+ * Parse a dotted IPv4 address like "192.168.0.2" at the start of str.
+ * @param address [out] The address in host byte order, only set on success
+ * @return the rest of str after the address, or NULL if it doesn't start with one
+ */
+const char* netdb_parse_address(const char* str, uint32_t* address);
+
+/**
+ * Resolve a host name or dotted IPv4 address to its addresses, can be called from any thread.
+ * Answers are cached while their TTL lasts, so repeated lookups of the same name don't query the DNS server.
+ * @param addresses [out] Addresses of the host, to try one after another if connecting fails
+ * @return the number of addresses, or a negative EAI_* error
+ */
+int netdb_resolve(const char* name, uint32_t* addresses, uint32_t maxAddresses);
+
+/**
+ * Resolve through netdb_resolve() into a static hostent, which isn't thread-safe.
+ */
 struct hostent* gethostbyname(const char *name);
@@ -0,0 +1,29 @@
+#include "Diagnostics.h"
+
+#include "menu.h"
+#include "gfx.h"
+#include "stackmon.h"
+
+void option_Diagnostics(void)
+{
+    gfx_clear(COLOR_BACKGROUND);
+    drawTopBar("Diagnostics");
+
+    uint32_t index = 16 + 8 + 2 + 8;
+
+    gfx_set_font_color(COLOR_SECONDARY);
+    gfx_print(16, index, 0, "Thread stacks (high-water mark):");
+    index += CHAR_SIZE_DRC_Y + 4;
+
+    StackUsage usage[STACKMON_MAX_STACKS];
+    int count = stackmon_get_usage(usage, STACKMON_MAX_STACKS);
+    for (int i = 0; i < count; i++) {
+        // anything close to the limit might already have overflowed
+        uint32_t percent = (usage[i].used * 100) / usage[i].size;
+        gfx_set_font_color((percent >= 90) ? COLOR_ERROR : COLOR_PRIMARY);
+        gfx_printf(16, index, 0, "%-16s %5lu / %5lu bytes (%lu%%)", usage[i].name, usage[i].used, usage[i].size, percent);
+        index += CHAR_SIZE_DRC_Y + 4;
+    }
+
+    waitButtonInput();
+}
@@ -0,0 +1,34 @@
+#include "DumpTrace.h"
+
+#include "menu.h"
+#include "gfx.h"
+#include "fsa.h"
+#include "utils.h"
+#include "trace.h"
+
+#ifdef TRACE
+
+void option_DumpTrace(void)
+{
+    gfx_clear(COLOR_BACKGROUND);
+
+    drawTopBar("Dumping Trace...");
+    setNotificationLED(NOTIF_LED_RED_BLINKING, 0);
+
+    uint32_t index = 16 + 8 + 2 + 8;
+    gfx_print(16, index, 0, "Writing trace.bin...");
+    index += CHAR_SIZE_DRC_Y + 4;
+
+    int res = trace_dump(fsaHandle, "/vol/storage_recovsd/trace.bin");
+    if (res < 0) {
+        printf_error(index, "Failed to write trace: %x", res);
+        return;
+    }
+
+    setNotificationLED(NOTIF_LED_PURPLE, 0);
+    gfx_set_font_color(COLOR_SUCCESS);
+    gfx_print(16, index, 0, "Done! Convert with tools/trace2json.py");
+    waitButtonInput();
+}
+
+#endif /* TRACE */
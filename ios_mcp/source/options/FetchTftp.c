@@ -0,0 +1,354 @@
+#include "FetchTftp.h"
+
+#include "menu.h"
+#include "gfx.h"
+#include "fsa.h"
+#include "imports.h"
+#include "netdb.h"
+#include "tftp.h"
+#include "utils.h"
+
+#include <string.h>
+
+#define SD_PATH "/vol/storage_recovsd/"
+#define DEFAULT_MANIFEST "recovery.sha256"
+
+#define MANIFEST_SIZE   0x4000
+#define MAX_NAME_LENGTH 0x80
+// downloads are written and hashed in chunks of this size
+#define DATA_BUFFER_SIZE 0x10000
+
+#define PROGRESS_WIDTH  (SCREEN_WIDTH - 32)
+#define PROGRESS_HEIGHT 12
+
+typedef struct {
+    // buffer for the whole manifest, or a chunk of a download
+    uint8_t* buffer;
+    uint32_t bufferSize;
+    uint32_t buffered;
+
+    int fileHandle;
+    uint8_t hashContext[IOSC_HASH_CONTEXT_SIZE];
+    uint32_t index;
+} FetchState;
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Get the next entry of a manifest in the format of sha256sum: the hash, two spaces or a space and a '*', and the path.
+ * Only files in the root of the SD Card or the install folder are accepted.
+ * The manifest isn't modified, so it can be parsed again from the start.
+ * @param name [out] The path of the file, needs room for MAX_NAME_LENGTH + 1 characters
+ * @return 1 if an entry was found, 0 at the end, -1 for an invalid line
+ */
+static int nextEntry(const char** cursor, const char* end, uint8_t* hash, char* name)
+{
+    const char* line = *cursor;
+    while (line < end && (*line == '\n' || *line == '\r')) {
+        line++;
+    }
+    if (line >= end) {
+        return 0;
+    }
+
+    const char* lineEnd = line;
+    while (lineEnd < end && *lineEnd != '\n' && *lineEnd != '\r') {
+        lineEnd++;
+    }
+    *cursor = lineEnd;
+
+    if (lineEnd - line < 64 + 2 + 1 || line[64] != ' ' || (line[65] != ' ' && line[65] != '*')) {
+        return -1;
+    }
+
+    for (int i = 0; i < 32; i++) {
+        int high = hexValue(line[i * 2]);
+        int low = hexValue(line[i * 2 + 1]);
+        if (high < 0 || low < 0) {
+            return -1;
+        }
+        hash[i] = (high << 4) | low;
+    }
+
+    const char* path = line + 66;
+    uint32_t length = lineEnd - path;
+    if (length > MAX_NAME_LENGTH) {
+        return -1;
+    }
+
+    const char* file = path;
+    if (length >= sizeof("install/") - 1 && memcmp(path, "install/", sizeof("install/") - 1) == 0) {
+        file += sizeof("install/") - 1;
+    }
+
+    for (const char* c = file; c < lineEnd; c++) {
+        if (*c == '/' || *c == '\\' || *c == ':') {
+            return -1;
+        }
+    }
+    if (file == lineEnd || file[0] == '.') {
+        return -1;
+    }
+
+    memcpy(name, path, length);
+    name[length] = '\0';
+    return 1;
+}
+
+static int writeManifest(TftpTransfer* transfer, const uint8_t* data, uint32_t size)
+{
+    FetchState* state = (FetchState*) transfer->userdata;
+    if (state->buffered + size > state->bufferSize) {
+        return -1;
+    }
+
+    memcpy(state->buffer + state->buffered, data, size);
+    state->buffered += size;
+    return 0;
+}
+
+static void drawProgress(FetchState* state, uint32_t received, uint32_t total)
+{
+    gfx_draw_rect_filled(16, state->index, PROGRESS_WIDTH, CHAR_SIZE_DRC_Y, COLOR_BACKGROUND);
+    if (total) {
+        gfx_printf(16, state->index, 0, "%lu KiB / %lu KiB", received / 1024, total / 1024);
+
+        uint32_t width = (received >= total) ? PROGRESS_WIDTH : (uint32_t) (((uint64_t) received * PROGRESS_WIDTH) / total);
+        gfx_draw_rect_filled(16, state->index + CHAR_SIZE_DRC_Y + 4, width, PROGRESS_HEIGHT, COLOR_SUCCESS);
+    } else {
+        gfx_printf(16, state->index, 0, "%lu KiB", received / 1024);
+    }
+}
+
+static int flushFile(FetchState* state)
+{
+    if (!state->buffered) {
+        return 0;
+    }
+
+    int res = IOSC_GenerateHash(state->hashContext, sizeof(state->hashContext), state->buffer, state->buffered, IOSC_HASH_FLAGS_SHA256_UPDATE, NULL, 0);
+    if (res < 0) {
+        return res;
+    }
+
+    res = FSA_WriteFile(fsaHandle, state->buffer, 1, state->buffered, state->fileHandle, 0);
+    if (res != (int) state->buffered) {
+        return (res < 0) ? res : -1;
+    }
+
+    state->buffered = 0;
+    return 0;
+}
+
+static int writeFile(TftpTransfer* transfer, const uint8_t* data, uint32_t size)
+{
+    FetchState* state = (FetchState*) transfer->userdata;
+    if (state->buffered + size > state->bufferSize) {
+        if (flushFile(state) < 0) {
+            return -1;
+        }
+
+        drawProgress(state, transfer->received, transfer->totalSize);
+    }
+
+    memcpy(state->buffer + state->buffered, data, size);
+    state->buffered += size;
+    return 0;
+}
+
+static int fetchFile(FetchState* state, uint32_t server, const char* name, const uint8_t* expectedHash, TftpTransfer* transfer)
+{
+    char path[0x100];
+    snprintf(path, sizeof(path), SD_PATH "%s", name);
+
+    int res = FSA_OpenFile(fsaHandle, path, "w", &state->fileHandle);
+    if (res < 0) {
+        snprintf(transfer->error, sizeof(transfer->error), "Failed to create file: %x", res);
+        return res;
+    }
+
+    state->buffered = 0;
+    res = IOSC_GenerateHash(state->hashContext, sizeof(state->hashContext), NULL, 0, IOSC_HASH_FLAGS_SHA256_INIT, NULL, 0);
+    if (res >= 0) {
+        transfer->write = writeFile;
+        res = tftp_get(server, name, transfer);
+        if (res < 0) {
+            if (!transfer->error[0]) {
+                snprintf(transfer->error, sizeof(transfer->error), "Transfer failed: %d", res);
+            }
+        } else {
+            res = flushFile(state);
+            if (res < 0) {
+                snprintf(transfer->error, sizeof(transfer->error), "Failed to write file: %x", res);
+            }
+        }
+    }
+
+    if (res >= 0) {
+        drawProgress(state, transfer->received, transfer->received);
+
+        uint8_t hash[32];
+        res = IOSC_GenerateHash(state->hashContext, sizeof(state->hashContext), NULL, 0, IOSC_HASH_FLAGS_SHA256_FINALIZE, hash, sizeof(hash));
+        if (res >= 0 && memcmp(hash, expectedHash, sizeof(hash)) != 0) {
+            strncpy(transfer->error, "SHA-256 mismatch", sizeof(transfer->error));
+            res = -1;
+        }
+    }
+
+    FSA_CloseFile(fsaHandle, state->fileHandle);
+    if (res < 0) {
+        // don't leave anything behind which could get installed or booted
+        FSA_Remove(fsaHandle, path);
+    }
+
+    return res;
+}
+
+void option_FetchTftp(void)
+{
+    gfx_clear(COLOR_BACKGROUND);
+    drawTopBar("Fetch Files over TFTP");
+
+    uint32_t index = 16 + 8 + 2 + 8;
+
+    char server[0x40] = "";
+    char manifest[0x40] = DEFAULT_MANIFEST;
+    int res = readNetworkConfig("tftp_server", server, sizeof(server));
+    if (res >= 0) {
+        res = readNetworkConfig("tftp_manifest", manifest, sizeof(manifest));
+    }
+    if (res < 0) {
+        printf_error(index, "Failed to read network.cfg: %x", res);
+        return;
+    }
+    if (!server[0]) {
+        print_error(index, "Add 'tftp_server=<address>' to network.cfg on the SD Card");
+        return;
+    }
+
+    res = initNetconf(&index);
+    if (res != 0) {
+        // An error occurred while initializing netconf.
+        waitButtonInput();
+        return;
+    }
+    index += 4;
+
+    uint32_t serverAddress;
+    if (netdb_resolve(server, &serverAddress, 1) <= 0) {
+        printf_error(index, "Failed to resolve %s", server);
+        return;
+    }
+
+    FetchState state;
+    memset(&state, 0, sizeof(state));
+    state.bufferSize = MANIFEST_SIZE;
+    state.buffer = IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, DATA_BUFFER_SIZE, 0x40);
+    char* manifestBuffer = IOS_HeapAlloc(LOCAL_PROCESS_HEAP_ID, MANIFEST_SIZE);
+    if (!state.buffer || !manifestBuffer) {
+        if (state.buffer) IOS_HeapFree(CROSS_PROCESS_HEAP_ID, state.buffer);
+        if (manifestBuffer) IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, manifestBuffer);
+        print_error(index, "Out of memory!");
+        return;
+    }
+
+    gfx_printf(16, index, 0, "Fetching %s from %s...", manifest, server);
+    index += CHAR_SIZE_DRC_Y + 4;
+
+    TftpTransfer transfer;
+    transfer.write = writeManifest;
+    transfer.userdata = &state;
+    res = tftp_get(serverAddress, manifest, &transfer);
+    if (res < 0) {
+        if (transfer.error[0]) {
+            printf_error(index, "Failed to fetch %s: %s", manifest, transfer.error);
+        } else {
+            printf_error(index, "Failed to fetch %s: %d", manifest, res);
+        }
+        goto done;
+    }
+
+    // the manifest is parsed from its own buffer, the data buffer is needed for the downloads
+    memcpy(manifestBuffer, state.buffer, state.buffered);
+    const char* manifestEnd = manifestBuffer + state.buffered;
+
+    uint8_t hash[32];
+    char name[MAX_NAME_LENGTH + 1];
+    uint32_t numFiles = 0;
+    int installFiles = 0;
+    const char* cursor = manifestBuffer;
+    while ((res = nextEntry(&cursor, manifestEnd, hash, name)) > 0) {
+        numFiles++;
+        if (strncmp(name, "install/", sizeof("install/") - 1) == 0) {
+            installFiles = 1;
+        }
+    }
+    if (res < 0 || numFiles == 0) {
+        printf_error(index, "%s has no valid entries, expected lines of '<sha256>  <file>'", manifest);
+        goto done;
+    }
+
+    index = gfx_printf(16, index, 0, "%lu files will be written to the SD Card, existing files are replaced.\nDo you want to continue?", numFiles);
+    index += CHAR_SIZE_DRC_Y + 4;
+
+    static const Menu fetchOptions[] = {
+        {"Cancel", {0} },
+        {"Download", {0} },
+    };
+    int selected = drawMenu("Fetch Files over TFTP",
+        fetchOptions, ARRAY_SIZE(fetchOptions), 0,
+        MenuFlag_NoClearScreen, 16, index);
+    if (selected == 0) {
+        goto done;
+    }
+
+    gfx_clear(COLOR_BACKGROUND);
+    drawTopBar("Fetch Files over TFTP");
+    index = 16 + 8 + 2 + 8;
+
+    if (installFiles) {
+        res = FSA_MakeDir(fsaHandle, SD_PATH "install", 0x600);
+        // -0x30016: already exists
+        if (res < 0 && res != -0x30016) {
+            printf_error(index, "Failed to create sd:/install: %x", res);
+            goto done;
+        }
+    }
+
+    state.bufferSize = DATA_BUFFER_SIZE;
+    state.index = index + CHAR_SIZE_DRC_Y + 4;
+    uint32_t file = 0;
+    uint32_t totalKiB = 0;
+    cursor = manifestBuffer;
+    while ((res = nextEntry(&cursor, manifestEnd, hash, name)) > 0) {
+        file++;
+
+        gfx_draw_rect_filled(16, index, PROGRESS_WIDTH, CHAR_SIZE_DRC_Y + 4 + CHAR_SIZE_DRC_Y + 4 + PROGRESS_HEIGHT, COLOR_BACKGROUND);
+        gfx_printf(16, index, 0, "(%lu/%lu) %s", file, numFiles, name);
+
+        res = fetchFile(&state, serverAddress, name, hash, &transfer);
+        if (res < 0) {
+            printf_error(state.index + CHAR_SIZE_DRC_Y + 4 + PROGRESS_HEIGHT + 8, "%s: %s", name, transfer.error);
+            goto done;
+        }
+        totalKiB += transfer.received / 1024;
+    }
+    if (res < 0 || file != numFiles) {
+        printf_error(state.index + CHAR_SIZE_DRC_Y + 4 + PROGRESS_HEIGHT + 8, "Only %lu of %lu files in %s were downloaded", file, numFiles, manifest);
+        goto done;
+    }
+
+    gfx_set_font_color(COLOR_SUCCESS);
+    gfx_printf(16, state.index + CHAR_SIZE_DRC_Y + 4 + PROGRESS_HEIGHT + 8, 0, "Done! %lu files (%lu KiB) downloaded and verified.", numFiles, totalKiB);
+    waitButtonInput();
+
+done:
+    IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, manifestBuffer);
+    IOS_HeapFree(CROSS_PROCESS_HEAP_ID, state.buffer);
+}
@@ -5,6 +5,8 @@
 #include "mcp_install.h"
 #include "imports.h"
 #include "utils.h"
+#include "trace.h"
+#include "stackmon.h"
 #include <unistd.h>
 
 static int callbackQueue = -1;
@@ -100,6 +102,7 @@ void option_InstallWUP(void)
         return;
     }
 
+    stackmon_register("install", callbackThreadStack, sizeof(callbackThreadStack));
     int callbackThreadId = IOS_CreateThread(callbackThread, NULL, callbackThreadStack + sizeof(callbackThreadStack), sizeof(callbackThreadStack), IOS_GetThreadPriority(0), IOS_THREAD_FLAGS_NONE);
     if (callbackThreadId < 0) {
         IOS_DestroyMessageQueue(callbackQueue);
@@ -133,6 +136,7 @@ void option_InstallWUP(void)
         MCPInstallProgress progress;
         res = MCP_InstallGetProgress(mcpHandle, &progress);
         if (res >= 0) {
+            TRACE_INSTANT(TRACE_TAG_MCP_INSTALL_PROGRESS, progress.sizeProgress / 1024llu, progress.contentsProgress);
             gfx_printf(16, index, GfxPrintFlag_ClearBG, "Installing... (%lu KiB / %lu KiB)", (uint32_t) (progress.sizeProgress / 1024llu), (uint32_t) (progress.sizeTotal / 1024llu));
         }
 
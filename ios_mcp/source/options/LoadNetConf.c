@@ -4,10 +4,24 @@
 #include "gfx.h"
 #include "netconf.h"
 #include "fsa.h"
+#include "netdb.h"
 
 #include <string.h>
 
-static void network_parse_config_value(uint32_t* console_idx, NetConfCfg* cfg, const char* key, const char* value, uint32_t value_len)
+static void network_parse_ipv4_value(uint32_t* console_idx, const char* name, const char* value, uint32_t* address)
+{
+    gfx_printf(16, *console_idx, 0, "%s: %s", name, value);
+    (*console_idx) += CHAR_SIZE_DRC_Y + 4;
+
+    const char* end = value ? netdb_parse_address(value, address) : NULL;
+    if (!end || *end) {
+        *address = 0;
+        gfx_print(16, *console_idx, 0, "Invalid address!");
+        (*console_idx) += CHAR_SIZE_DRC_Y + 4;
+    }
+}
+
+static void network_parse_config_value(uint32_t* console_idx, NetConfCfg* cfg, NetConfIPv4Info* ipv4, const char* key, const char* value, uint32_t value_len)
 {
     if (strncmp(key, "type", sizeof("type")) == 0) {
         gfx_printf(16, *console_idx, 0, "Type: %s", value);
@@ -64,6 +78,26 @@ static void network_parse_config_value(uint32_t* console_idx, NetConfCfg* cfg, c
                 (*console_idx) += CHAR_SIZE_DRC_Y + 4;
             }
         }
+    } else if (strncmp(key, "ip", sizeof("ip")) == 0) {
+        network_parse_ipv4_value(console_idx, "IP address", value, &ipv4->addr);
+    } else if (strncmp(key, "netmask", sizeof("netmask")) == 0) {
+        network_parse_ipv4_value(console_idx, "Netmask", value, &ipv4->netmask);
+    } else if (strncmp(key, "gateway", sizeof("gateway")) == 0) {
+        network_parse_ipv4_value(console_idx, "Gateway", value, &ipv4->nexthop);
+    } else if (strncmp(key, "dns", sizeof("dns")) == 0) {
+        gfx_printf(16, *console_idx, 0, "DNS: %s", value);
+        (*console_idx) += CHAR_SIZE_DRC_Y + 4;
+
+        // one or two servers, separated by a comma
+        const char* end = value ? netdb_parse_address(value, &ipv4->ns1) : NULL;
+        if (end && *end == ',') {
+            end = netdb_parse_address(end + 1, &ipv4->ns2);
+        }
+        if (!end || *end) {
+            ipv4->ns1 = ipv4->ns2 = 0;
+            gfx_print(16, *console_idx, 0, "Invalid address!");
+            (*console_idx) += CHAR_SIZE_DRC_Y + 4;
+        }
     }
 }
 
@@ -120,6 +154,10 @@ void option_LoadNetConf(void)
     NetConfCfg cfg;
     memset(&cfg, 0, sizeof(cfg));
 
+    // static addresses can be set before or after the type, so they're applied once the whole file is parsed
+    NetConfIPv4Info ipv4;
+    memset(&ipv4, 0, sizeof(ipv4));
+
     // parse network cfg file
     const char* keyPtr = cfgBuffer;
     const char* valuePtr = NULL;
@@ -136,7 +174,7 @@ void option_LoadNetConf(void)
                 cfgBuffer[end] = '\0';
             }
 
-            network_parse_config_value(&index, &cfg, keyPtr, valuePtr, (cfgBuffer + end) - valuePtr);
+            network_parse_config_value(&index, &cfg, &ipv4, keyPtr, valuePtr, (cfgBuffer + end) - valuePtr);
 
             keyPtr = cfgBuffer + i + 1;
             valuePtr = NULL;
@@ -145,7 +183,22 @@ void option_LoadNetConf(void)
 
     // if valuePtr isn't NULL there is another option without a newline at the end
     if (valuePtr) {
-        network_parse_config_value(&index, &cfg, keyPtr, valuePtr, (cfgBuffer + stat.size) - valuePtr);
+        network_parse_config_value(&index, &cfg, &ipv4, keyPtr, valuePtr, (cfgBuffer + stat.size) - valuePtr);
+    }
+
+    // without DHCP the address can be used as soon as the link is up
+    if (ipv4.addr) {
+        if (!ipv4.netmask) {
+            ipv4.netmask = 0xffffff00;
+        }
+        ipv4.mode = NET_CONFIG_IPV4_MODE_NO_AUTO_OBTAIN_IP;
+
+        if (cfg.wl0.if_sate) {
+            cfg.wl0.ipv4Info = ipv4;
+        }
+        if (cfg.eth0.if_sate) {
+            cfg.eth0.ipv4Info = ipv4;
+        }
     }
 
     gfx_print(16, index, 0, "Applying configuration...");
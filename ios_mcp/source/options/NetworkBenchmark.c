@@ -0,0 +1,164 @@
+#include "NetworkBenchmark.h"
+
+#include "menu.h"
+#include "gfx.h"
+#include "netbench.h"
+#include "netdb.h"
+#include "utils.h"
+
+#include <string.h>
+
+#ifdef NETBENCH
+
+#define TEST_SECONDS 3
+
+typedef struct {
+    NetbenchTest test;
+    NetbenchApi api;
+    uint32_t size;
+} BenchmarkTest;
+
+// the sizes of the TCP tests are the sizes of the send and receive calls, the UDP ones are datagram sizes
+static const BenchmarkTest benchmarkTests[] = {
+    { NETBENCH_TEST_UDP_ECHO, NETBENCH_API_COPY,   64 },
+    { NETBENCH_TEST_TCP_SEND, NETBENCH_API_COPY,   0x1000 },
+    { NETBENCH_TEST_TCP_SEND, NETBENCH_API_COPY,   0x4000 },
+    { NETBENCH_TEST_TCP_SEND, NETBENCH_API_COPY,   0x10000 },
+    { NETBENCH_TEST_TCP_SEND, NETBENCH_API_VECTOR, 0x1000 },
+    { NETBENCH_TEST_TCP_SEND, NETBENCH_API_VECTOR, 0x4000 },
+    { NETBENCH_TEST_TCP_SEND, NETBENCH_API_VECTOR, 0x10000 },
+    { NETBENCH_TEST_TCP_RECV, NETBENCH_API_COPY,   0x1000 },
+    { NETBENCH_TEST_TCP_RECV, NETBENCH_API_COPY,   0x4000 },
+    { NETBENCH_TEST_TCP_RECV, NETBENCH_API_COPY,   0x10000 },
+    { NETBENCH_TEST_TCP_RECV, NETBENCH_API_VECTOR, 0x1000 },
+    { NETBENCH_TEST_TCP_RECV, NETBENCH_API_VECTOR, 0x4000 },
+    { NETBENCH_TEST_TCP_RECV, NETBENCH_API_VECTOR, 0x10000 },
+    { NETBENCH_TEST_UDP_SEND, NETBENCH_API_COPY,   512 },
+    { NETBENCH_TEST_UDP_SEND, NETBENCH_API_COPY,   1472 },
+    { NETBENCH_TEST_UDP_SEND, NETBENCH_API_VECTOR, 1472 },
+};
+
+static const char* const testNames[] = {
+    [NETBENCH_TEST_TCP_SEND] = "TCP send",
+    [NETBENCH_TEST_TCP_RECV] = "TCP recv",
+    [NETBENCH_TEST_UDP_SEND] = "UDP send",
+    [NETBENCH_TEST_UDP_ECHO] = "UDP echo",
+};
+
+static const char* const apiNames[][2] = {
+    [NETBENCH_TEST_TCP_SEND] = { "send()",   "sendv()" },
+    [NETBENCH_TEST_TCP_RECV] = { "recv()",   "recvv()" },
+    [NETBENCH_TEST_UDP_SEND] = { "sendto()", "sendv()" },
+    [NETBENCH_TEST_UDP_ECHO] = { "send()",   "send()" },
+};
+
+// format a rate as MiB/s with the given number of decimal places (1 or 2)
+static int formatRate(char* buf, uint32_t size, uint32_t bytes, uint32_t microseconds, uint32_t decimals)
+{
+    uint32_t scale = (decimals == 1) ? 10 : 100;
+    uint32_t rate = microseconds ? (uint32_t) ((uint64_t) bytes * scale * 1000000 / ((uint64_t) microseconds << 20)) : 0;
+    return snprintf(buf, size, (decimals == 1) ? "%lu.%01lu" : "%lu.%02lu", rate / scale, rate % scale);
+}
+
+static void formatResult(char* line, uint32_t size, const BenchmarkTest* test, const NetbenchResult* result)
+{
+    int length = snprintf(line, size, "%s  %-8s %6lu  ", testNames[test->test], apiNames[test->test][test->api], test->size);
+
+    if (test->test == NETBENCH_TEST_UDP_ECHO) {
+        snprintf(line + length, size - length, "%lu/%lu answered, RTT min %lu.%02lu avg %lu.%02lu max %lu.%02lu ms",
+            result->received, result->sent,
+            result->rttMin / 1000, (result->rttMin % 1000) / 10,
+            result->rttAvg / 1000, (result->rttAvg % 1000) / 10,
+            result->rttMax / 1000, (result->rttMax % 1000) / 10);
+        return;
+    }
+
+    length += formatRate(line + length, size - length, result->bytes, result->time, 2);
+    length += snprintf(line + length, size - length, " MiB/s ");
+
+    if (test->test == NETBENCH_TEST_UDP_SEND && result->sent) {
+        uint32_t lost = (result->sent > result->received) ? result->sent - result->received : 0;
+        uint32_t permille = (uint32_t) ((uint64_t) lost * 1000 / result->sent);
+        length += snprintf(line + length, size - length, "%2lu.%01lu%% lost ", permille / 10, permille % 10);
+    }
+
+    // what the console sent or received in every second
+    for (uint32_t i = 0; i < result->seconds && length < size; i++) {
+        length += snprintf(line + length, size - length, (i == 0) ? " [" : " ");
+        length += formatRate(line + length, size - length, result->timeline[i], 1000000, 1);
+    }
+    if (length < size) {
+        snprintf(line + length, size - length, "]");
+    }
+}
+
+void option_NetworkBenchmark(void)
+{
+    gfx_clear(COLOR_BACKGROUND);
+    drawTopBar("Network Benchmark");
+
+    uint32_t index = 16 + 8 + 2 + 8;
+
+    char server[0x40] = "";
+    int res = readNetworkConfig("bench_server", server, sizeof(server));
+    if (res < 0) {
+        printf_error(index, "Failed to read network.cfg: %x", res);
+        return;
+    }
+    if (!server[0]) {
+        print_error(index, "Add 'bench_server=<address>' to network.cfg on the SD Card");
+        return;
+    }
+
+    res = initNetconf(&index);
+    if (res != 0) {
+        // An error occurred while initializing netconf.
+        waitButtonInput();
+        return;
+    }
+    index += 4;
+
+    uint32_t serverAddress;
+    if (netdb_resolve(server, &serverAddress, 1) <= 0) {
+        printf_error(index, "Failed to resolve %s", server);
+        return;
+    }
+
+    gfx_printf(16, index, 0, "Testing against %s port %d, %d seconds per test...", server, NETBENCH_PORT, TEST_SECONDS);
+    index += CHAR_SIZE_DRC_Y + 4;
+
+    // results also go to the log, to compare them later
+    printf("Network benchmark against %s\n", server);
+
+    char line[0x80];
+    for (uint32_t i = 0; i < ARRAY_SIZE(benchmarkTests); i++) {
+        const BenchmarkTest* test = &benchmarkTests[i];
+        gfx_set_font_color(COLOR_PRIMARY);
+        gfx_printf(16, index, 0, "%s  %-8s %6lu  ...", testNames[test->test], apiNames[test->test][test->api], test->size);
+
+        NetbenchResult result;
+        res = netbench_run(serverAddress, test->test, test->api, test->size, TEST_SECONDS, &result);
+        if (res < 0) {
+            // nothing works without the peer, other failures only affect the test
+            if (i == 0) {
+                printf_error(index, "Failed to reach the peer on %s: %d", server, res);
+                return;
+            }
+
+            snprintf(line, sizeof(line), "%s  %-8s %6lu  failed: %d", testNames[test->test], apiNames[test->test][test->api], test->size, res);
+            gfx_set_font_color(COLOR_ERROR);
+        } else {
+            formatResult(line, sizeof(line), test, &result);
+        }
+
+        gfx_print(16, index, GfxPrintFlag_ClearBG, line);
+        printf("%s\n", line);
+        index += CHAR_SIZE_DRC_Y + 2;
+    }
+
+    gfx_set_font_color(COLOR_SUCCESS);
+    gfx_print(16, index + 2, 0, "Done!");
+    waitButtonInput();
+}
+
+#endif /* NETBENCH */
@@ -0,0 +1,266 @@
+#include "Profiler.h"
+
+#include "menu.h"
+#include "gfx.h"
+#include "fsa.h"
+#include "utils.h"
+#include "imports.h"
+#include "stackmon.h"
+
+#include <stddef.h>
+
+#ifdef PROFILER
+
+#define PROFILE_MAGIC 0x50524f46 // "PROF"
+#define PROFILE_VERSION 1
+
+// sample every timer interrupt
+#define PROFILE_INTERVAL 1
+
+#define PROFILE_CHUNK_SIZE 0x800
+#define PROFILE_PATH "/vol/storage_recovsd/profile.bin"
+
+#define DRAIN_STACK_SIZE 0x400
+// the kernel only buffers 1024 samples, drain them long before they run out
+#define DRAIN_INTERVAL (50 * 1000)
+
+enum {
+    DRAIN_MESSAGE_STOP_THREAD,
+    DRAIN_MESSAGE_DRAIN,
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t interval;
+    uint32_t dropped;
+} ProfileHeader;
+
+static int profilerRunning = 0;
+
+static int drainThreadHandle = -1;
+static uint8_t* drainThreadStack = NULL;
+static uint32_t drainMessageQueueBuf[0x4];
+static int drainMessageQueue = -1;
+static int drainTimer = -1;
+// used for both the header and the samples
+static uint8_t* drainBuffer = NULL;
+static int profileFile = -1;
+// first error while writing, the drain thread stops writing once it's set
+static volatile int drainError = 0;
+
+// write everything the kernel buffered so far to the profile
+static void drainSamples(void)
+{
+    while (drainError >= 0) {
+        int read = kernProfilerRead(drainBuffer, PROFILE_CHUNK_SIZE);
+        if (read <= 0) {
+            if (read < 0) {
+                drainError = read;
+            }
+            break;
+        }
+
+        int res = FSA_WriteFile(fsaHandle, drainBuffer, 1, read, profileFile, 0);
+        if (res < 0) {
+            drainError = res;
+        }
+    }
+}
+
+static int drainThread(void* arg)
+{
+    while (1) {
+        uint32_t message;
+        if (IOS_ReceiveMessage(drainMessageQueue, &message, IOS_MESSAGE_FLAGS_NONE) < 0) {
+            return 0;
+        }
+
+        drainSamples();
+
+        if (message == DRAIN_MESSAGE_STOP_THREAD) {
+            return 0;
+        }
+    }
+}
+
+static void stopDrain(void)
+{
+    if (drainTimer >= 0) {
+        IOS_DestroyTimer(drainTimer);
+        drainTimer = -1;
+    }
+
+    // the thread drains what is left before it stops
+    if (drainThreadHandle >= 0) {
+        IOS_SendMessage(drainMessageQueue, DRAIN_MESSAGE_STOP_THREAD, IOS_MESSAGE_FLAGS_NONE);
+        IOS_JoinThread(drainThreadHandle, NULL);
+        drainThreadHandle = -1;
+    }
+
+    if (drainMessageQueue >= 0) {
+        IOS_DestroyMessageQueue(drainMessageQueue);
+        drainMessageQueue = -1;
+    }
+
+    if (drainThreadStack) {
+        stackmon_unregister(drainThreadStack);
+        IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, drainThreadStack);
+        drainThreadStack = NULL;
+    }
+}
+
+static void closeProfile(void)
+{
+    if (profileFile >= 0) {
+        FSA_CloseFile(fsaHandle, profileFile);
+        profileFile = -1;
+    }
+
+    if (drainBuffer) {
+        IOS_HeapFree(CROSS_PROCESS_HEAP_ID, drainBuffer);
+        drainBuffer = NULL;
+    }
+}
+
+// create the profile and start the thread which streams the samples into it
+static int startDrain(void)
+{
+    drainError = 0;
+    drainBuffer = IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, PROFILE_CHUNK_SIZE, 0x40);
+    drainThreadStack = IOS_HeapAllocAligned(LOCAL_PROCESS_HEAP_ID, DRAIN_STACK_SIZE, 0x20);
+    if (!drainBuffer || !drainThreadStack) {
+        if (drainThreadStack) {
+            IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, drainThreadStack);
+            drainThreadStack = NULL;
+        }
+        closeProfile();
+        return -1;
+    }
+
+    int res = FSA_OpenFile(fsaHandle, PROFILE_PATH, "w", &profileFile);
+    if (res < 0) {
+        profileFile = -1;
+        IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, drainThreadStack);
+        drainThreadStack = NULL;
+        closeProfile();
+        return res;
+    }
+
+    // the dropped samples are only known once the profiler is stopped, see finishProfile
+    ProfileHeader* header = (ProfileHeader*) drainBuffer;
+    header->magic = PROFILE_MAGIC;
+    header->version = PROFILE_VERSION;
+    header->interval = PROFILE_INTERVAL;
+    header->dropped = 0;
+    res = FSA_WriteFile(fsaHandle, header, 1, sizeof(*header), profileFile, 0);
+    if (res < 0) {
+        IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, drainThreadStack);
+        drainThreadStack = NULL;
+        closeProfile();
+        return res;
+    }
+
+    drainMessageQueue = IOS_CreateMessageQueue(drainMessageQueueBuf, sizeof(drainMessageQueueBuf) / 4);
+    if (drainMessageQueue < 0) {
+        res = drainMessageQueue;
+        stopDrain();
+        closeProfile();
+        return res;
+    }
+
+    stackmon_register("profiler", drainThreadStack, DRAIN_STACK_SIZE);
+
+    // the drain thread is sampled as well, it can be told apart by its thread id
+    drainThreadHandle = IOS_CreateThread(drainThread, NULL, drainThreadStack + DRAIN_STACK_SIZE, DRAIN_STACK_SIZE, IOS_GetThreadPriority(0), IOS_THREAD_FLAGS_NONE);
+    if (drainThreadHandle < 0 || IOS_StartThread(drainThreadHandle) < 0) {
+        res = drainThreadHandle;
+        stopDrain();
+        closeProfile();
+        return (res < 0) ? res : -1;
+    }
+
+    drainTimer = IOS_CreateTimer(DRAIN_INTERVAL, DRAIN_INTERVAL, drainMessageQueue, DRAIN_MESSAGE_DRAIN);
+    if (drainTimer < 0) {
+        res = drainTimer;
+        stopDrain();
+        closeProfile();
+        return res;
+    }
+
+    return 0;
+}
+
+// drain the remaining samples and store the dropped count in the header
+static int finishProfile(uint32_t dropped)
+{
+    stopDrain();
+
+    int res = drainError;
+    if (res >= 0) {
+        res = FSA_SetPosFile(fsaHandle, profileFile, offsetof(ProfileHeader, dropped));
+    }
+    if (res >= 0) {
+        *(uint32_t*) drainBuffer = dropped;
+        res = FSA_WriteFile(fsaHandle, drainBuffer, 1, sizeof(uint32_t), profileFile, 0);
+    }
+
+    closeProfile();
+    return res;
+}
+
+void option_Profiler(void)
+{
+    gfx_clear(COLOR_BACKGROUND);
+
+    drawTopBar("Profiler");
+
+    uint32_t index = 16 + 8 + 2 + 8;
+
+    if (!profilerRunning) {
+        int res = kernProfilerControl(PROFILE_INTERVAL);
+        if (res < 0) {
+            printf_error(index, "Failed to start profiler: %x", res);
+            return;
+        }
+
+        res = startDrain();
+        if (res < 0) {
+            kernProfilerControl(0);
+            printf_error(index, "Failed to create profile.bin: %x", res);
+            return;
+        }
+
+        profilerRunning = 1;
+        gfx_set_font_color(COLOR_SUCCESS);
+        gfx_print(16, index, 0, "Profiler started!");
+        index += CHAR_SIZE_DRC_Y + 4;
+        gfx_set_font_color(COLOR_PRIMARY);
+        gfx_print(16, index, 0, "Samples are written to profile.bin, select this option again to stop.");
+        waitButtonInput();
+        return;
+    }
+
+    setNotificationLED(NOTIF_LED_RED_BLINKING, 0);
+
+    int dropped = kernProfilerControl(0);
+    profilerRunning = 0;
+
+    gfx_print(16, index, 0, "Finishing profile.bin...");
+    index += CHAR_SIZE_DRC_Y + 4;
+
+    int res = finishProfile(dropped);
+    if (res < 0) {
+        printf_error(index, "Failed to write profile: %x", res);
+        return;
+    }
+
+    setNotificationLED(NOTIF_LED_PURPLE, 0);
+    gfx_printf(16, index, 0, "%d samples dropped", dropped);
+    index += CHAR_SIZE_DRC_Y + 4;
+    gfx_set_font_color(COLOR_SUCCESS);
+    gfx_print(16, index, 0, "Done! Symbolize with tools/symbolize_profile.py");
+    waitButtonInput();
+}
+
+#endif /* PROFILER */
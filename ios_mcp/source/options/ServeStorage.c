@@ -0,0 +1,152 @@
+/*
+ *   Copyright (C) 2022 GaryOderNichts
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "ServeStorage.h"
+
+#include "gfx.h"
+#include "menu.h"
+#include "fsa.h"
+#include "logger.h"
+#include "nbd.h"
+#include "netconf.h"
+#include "utils.h"
+
+#include <stdint.h>
+
+#ifdef NBD
+
+#define DEVICE_SD 3
+
+// whether the SD log was enabled before the SD Card was unmounted
+static int sdLogEnabled = 0;
+
+// the SD Card is mounted by the menu itself, so it can be unmounted for read-write exports
+static int unmountSd(void)
+{
+    // the log file has to be closed first
+    sdLogEnabled = logger_sink_enabled(LOGGER_SINK_SD);
+    logger_enable_sink(LOGGER_SINK_SD, 0);
+    logger_sync();
+
+    int res = FSA_Unmount(fsaHandle, "/vol/storage_recovsd", 2);
+    if (res < 0) {
+        logger_enable_sink(LOGGER_SINK_SD, sdLogEnabled);
+    }
+
+    return res;
+}
+
+static int remountSd(void)
+{
+    int res = FSA_Mount(fsaHandle, "/dev/sdcard01", "/vol/storage_recovsd", 2, NULL, 0);
+    if (res >= 0) {
+        logger_enable_sink(LOGGER_SINK_SD, sdLogEnabled);
+    }
+
+    return res;
+}
+
+void option_ServeStorage(void)
+{
+    static const Menu deviceOptions[] = {
+        {"Back", {0} },
+        {"MLC", {0} },
+        {"SLC", {0} },
+        {"SD Card", {0} },
+    };
+    static const char* const devicePaths[] = {
+        NULL,
+        "/dev/mlc01",
+        "/dev/slc01",
+        "/dev/sdcard01",
+    };
+
+    static const Menu modeOptions[] = {
+        {"Read-only", {0} },
+        {"Read-write (the SD Card is unmounted while exported)", {0} },
+    };
+
+    uint32_t index = 16 + 8 + 2 + 8;
+    int device = drawMenu("Serve Storage over Network",
+        deviceOptions, ARRAY_SIZE(deviceOptions), 0,
+        0, 16, index);
+    if (device == 0)
+        return;
+
+    // MLC and SLC stay mounted by the system, writing to them underneath it would corrupt them
+    int mode = 0;
+    if (device == DEVICE_SD) {
+        mode = drawMenu("Serve Storage over Network",
+            modeOptions, ARRAY_SIZE(modeOptions), 0,
+            0, 16, index);
+    }
+
+    gfx_clear(COLOR_BACKGROUND);
+    drawTopBar("Serving storage over network...");
+
+    int res = initNetconf(&index);
+    if (res != 0) {
+        // An error occurred while initializing netconf.
+        waitButtonInput();
+        return;
+    }
+
+    if (mode != 0) {
+        res = unmountSd();
+        if (res < 0) {
+            printf_error(index, "Failed to unmount the SD Card: %x", res);
+            return;
+        }
+    }
+
+    uint64_t size = 0;
+    res = nbd_init(devicePaths[device], mode == 0, &size);
+    if (res < 0) {
+        if (mode != 0) {
+            remountSd();
+        }
+        printf_error(index, "Failed to open %s: %x", devicePaths[device], res);
+        return;
+    }
+
+    index += 4;
+    gfx_set_font_color(COLOR_PRIMARY);
+    index = gfx_printf(16, index, 0, "Exporting %s (%lu MiB, %s) over NBD on port %d.",
+        deviceOptions[device].name, (uint32_t) (size >> 20), (mode == 0) ? "read-only" : "read-write", NBD_PORT);
+    index += 4;
+    gfx_set_font_color(COLOR_SUCCESS);
+    gfx_print(16, index, 0, "NBD server running. Press EJECT or POWER to stop.");
+    index += CHAR_SIZE_DRC_Y + 4;
+
+    waitButtonInput();
+
+    gfx_set_font_color(COLOR_PRIMARY);
+    gfx_print(16, index, 0, "Stopping NBD server...");
+    index += CHAR_SIZE_DRC_Y + 4;
+
+    nbd_deinit();
+
+    if (mode != 0) {
+        res = remountSd();
+        if (res < 0) {
+            printf_error(index, "Failed to mount the SD Card again: %x", res);
+            return;
+        }
+    }
+}
+
+#endif /* NBD */
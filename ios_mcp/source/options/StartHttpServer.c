@@ -0,0 +1,64 @@
+/*
+ *   Copyright (C) 2022 GaryOderNichts
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "StartHttpServer.h"
+
+#include "gfx.h"
+#include "menu.h"
+#include "netconf.h"
+#include "httpserver.h"
+
+#include <stdint.h>
+
+#ifdef HTTPSERVER
+
+void option_StartHttpServer(void)
+{
+    gfx_clear(COLOR_BACKGROUND);
+    drawTopBar("Running HTTP file server...");
+
+    uint32_t index = 16 + 8 + 2 + 8;
+    int res = initNetconf(&index);
+    if (res != 0) {
+        // An error occurred while initializing netconf.
+        waitButtonInput();
+        return;
+    }
+
+    if (httpserver_init() < 0) {
+        print_error(index, "Out of memory!");
+        return;
+    }
+
+    index += 4;
+    gfx_set_font_color(COLOR_PRIMARY);
+    gfx_print(16, index, 0, "Open http://<IP address>/ in a browser to browse the SD Card, SLC and MLC.");
+    index += CHAR_SIZE_DRC_Y + 4;
+    gfx_set_font_color(COLOR_SUCCESS);
+    gfx_print(16, index, 0, "HTTP server running. Press EJECT or POWER to stop.");
+    index += CHAR_SIZE_DRC_Y + 4;
+
+    waitButtonInput();
+
+    gfx_set_font_color(COLOR_PRIMARY);
+    gfx_print(16, index, 0, "Stopping HTTP server...");
+    index += CHAR_SIZE_DRC_Y + 4;
+
+    httpserver_deinit();
+}
+
+#endif /* HTTPSERVER */
@@ -0,0 +1,300 @@
+#include "StreamSyslogs.h"
+
+#include "menu.h"
+#include "gfx.h"
+#include "fsa.h"
+#include "netdb.h"
+#include "socket.h"
+#include "utils.h"
+
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Follows the files in /vol/system/logs and sends new lines over UDP, to syslog_host from network.cfg
+ * or as broadcast. Every datagram starts with a sequence number (uint32_t, big endian) which counts
+ * the datagrams of the stream, followed by the null terminated file name and complete lines of the file.
+ * tools/syslog_listener.py prints them and reports lost datagrams.
+ */
+
+#define SYSLOG_PATH "/vol/system/logs"
+#define SYSLOG_STREAM_PORT 4406
+
+#define MAX_LOG_FILES 16
+// room in front of the data for the sequence number and the file name
+#define HEADER_SIZE 0x40
+#define MAX_NAME_LENGTH (HEADER_SIZE - 4 - 1)
+// keeps datagrams within an ethernet frame
+#define MAX_DATA_SIZE 1400
+
+// in milliseconds, polls quickly while the logs are written to and backs off while they aren't
+#define POLL_MIN_DELAY  20
+#define POLL_MAX_DELAY  320
+// new log files are picked up every few seconds
+#define RESCAN_INTERVAL 2000
+
+typedef struct {
+    // -1 for unused entries
+    int handle;
+    uint32_t position;
+    char name[MAX_NAME_LENGTH + 1];
+} LogFile;
+
+typedef struct {
+    LogFile files[MAX_LOG_FILES];
+    uint32_t numFiles;
+
+    int socket;
+    struct sockaddr_in destination;
+    uint32_t sequence;
+    uint32_t bytes;
+
+    // HEADER_SIZE + MAX_DATA_SIZE, the data is read to HEADER_SIZE and the header goes right in front of it
+    uint8_t* buffer;
+} StreamState;
+
+static void scanLogs(StreamState* state, int skipExisting)
+{
+    int dirHandle;
+    if (FSA_OpenDir(fsaHandle, SYSLOG_PATH, &dirHandle) < 0) {
+        return;
+    }
+
+    FSDirectoryEntry entry;
+    while (FSA_ReadDir(fsaHandle, dirHandle, &entry) >= 0) {
+        uint32_t nameLength = strnlen(entry.name, sizeof(entry.name));
+        if ((entry.stat.flags & DIR_ENTRY_IS_DIRECTORY) || nameLength > MAX_NAME_LENGTH) {
+            continue;
+        }
+
+        LogFile* file = NULL;
+        int known = 0;
+        for (int i = 0; i < MAX_LOG_FILES; i++) {
+            if (state->files[i].handle < 0) {
+                if (!file) {
+                    file = &state->files[i];
+                }
+            } else if (strncmp(state->files[i].name, entry.name, sizeof(state->files[i].name)) == 0) {
+                known = 1;
+                break;
+            }
+        }
+        if (known || !file) {
+            continue;
+        }
+
+        char path[sizeof(SYSLOG_PATH "/") + MAX_NAME_LENGTH];
+        snprintf(path, sizeof(path), SYSLOG_PATH "/%s", entry.name);
+        if (FSA_OpenFile(fsaHandle, path, "r", &file->handle) < 0) {
+            file->handle = -1;
+            continue;
+        }
+
+        memcpy(file->name, entry.name, nameLength + 1);
+        // files which already exist when the stream starts are followed from their current end
+        file->position = skipExisting ? entry.stat.size : 0;
+        state->numFiles++;
+    }
+
+    FSA_CloseDir(fsaHandle, dirHandle);
+}
+
+// send what was appended to a file since the last call, returns the number of bytes sent
+static int streamFile(StreamState* state, LogFile* file)
+{
+    FSStat stat;
+    if (FSA_StatFile(fsaHandle, file->handle, &stat) < 0) {
+        // the file is gone, a new one is picked up by the next scan
+        FSA_CloseFile(fsaHandle, file->handle);
+        file->handle = -1;
+        state->numFiles--;
+        return 0;
+    }
+
+    // the file was truncated
+    if (stat.size < file->position) {
+        file->position = 0;
+    }
+
+    uint32_t nameLength = strnlen(file->name, MAX_NAME_LENGTH);
+    uint8_t* data = state->buffer + HEADER_SIZE;
+    uint8_t* header = data - (4 + nameLength + 1);
+    int sent = 0;
+    while (file->position < stat.size) {
+        uint32_t size = stat.size - file->position;
+        if (size > MAX_DATA_SIZE) {
+            size = MAX_DATA_SIZE;
+        }
+
+        if (FSA_SetPosFile(fsaHandle, file->handle, file->position) < 0) {
+            break;
+        }
+        int res = FSA_ReadFile(fsaHandle, data, 1, size, file->handle, 0);
+        if (res <= 0) {
+            break;
+        }
+
+        // only complete lines are sent, unless a line doesn't fit into a datagram
+        uint32_t length = res;
+        while (length > 0 && data[length - 1] != '\n') {
+            length--;
+        }
+        if (length == 0) {
+            if ((uint32_t) res < MAX_DATA_SIZE) {
+                // the rest of the line isn't written yet
+                break;
+            }
+            length = res;
+        }
+
+        header[0] = state->sequence >> 24;
+        header[1] = state->sequence >> 16;
+        header[2] = state->sequence >> 8;
+        header[3] = state->sequence;
+        memcpy(header + 4, file->name, nameLength + 1);
+
+        res = sendto(state->socket, header, (data + length) - header, 0, (struct sockaddr*) &state->destination, sizeof(state->destination));
+        if (res < 0) {
+            return res;
+        }
+
+        state->sequence++;
+        state->bytes += length;
+        file->position += length;
+        sent += length;
+    }
+
+    return sent;
+}
+
+void option_StreamSyslogs(void)
+{
+    gfx_clear(COLOR_BACKGROUND);
+    drawTopBar("Streaming Syslogs...");
+
+    uint32_t index = 16 + 8 + 2 + 8;
+
+    // without a host the lines are broadcast
+    char host[0x40] = "";
+    readNetworkConfig("syslog_host", host, sizeof(host));
+
+    int res = initNetconf(&index);
+    if (res != 0) {
+        // An error occurred while initializing netconf.
+        waitButtonInput();
+        return;
+    }
+    index += 4;
+
+    uint32_t address = INADDR_BROADCAST;
+    if (host[0] && netdb_resolve(host, &address, 1) <= 0) {
+        printf_error(index, "Failed to resolve %s", host);
+        return;
+    }
+
+    StreamState* state = IOS_HeapAlloc(LOCAL_PROCESS_HEAP_ID, sizeof(StreamState));
+    uint8_t* buffer = IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, HEADER_SIZE + MAX_DATA_SIZE, 0x40);
+    if (!state || !buffer) {
+        if (state) IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, state);
+        if (buffer) IOS_HeapFree(CROSS_PROCESS_HEAP_ID, buffer);
+        print_error(index, "Out of memory!");
+        return;
+    }
+
+    memset(state, 0, sizeof(*state));
+    for (int i = 0; i < MAX_LOG_FILES; i++) {
+        state->files[i].handle = -1;
+    }
+    state->buffer = buffer;
+    state->destination.sin_family = AF_INET;
+    state->destination.sin_port = SYSLOG_STREAM_PORT;
+    state->destination.sin_addr.s_addr = address;
+
+    state->socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (state->socket < 0) {
+        printf_error(index, "Failed to create socket: %x", state->socket);
+        goto done;
+    }
+
+    if (!host[0]) {
+        int enable = 1;
+        res = setsockopt(state->socket, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable));
+        if (res < 0) {
+            printf_error(index, "Failed to enable broadcasts: %x", res);
+            goto done;
+        }
+    }
+
+    gfx_printf(16, index, 0, "Sending new lines of %s to %s port %d", SYSLOG_PATH, host[0] ? host : "broadcast", SYSLOG_STREAM_PORT);
+    index += CHAR_SIZE_DRC_Y + 4;
+    gfx_set_font_color(COLOR_SUCCESS);
+    gfx_print(16, index, 0, "Streaming. Press EJECT or POWER to stop.");
+    index += CHAR_SIZE_DRC_Y + 4;
+    gfx_set_font_color(COLOR_PRIMARY);
+
+    scanLogs(state, 1);
+
+    uint64_t lastScan, now;
+    IOS_GetAbsTime64(&lastScan);
+    uint32_t pollDelay = POLL_MIN_DELAY;
+    uint32_t shownSequence = 0xffffffff;
+    uint32_t shownFiles = 0xffffffff;
+    uint8_t cur_flag = 0;
+    uint8_t flag = 0;
+    while (1) {
+        SMC_ReadSystemEventFlag(&flag);
+        if (cur_flag != flag) {
+            if ((flag & SYSTEM_EVENT_FLAG_EJECT_BUTTON) || (flag & SYSTEM_EVENT_FLAG_POWER_BUTTON)) {
+                break;
+            }
+
+            cur_flag = flag;
+        }
+
+        IOS_GetAbsTime64(&now);
+        if ((uint32_t) (now - lastScan) >= RESCAN_INTERVAL * 1000) {
+            scanLogs(state, 0);
+            lastScan = now;
+        }
+
+        int sent = 0;
+        for (int i = 0; i < MAX_LOG_FILES; i++) {
+            if (state->files[i].handle < 0) {
+                continue;
+            }
+
+            res = streamFile(state, &state->files[i]);
+            if (res < 0) {
+                printf_error(index, "Failed to send %s: %x", state->files[i].name, res);
+                goto done;
+            }
+            sent += res;
+        }
+
+        if (state->sequence != shownSequence || state->numFiles != shownFiles) {
+            shownSequence = state->sequence;
+            shownFiles = state->numFiles;
+            gfx_printf(16, index, GfxPrintFlag_ClearBG, "%lu log files, %lu datagrams (%lu KiB) sent",
+                state->numFiles, state->sequence, state->bytes / 1024);
+        }
+
+        if (sent) {
+            pollDelay = POLL_MIN_DELAY;
+        } else if (pollDelay < POLL_MAX_DELAY) {
+            pollDelay *= 2;
+        }
+        usleep(pollDelay * 1000);
+    }
+
+done:
+    for (int i = 0; i < MAX_LOG_FILES; i++) {
+        if (state->files[i].handle >= 0) {
+            FSA_CloseFile(fsaHandle, state->files[i].handle);
+        }
+    }
+    if (state->socket >= 0) {
+        closesocket(state->socket);
+    }
+    IOS_HeapFree(CROSS_PROCESS_HEAP_ID, buffer);
+    IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, state);
+}
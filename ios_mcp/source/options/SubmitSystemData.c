@@ -20,6 +20,7 @@
 
 #include "menu.h"
 #include "gfx.h"
+#include "httpclient.h"
 #include "imports.h"
 #include "mdinfo.h"
 #include "netconf.h"
@@ -80,75 +81,24 @@ struct post_data_hashed {
 };  // size == 0x260 (608)
 static_assert(sizeof(struct post_data_hashed) == 0x260, "struct post_data_hashed size is WRONG");
 
-/**
- * Get data from the received HTTP response header.
- *
- * NOTE: This modifies the HTTP response header to add
- * NUL bytes in order to parse individual messages.
- *
- * @param in_buf    [in] HTTP response header
- * @param len       [in] Size of HTTP response header
- * @param out_resp  [out] Start of "200 OK" or other response code
- * @param out_body  [out] Message body, or NULL if not available
- * @return 0 on success; non-zero if the header is invalid.
- */
-static int parse_http_response(char *buf, size_t len, const char **out_resp, const char **out_body)
+// Start of the response body, printed after the status.
+typedef struct {
+    char* buf;
+    uint32_t len;
+} ResponseMessage;
+
+#define RESPONSE_MESSAGE_MAX 0xFF
+
+static int collect_response_message(HttpResponse* response, const uint8_t* data, uint32_t size)
 {
-    // Start of the buffer must be in the format: "HTTP/1.x 200 OK\r\n"
-    // - Can be 1.1 or 1.0.
-    // - Response code must be 3 digits.
-    if (len < 64) {
-        // Not enough data in the buffer to parse anything.
-        return -1;
-    }
-    *out_resp = NULL;
-    *out_body = NULL;
-    char *const p_end = buf + len;
-
-    // Check for an HTTP response code.
-    // TODO: Get scanf() and strchr() from IOSU?
-    if (memcmp(buf, "HTTP/1.", 7) != 0)
-        return -1;
-    if (buf[7] != '0' && buf[7] != '1')
-        return -1;
-    if (buf[ 8] != ' ' || buf[12] != ' ' ||
-       (buf[ 9] < '0' && buf[ 9] > '9') ||
-       (buf[10] < '0' && buf[10] > '9') ||
-       (buf[11] < '0' && buf[11] > '9')) {
-        return -2;
-    }
+    ResponseMessage* message = (ResponseMessage*)response->userdata;
 
-    // Find the '\r' and NULL it out.
-    char *p = &buf[13];
-    for (; p < p_end; p++) {
-        if (*p == '\r') {
-            *p = '\0';
-            *out_resp = &buf[9];
-            p++;
-            break;
-        }
-    }
-    if (p == p_end)
-        return -3;
-
-    // Find the end of the response header and the start of the message body.
-    // This is delimited with the string "\r\n\r\n".
-    // NOTE: If 204, there is no message body, but the server shouldn't
-    // respond with 204.
-    // TODO: Check "Content-Length"?
-    for (; p < (p_end - 3); p++) {
-        if (*p == '\r') {
-            // Check if this is "\r\n\r\n".
-            if (!memcmp(p, "\r\n\r\n", 4)) {
-                // Found the start of the message body.
-                p += 4;
-                if (p < p_end) {
-                    *out_body = p;
-                }
-                break;
-            }
-        }
+    // Anything after the first RESPONSE_MESSAGE_MAX bytes is dropped.
+    if (size > RESPONSE_MESSAGE_MAX - message->len) {
+        size = RESPONSE_MESSAGE_MAX - message->len;
     }
+    memcpy(message->buf + message->len, data, size);
+    message->len += size;
     return 0;
 }
 
@@ -200,7 +150,10 @@ void option_SubmitSystemData(void)
     // 0x400-0x5FF: SEEPROM
     // 0x600-0x6FF: RSA-encrypted AES key
     // 0x700-0x9FF: post_data_hashed
-#define DATA_BUFFER_SIZE 0xA00
+    // 0xA00-0xAFF: start of the response body (ResponseMessage), with its terminator
+    // The request body is passed to the socket driver directly, so the encrypted key and
+    // post_data_hashed need to be in here. httpclient builds the request header in its own buffer.
+#define DATA_BUFFER_SIZE 0xB00
     uint8_t* dataBuffer = IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, DATA_BUFFER_SIZE, 0x40);
     if (!dataBuffer) {
         print_error(index, "Out of memory!");
@@ -214,7 +167,7 @@ void option_SubmitSystemData(void)
     /** Get the data and submit it. **/
     uint8_t* const otp = dataBuffer;
     uint16_t* const seeprom = (uint16_t*)dataBuffer + 0x200;
-    struct post_data_hashed* const pdh = (struct post_data_hashed*)dataBuffer + 0x700;
+    struct post_data_hashed* const pdh = (struct post_data_hashed*)(dataBuffer + 0x700);
     struct post_data* const pd = &pdh->data;
     memset(pd, 0, sizeof(*pd)); // zero out post_data initially
     memset(&otp[0x380], 0, 0x40);
@@ -386,108 +339,65 @@ void option_SubmitSystemData(void)
         return;
     }
 
-    int httpSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (httpSocket < 0) {
-        IOS_HeapFree(CROSS_PROCESS_HEAP_ID, dataBuffer);
-        printf_error(index, "socket() failed: %d", httpSocket);
-        return;
-    }
-
     // Look up the domain name.
-    struct hostent* h = gethostbyname(SYSDATA_HOST_NAME);
-    if (!h || !h->h_addr) {
+    uint32_t addresses[NETDB_MAX_ADDRESSES];
+    int numAddresses = netdb_resolve(SYSDATA_HOST_NAME, addresses, NETDB_MAX_ADDRESSES);
+    if (numAddresses <= 0) {
         IOS_HeapFree(CROSS_PROCESS_HEAP_ID, dataBuffer);
-        print_error(index, "gethostbyname() failed; is your DNS server working?");
+        print_error(index, "Failed to look up " SYSDATA_HOST_NAME "; is your DNS server working?");
         return;
     }
 
-    // IP address is stored in h->h_addr.
-    struct sockaddr_in sockaddr;
-    memset(&sockaddr, 0, sizeof(sockaddr));
-    sockaddr.sin_family = AF_INET;
-    sockaddr.sin_port = 80;
-    memcpy(&sockaddr.sin_addr.s_addr, h->h_addr, 4);
-
-    res = connect(httpSocket, (struct sockaddr*)&sockaddr, sizeof(sockaddr));
-    if (res < 0) {
-        closesocket(httpSocket);
-        IOS_HeapFree(CROSS_PROCESS_HEAP_ID, dataBuffer);
-        printf_error(index, "connect() failed: %d", res);
-        return;
-    }
-
-    static const char submitting_data[] = "Connected, submitting data...";
+    static const char submitting_data[] = "Submitting data...";
     static const int status_xpos = 16 + (CHAR_SIZE_DRC_X * sizeof(submitting_data));
     gfx_print(16, index, 0, submitting_data);
 
-    // To reduce processing requirements here, we'll submit a simple HTTP/1.0 request
-    // without encryption.
-    static const char http_req[] = "POST /add-system.php HTTP/1.0\r\n"
-        "Host: wiiu.gerbilsoft.com\r\n"
-        "User-Agent: Wii U Recovery Menu/" VERSION_STRING "\r\n"
-        "Content-Type: application/octet-stream\r\n"
-        "Content-Length: 864\r\n\r\n";
-
-    // Send the HTTP request.
-    ok = false;
-    do {
-        res = send(httpSocket, http_req, sizeof(http_req)-1, 0);
-        if (res != sizeof(http_req)-1)
-            break;
-        res = send(httpSocket, encKey, RSA2048_BUF_SIZE, 0);
-        if (res != RSA2048_BUF_SIZE)
-            break;
-        res = send(httpSocket, pdh, sizeof(*pdh), 0);
-        if (res != sizeof(*pdh))
-            break;
-        ok = true;
-    } while (0);
-    if (!ok) {
-        IOS_HeapFree(CROSS_PROCESS_HEAP_ID, dataBuffer);
-        print_error(index, "Failed to send HTTP request.");
-        return;
+    // The request is sent without encryption, since the data is encrypted already.
+    // The encrypted key and post_data_hashed are contiguous and form the body.
+    const struct iovec body = { encKey, RSA2048_BUF_SIZE + sizeof(*pdh) };
+
+    // NOTE: Reusing dataBuffer for the message in the response body.
+    ResponseMessage message = { (char*)dataBuffer + 0xA00, 0 };
+    HttpResponse response;
+    response.body = collect_response_message;
+    response.userdata = &message;
+
+    // If the server can't be reached, try its other addresses.
+    response.status = 0;
+    res = HTTP_CLIENT_ERROR_SOCKET;
+    for (int i = 0; i < numAddresses && res == HTTP_CLIENT_ERROR_SOCKET && response.status == 0; i++) {
+        HttpClient client;
+        res = httpclient_init(&client, addresses[i], 80, SYSDATA_HOST_NAME);
+        if (res == 0) {
+            res = httpclient_request(&client, "POST", "/add-system.php",
+                "Content-Type: application/octet-stream\r\n", &body, &response);
+            httpclient_close(&client);
+        }
     }
+    message.buf[message.len] = '\0';
 
-    // Wait for a response.
-    // NOTE: Reusing dataBuffer here.
-    // TODO: Show an error message aside from the HTTP response code?
     ok = false;
-    res = recv(httpSocket, dataBuffer, DATA_BUFFER_SIZE-1, 0);
-    dataBuffer[DATA_BUFFER_SIZE-1] = 0;
-    if (res <= 0) {
-        // No data received...
+    if (res < 0) {
         gfx_set_font_color(COLOR_ERROR);
-        gfx_print(status_xpos, index, 0, "No response received from the server.");
+        gfx_printf(status_xpos, index, 0, (response.status == 0) ?
+            "No response received from the server: %d" : "Invalid response received from the server: %d", res);
         index += CHAR_SIZE_DRC_Y;
     } else {
-        // Received data. Parse the header.
-        if (res < DATA_BUFFER_SIZE) {
-            dataBuffer[res] = 0;
-        }
-        const char *resp = NULL, *body = NULL;
-        res = parse_http_response((char*)dataBuffer, res, &resp, &body);
-        if (res == 0 && resp) {
-            // If the response code is 2xx, success.
-            // Otherwise, something failed.
-            ok = (resp[0] == '2');
-            gfx_set_font_color(ok ? COLOR_SUCCESS : COLOR_ERROR);
-            index = gfx_print(status_xpos, index, 0, resp);
-            index += CHAR_SIZE_DRC_Y;
-            if (body) {
-                // Print the message body.
-                // TODO: Handle newlines if present?
-                // TODO: Limit number of characters?
-                gfx_print(16, index, 0, body);
-                index += CHAR_SIZE_DRC_Y;
-            }
+        // If the response code is 2xx, success.
+        // Otherwise, something failed.
+        ok = (response.status / 100 == 2);
+        gfx_set_font_color(ok ? COLOR_SUCCESS : COLOR_ERROR);
+        index = gfx_print(status_xpos, index, 0, response.statusLine);
+        index += CHAR_SIZE_DRC_Y;
+        if (message.len) {
+            // Print the message body.
+            // TODO: Handle newlines if present?
+            gfx_print(16, index, 0, message.buf);
             index += CHAR_SIZE_DRC_Y;
-        } else {
-            gfx_set_font_color(COLOR_ERROR);
-            gfx_print(status_xpos, index, 0, "Invalid response received from the server.");
         }
+        index += CHAR_SIZE_DRC_Y;
     }
 
-    closesocket(httpSocket);
     gfx_set_font_color(COLOR_PRIMARY);
     if (ok) {
         gfx_print(16, index, 0, "System data submitted successfully.");
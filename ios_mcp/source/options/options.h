@@ -1,14 +1,22 @@
 #pragma once
 
 #include "DebugSystemRegion.h"
+#include "Diagnostics.h"
 #include "DumpOtpAndSeeprom.h"
 #include "DumpSyslogs.h"
+#include "DumpTrace.h"
 #include "EditParental.h"
+#include "FetchTftp.h"
 #include "InstallWUP.h"
 #include "LoadBoot1Payload.h"
 #include "LoadNetConf.h"
+#include "NetworkBenchmark.h"
 #include "PairDRC.h"
+#include "Profiler.h"
+#include "ServeStorage.h"
 #include "SetColdbootTitle.h"
+#include "StartHttpServer.h"
 #include "StartWupserver.h"
+#include "StreamSyslogs.h"
 #include "SubmitSystemData.h"
 #include "SystemInformation.h"
@@ -0,0 +1,439 @@
+#define PERFSTATS_NO_WRAP
+#include "perfstats.h"
+
+#ifdef PERFSTATS
+
+#include "gfx.h"
+
+#include <string.h>
+
+#define PERFSTATS_MAX_ALLOCATIONS 256
+#define PERFSTATS_MAX_SITES 48
+#define PERFSTATS_MAX_DEVICES 16
+#define PERFSTATS_MAX_FDS 32
+#define PERFSTATS_DEVICE_NAME_LENGTH 20
+
+#define HUD_LINES 10
+#define HUD_COLUMNS 40
+#define HUD_X (SCREEN_WIDTH - 16 - HUD_COLUMNS * CHAR_SIZE_DRC_X)
+#define HUD_Y (16 + 8 + 2 + 8)
+// redraw every 500ms
+#define HUD_UPDATE_INTERVAL (500 * 1000)
+
+enum {
+    HEAP_LOCAL,
+    HEAP_CROSS,
+    HEAP_COUNT,
+};
+
+typedef struct {
+    uint32_t current;
+    uint32_t peak;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failed;
+} HeapStats;
+
+typedef struct {
+    const char* file;
+    uint16_t line;
+    uint8_t heap;
+    uint32_t allocs;
+    // bytes still allocated from this site
+    uint32_t bytes;
+} AllocSite;
+
+typedef struct {
+    void* ptr;
+    uint32_t size : 24;
+    uint32_t site : 8;
+} Allocation;
+
+typedef struct {
+    char name[PERFSTATS_DEVICE_NAME_LENGTH];
+    uint32_t calls;
+    uint64_t time;
+} DeviceStats;
+
+typedef struct {
+    int fd;
+    int device;
+} FdEntry;
+
+typedef struct {
+    HeapStats heaps[HEAP_COUNT];
+    AllocSite sites[PERFSTATS_MAX_SITES];
+    Allocation allocations[PERFSTATS_MAX_ALLOCATIONS];
+    uint32_t untracked;
+    DeviceStats devices[PERFSTATS_MAX_DEVICES];
+    FdEntry fds[PERFSTATS_MAX_FDS];
+} PerfStats;
+
+static PerfStats* stats = NULL;
+
+// a message queue with a single message acts as the lock
+static uint32_t lockMessageQueueBuf[1];
+static int lockMessageQueue = -1;
+
+static uint32_t redrawTime = 0;
+static int hudVisible = 0;
+static uint64_t lastHudUpdate = 0;
+
+static void lock(void)
+{
+    uint32_t msg;
+    IOS_ReceiveMessage(lockMessageQueue, &msg, IOS_MESSAGE_FLAGS_NONE);
+}
+
+static void unlock(void)
+{
+    IOS_SendMessage(lockMessageQueue, 0, IOS_MESSAGE_FLAGS_NONE);
+}
+
+int perfstats_init(void)
+{
+    if (stats) {
+        return 0;
+    }
+
+    lockMessageQueue = IOS_CreateMessageQueue(lockMessageQueueBuf, 1);
+    if (lockMessageQueue < 0) {
+        return lockMessageQueue;
+    }
+
+    PerfStats* s = IOS_HeapAlloc(LOCAL_PROCESS_HEAP_ID, sizeof(PerfStats));
+    if (!s) {
+        IOS_DestroyMessageQueue(lockMessageQueue);
+        lockMessageQueue = -1;
+        return -1;
+    }
+
+    memset(s, 0, sizeof(PerfStats));
+    for (int i = 0; i < PERFSTATS_MAX_FDS; i++) {
+        s->fds[i].fd = -1;
+    }
+
+    unlock();
+    stats = s;
+    return 0;
+}
+
+static int heapIndex(uint32_t heap)
+{
+    return (heap == CROSS_PROCESS_HEAP_ID) ? HEAP_CROSS : HEAP_LOCAL;
+}
+
+static int findSite(int heap, const char* file, int line)
+{
+    for (int i = 0; i < PERFSTATS_MAX_SITES; i++) {
+        AllocSite* site = &stats->sites[i];
+        if (!site->file) {
+            site->file = file;
+            site->line = line;
+            site->heap = heap;
+            return i;
+        }
+        if (site->file == file && site->line == line && site->heap == heap) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void trackAlloc(uint32_t heap, void* ptr, uint32_t size, const char* file, int line)
+{
+    if (!stats) {
+        return;
+    }
+
+    int h = heapIndex(heap);
+
+    lock();
+
+    HeapStats* hs = &stats->heaps[h];
+    if (!ptr) {
+        hs->failed++;
+        unlock();
+        return;
+    }
+
+    int site = findSite(h, file, line);
+    Allocation* alloc = NULL;
+    for (int i = 0; site >= 0 && i < PERFSTATS_MAX_ALLOCATIONS; i++) {
+        if (!stats->allocations[i].ptr) {
+            alloc = &stats->allocations[i];
+            break;
+        }
+    }
+
+    if (!alloc) {
+        // can't be freed correctly later, so don't account it at all
+        stats->untracked++;
+        unlock();
+        return;
+    }
+
+    alloc->ptr = ptr;
+    alloc->size = size;
+    alloc->site = site;
+
+    stats->sites[site].allocs++;
+    stats->sites[site].bytes += size;
+
+    hs->allocs++;
+    hs->current += size;
+    if (hs->current > hs->peak) {
+        hs->peak = hs->current;
+    }
+
+    unlock();
+}
+
+static void trackFree(uint32_t heap, void* ptr)
+{
+    if (!stats || !ptr) {
+        return;
+    }
+
+    lock();
+
+    for (int i = 0; i < PERFSTATS_MAX_ALLOCATIONS; i++) {
+        Allocation* alloc = &stats->allocations[i];
+        if (alloc->ptr == ptr) {
+            HeapStats* hs = &stats->heaps[heapIndex(heap)];
+            hs->frees++;
+            hs->current -= alloc->size;
+            stats->sites[alloc->site].bytes -= alloc->size;
+            alloc->ptr = NULL;
+            break;
+        }
+    }
+
+    unlock();
+}
+
+void* perfstats_HeapAlloc(uint32_t heap, uint32_t size, const char* file, int line)
+{
+    void* ptr = IOS_HeapAlloc(heap, size);
+    trackAlloc(heap, ptr, size, file, line);
+    return ptr;
+}
+
+void* perfstats_HeapAllocAligned(uint32_t heap, uint32_t size, uint32_t alignment, const char* file, int line)
+{
+    void* ptr = IOS_HeapAllocAligned(heap, size, alignment);
+    trackAlloc(heap, ptr, size, file, line);
+    return ptr;
+}
+
+void* perfstats_HeapRealloc(uint32_t heap, void* ptr, uint32_t size, const char* file, int line)
+{
+    void* newPtr = IOS_HeapRealloc(heap, ptr, size);
+    if (newPtr) {
+        trackFree(heap, ptr);
+    }
+    trackAlloc(heap, newPtr, size, file, line);
+    return newPtr;
+}
+
+void perfstats_HeapFree(uint32_t heap, void* ptr)
+{
+    trackFree(heap, ptr);
+    IOS_HeapFree(heap, ptr);
+}
+
+int perfstats_Open(const char* device, int mode)
+{
+    int fd = IOS_Open(device, mode);
+    if (!stats || fd < 0) {
+        return fd;
+    }
+
+    lock();
+
+    int dev = -1;
+    for (int i = 0; i < PERFSTATS_MAX_DEVICES; i++) {
+        DeviceStats* ds = &stats->devices[i];
+        if (!ds->name[0]) {
+            strncpy(ds->name, device, PERFSTATS_DEVICE_NAME_LENGTH - 1);
+        }
+        if (strncmp(ds->name, device, PERFSTATS_DEVICE_NAME_LENGTH - 1) == 0) {
+            dev = i;
+            break;
+        }
+    }
+
+    for (int i = 0; dev >= 0 && i < PERFSTATS_MAX_FDS; i++) {
+        if (stats->fds[i].fd < 0) {
+            stats->fds[i].fd = fd;
+            stats->fds[i].device = dev;
+            break;
+        }
+    }
+
+    unlock();
+    return fd;
+}
+
+int perfstats_Close(int fd)
+{
+    if (stats) {
+        lock();
+        for (int i = 0; i < PERFSTATS_MAX_FDS; i++) {
+            if (stats->fds[i].fd == fd) {
+                stats->fds[i].fd = -1;
+                break;
+            }
+        }
+        unlock();
+    }
+
+    return IOS_Close(fd);
+}
+
+static void trackIpc(int fd, uint64_t start)
+{
+    if (!stats) {
+        return;
+    }
+
+    uint64_t end;
+    IOS_GetAbsTime64(&end);
+
+    lock();
+    for (int i = 0; i < PERFSTATS_MAX_FDS; i++) {
+        if (stats->fds[i].fd == fd) {
+            DeviceStats* ds = &stats->devices[stats->fds[i].device];
+            ds->calls++;
+            ds->time += end - start;
+            break;
+        }
+    }
+    unlock();
+}
+
+int perfstats_Ioctl(int fd, uint32_t request, void* input_buffer, uint32_t input_buffer_len, void* output_buffer, uint32_t output_buffer_len)
+{
+    uint64_t start;
+    IOS_GetAbsTime64(&start);
+    int res = IOS_Ioctl(fd, request, input_buffer, input_buffer_len, output_buffer, output_buffer_len);
+    trackIpc(fd, start);
+    return res;
+}
+
+int perfstats_Ioctlv(int fd, uint32_t request, uint32_t vector_count_in, uint32_t vector_count_out, IOSVec_t* vector)
+{
+    uint64_t start;
+    IOS_GetAbsTime64(&start);
+    int res = IOS_Ioctlv(fd, request, vector_count_in, vector_count_out, vector);
+    trackIpc(fd, start);
+    return res;
+}
+
+void perfstats_set_redraw_time(uint32_t us)
+{
+    redrawTime = us;
+}
+
+void perfstats_toggle_hud(void)
+{
+    hudVisible = !hudVisible;
+    if (!hudVisible) {
+        gfx_draw_rect_filled(HUD_X, HUD_Y, SCREEN_WIDTH - HUD_X, HUD_LINES * CHAR_SIZE_DRC_Y, COLOR_BACKGROUND);
+    }
+
+    perfstats_update_hud(1);
+}
+
+// index of the largest entry not already in used, -1 if there is none left
+static int pickLargest(const uint32_t* values, int count, uint64_t* used)
+{
+    int best = -1;
+    for (int i = 0; i < count; i++) {
+        if (!(*used & (1llu << i)) && values[i] && (best < 0 || values[i] > values[best])) {
+            best = i;
+        }
+    }
+
+    if (best >= 0) {
+        *used |= 1llu << best;
+    }
+    return best;
+}
+
+void perfstats_update_hud(int force)
+{
+    if (!stats || !hudVisible) {
+        return;
+    }
+
+    uint64_t now;
+    IOS_GetAbsTime64(&now);
+    if (!force && now - lastHudUpdate < HUD_UPDATE_INTERVAL) {
+        return;
+    }
+    lastHudUpdate = now;
+
+    // draw from a snapshot, the gfx calls would hold the lock for way too long
+    static const char* heapNames[HEAP_COUNT] = { "LOCAL", "CROSS" };
+    HeapStats heaps[HEAP_COUNT];
+    uint32_t siteBytes[PERFSTATS_MAX_SITES];
+    uint32_t deviceTime[PERFSTATS_MAX_DEVICES];
+    lock();
+    memcpy(heaps, stats->heaps, sizeof(heaps));
+    for (int i = 0; i < PERFSTATS_MAX_SITES; i++) {
+        siteBytes[i] = stats->sites[i].bytes;
+    }
+    for (int i = 0; i < PERFSTATS_MAX_DEVICES; i++) {
+        deviceTime[i] = (uint32_t) (stats->devices[i].time / 1000);
+    }
+    uint32_t untracked = stats->untracked;
+    unlock();
+
+    char line[HUD_COLUMNS + 1];
+    uint32_t y = HUD_Y;
+
+    gfx_set_font_color(COLOR_SECONDARY);
+    for (int i = 0; i < HEAP_COUNT; i++) {
+        snprintf(line, sizeof(line), "%s %6lu/%6lu B %4lu+%-4lu %lu!",
+            heapNames[i], heaps[i].current, heaps[i].peak, heaps[i].allocs - heaps[i].frees, heaps[i].frees, heaps[i].failed);
+        gfx_printf(HUD_X, y, GfxPrintFlag_ClearBG, "%-*s", HUD_COLUMNS, line);
+        y += CHAR_SIZE_DRC_Y;
+    }
+
+    snprintf(line, sizeof(line), "redraw %lu us, untracked %lu", redrawTime, untracked);
+    gfx_printf(HUD_X, y, GfxPrintFlag_ClearBG, "%-*s", HUD_COLUMNS, line);
+    y += CHAR_SIZE_DRC_Y;
+
+    // top call sites by live bytes
+    uint64_t used = 0;
+    for (int n = 0; n < 3; n++) {
+        int i = pickLargest(siteBytes, PERFSTATS_MAX_SITES, &used);
+        if (i < 0) {
+            line[0] = '\0';
+        } else {
+            AllocSite* site = &stats->sites[i];
+            snprintf(line, sizeof(line), "%.16s:%u %c %lu B %lux",
+                site->file, site->line, heapNames[site->heap][0], siteBytes[i], site->allocs);
+        }
+        gfx_printf(HUD_X, y, GfxPrintFlag_ClearBG, "%-*s", HUD_COLUMNS, line);
+        y += CHAR_SIZE_DRC_Y;
+    }
+
+    // top devices by time spent in ipc
+    used = 0;
+    for (int n = 0; n < HUD_LINES - 6; n++) {
+        int i = pickLargest(deviceTime, PERFSTATS_MAX_DEVICES, &used);
+        if (i < 0) {
+            line[0] = '\0';
+        } else {
+            DeviceStats* ds = &stats->devices[i];
+            snprintf(line, sizeof(line), "%-16s %6lu %6lu ms", ds->name, ds->calls, deviceTime[i]);
+        }
+        gfx_printf(HUD_X, y, GfxPrintFlag_ClearBG, "%-*s", HUD_COLUMNS, line);
+        y += CHAR_SIZE_DRC_Y;
+    }
+}
+
+#endif /* PERFSTATS */
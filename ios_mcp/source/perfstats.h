@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "imports.h"
+
+#ifdef PERFSTATS
+
+int perfstats_init(void);
+
+void* perfstats_HeapAlloc(uint32_t heap, uint32_t size, const char* file, int line);
+void* perfstats_HeapAllocAligned(uint32_t heap, uint32_t size, uint32_t alignment, const char* file, int line);
+void* perfstats_HeapRealloc(uint32_t heap, void* ptr, uint32_t size, const char* file, int line);
+void perfstats_HeapFree(uint32_t heap, void* ptr);
+
+int perfstats_Open(const char* device, int mode);
+int perfstats_Close(int fd);
+int perfstats_Ioctl(int fd, uint32_t request, void* input_buffer, uint32_t input_buffer_len, void* output_buffer, uint32_t output_buffer_len);
+int perfstats_Ioctlv(int fd, uint32_t request, uint32_t vector_count_in, uint32_t vector_count_out, IOSVec_t* vector);
+
+/**
+ * Report how long the last menu redraw took.
+ */
+void perfstats_set_redraw_time(uint32_t us);
+
+void perfstats_toggle_hud(void);
+
+/**
+ * Redraw the HUD if it is visible and the last update is old enough.
+ * @param force Redraw regardless of the last update
+ */
+void perfstats_update_hud(int force);
+
+// route all heap and ipc calls through the wrappers, perfstats.c calls the real ones
+#ifndef PERFSTATS_NO_WRAP
+#define IOS_HeapAlloc(heap, size)                       perfstats_HeapAlloc(heap, size, __FILE_NAME__, __LINE__)
+#define IOS_HeapAllocAligned(heap, size, alignment)     perfstats_HeapAllocAligned(heap, size, alignment, __FILE_NAME__, __LINE__)
+#define IOS_HeapRealloc(heap, ptr, size)                perfstats_HeapRealloc(heap, ptr, size, __FILE_NAME__, __LINE__)
+#define IOS_HeapFree(heap, ptr)                         perfstats_HeapFree(heap, ptr)
+#define IOS_Open(device, mode)                          perfstats_Open(device, mode)
+#define IOS_Close(fd)                                   perfstats_Close(fd)
+#define IOS_Ioctl(fd, request, in, inLen, out, outLen)  perfstats_Ioctl(fd, request, in, inLen, out, outLen)
+#define IOS_Ioctlv(fd, request, numIn, numOut, vec)     perfstats_Ioctlv(fd, request, numIn, numOut, vec)
+#endif /* PERFSTATS_NO_WRAP */
+
+#else /* !PERFSTATS */
+
+static inline int perfstats_init(void) { return 0; }
+static inline void perfstats_set_redraw_time(uint32_t us) { }
+static inline void perfstats_toggle_hud(void) { }
+static inline void perfstats_update_hud(int force) { }
+
+#endif /* PERFSTATS */
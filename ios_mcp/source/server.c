@@ -0,0 +1,295 @@
+#include <string.h>
+#include <unistd.h>
+#include "imports.h"
+#include "socket.h"
+#include "server.h"
+#include "stackmon.h"
+
+#define LISTENER_STACK_SIZE 0x400
+
+// the copying socket calls stage through an ipc buffer of the same size
+#define COPY_CHUNK_SIZE 0x4000
+
+#define WORKER_MESSAGE_STOP_THREAD 0xffffffff
+
+int server_wait_readable(int sock, const volatile int* running, int polls)
+{
+    while (*running) {
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        int ret = poll(&pfd, 1, SERVER_POLL_TIMEOUT);
+        if (ret != 0) {
+            return ret;
+        }
+
+        if (polls && --polls == 0) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int server_send_all(int sock, const void* data, uint32_t length)
+{
+    while (length) {
+        int ret = send(sock, data, (length < COPY_CHUNK_SIZE) ? length : COPY_CHUNK_SIZE, 0);
+        if (ret <= 0) {
+            return -1;
+        }
+
+        data = (const uint8_t*) data + ret;
+        length -= ret;
+    }
+
+    return 0;
+}
+
+int server_recv_all(int sock, void* data, uint32_t length)
+{
+    while (length) {
+        int ret = recv(sock, data, (length < COPY_CHUNK_SIZE) ? length : COPY_CHUNK_SIZE, 0);
+        if (ret <= 0) {
+            return -1;
+        }
+
+        data = (uint8_t*) data + ret;
+        length -= ret;
+    }
+
+    return 0;
+}
+
+int server_send_all_buffer(int sock, const void* buffer, uint32_t length)
+{
+    while (length) {
+        const struct iovec iov = { (void*) buffer, length };
+        int ret = sendv(sock, &iov, 1, 0);
+        if (ret <= 0) {
+            return -1;
+        }
+
+        buffer = (const uint8_t*) buffer + ret;
+        length -= ret;
+    }
+
+    return 0;
+}
+
+static int workerThread(void* arg)
+{
+    ServerWorker* worker = (ServerWorker*) arg;
+
+    while (1) {
+        uint32_t message;
+        if (IOS_ReceiveMessage(worker->messageQueue, &message, IOS_MESSAGE_FLAGS_NONE) < 0) {
+            return 0;
+        }
+
+        if (message == WORKER_MESSAGE_STOP_THREAD) {
+            return 0;
+        }
+
+        worker->pool->config->handleClient((int) message, worker->index);
+
+        closesocket((int) message);
+        worker->clientSocket = -1;
+    }
+}
+
+static void listenClients(ServerPool* pool)
+{
+    const ServerConfig* config = pool->config;
+
+    int serverSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (serverSocket < 0) {
+        return;
+    }
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+
+    server.sin_family = AF_INET;
+    server.sin_port = config->port;
+    server.sin_addr.s_addr = 0;
+
+    if (bind(serverSocket, (struct sockaddr*) &server, sizeof(server)) < 0 || listen(serverSocket, config->numWorkers) < 0) {
+        closesocket(serverSocket);
+        return;
+    }
+
+    while (server_wait_readable(serverSocket, &pool->running, 0) > 0) {
+        int csock = accept(serverSocket, NULL, NULL);
+        if (csock < 0) {
+            break;
+        }
+
+        ServerWorker* worker = NULL;
+        for (uint32_t i = 0; i < config->numWorkers; i++) {
+            if (pool->workers[i].clientSocket < 0) {
+                worker = &pool->workers[i];
+                break;
+            }
+        }
+
+        // all workers are busy, turn the client away
+        if (!worker) {
+            if (config->rejectClient) {
+                config->rejectClient(csock);
+            }
+            closesocket(csock);
+            continue;
+        }
+
+        worker->clientSocket = csock;
+        IOS_SendMessage(worker->messageQueue, (uint32_t) csock, IOS_MESSAGE_FLAGS_NONE);
+    }
+
+    closesocket(serverSocket);
+}
+
+static int listenerThread(void* arg)
+{
+    ServerPool* pool = (ServerPool*) arg;
+
+    // retry until the network is up
+    while (pool->running) {
+        listenClients(pool);
+        if (pool->running) {
+            usleep(1000 * 1000);
+        }
+    }
+
+    return 0;
+}
+
+static void destroyWorkers(ServerPool* pool)
+{
+    for (uint32_t i = 0; i < pool->config->numWorkers; i++) {
+        ServerWorker* worker = &pool->workers[i];
+
+        if (worker->threadId >= 0) {
+            IOS_SendMessage(worker->messageQueue, WORKER_MESSAGE_STOP_THREAD, IOS_MESSAGE_FLAGS_NONE);
+            IOS_JoinThread(worker->threadId, NULL);
+        }
+
+        if (worker->messageQueue >= 0) {
+            IOS_DestroyMessageQueue(worker->messageQueue);
+        }
+
+        if (worker->stack) {
+            stackmon_unregister(worker->stack);
+            IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, worker->stack);
+        }
+    }
+
+    IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, pool->workers);
+    pool->workers = NULL;
+}
+
+static int createWorkers(ServerPool* pool)
+{
+    const ServerConfig* config = pool->config;
+
+    pool->workers = IOS_HeapAlloc(LOCAL_PROCESS_HEAP_ID, config->numWorkers * sizeof(ServerWorker));
+    if (!pool->workers) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < config->numWorkers; i++) {
+        ServerWorker* worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        worker->threadId = -1;
+        worker->messageQueue = -1;
+        worker->clientSocket = -1;
+        worker->stack = IOS_HeapAllocAligned(LOCAL_PROCESS_HEAP_ID, config->workerStackSize, 0x20);
+    }
+
+    for (uint32_t i = 0; i < config->numWorkers; i++) {
+        ServerWorker* worker = &pool->workers[i];
+        if (!worker->stack) {
+            destroyWorkers(pool);
+            return -1;
+        }
+
+        worker->messageQueue = IOS_CreateMessageQueue(worker->messageQueueBuf, sizeof(worker->messageQueueBuf) / 4);
+        if (worker->messageQueue < 0) {
+            destroyWorkers(pool);
+            return -1;
+        }
+
+        stackmon_register(config->workerNames[i], worker->stack, config->workerStackSize);
+        worker->threadId = IOS_CreateThread(workerThread, worker, worker->stack + config->workerStackSize, config->workerStackSize, IOS_GetThreadPriority(0), IOS_THREAD_FLAGS_NONE);
+        if (worker->threadId < 0 || IOS_StartThread(worker->threadId) < 0) {
+            destroyWorkers(pool);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int server_pool_start(ServerPool* pool, const ServerConfig* config)
+{
+    if (config->numWorkers > SERVER_MAX_WORKERS) {
+        return -1;
+    }
+
+    pool->config = config;
+    pool->threadId = -1;
+
+    pool->threadStack = IOS_HeapAllocAligned(LOCAL_PROCESS_HEAP_ID, LISTENER_STACK_SIZE, 0x20);
+    if (!pool->threadStack) {
+        return -1;
+    }
+
+    if (createWorkers(pool) < 0) {
+        IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, pool->threadStack);
+        pool->threadStack = NULL;
+        return -1;
+    }
+
+    stackmon_register(config->name, pool->threadStack, LISTENER_STACK_SIZE);
+    pool->running = 1;
+    pool->threadId = IOS_CreateThread(listenerThread, pool, pool->threadStack + LISTENER_STACK_SIZE, LISTENER_STACK_SIZE, IOS_GetThreadPriority(0), IOS_THREAD_FLAGS_NONE);
+    if (pool->threadId < 0 || IOS_StartThread(pool->threadId) < 0) {
+        server_pool_deinit(pool);
+        return -1;
+    }
+
+    return 0;
+}
+
+void server_pool_stop(ServerPool* pool)
+{
+    pool->running = 0;
+
+    // the listener and idle workers notice this within SERVER_POLL_TIMEOUT,
+    // but workers might be blocked in the middle of a transfer
+    for (uint32_t i = 0; pool->workers && i < pool->config->numWorkers; i++) {
+        int sock = pool->workers[i].clientSocket;
+        if (sock >= 0) {
+            shutdown(sock, SHUT_RDWR);
+        }
+    }
+}
+
+void server_pool_deinit(ServerPool* pool)
+{
+    server_pool_stop(pool);
+
+    if (pool->threadId >= 0) {
+        IOS_JoinThread(pool->threadId, NULL);
+        pool->threadId = -1;
+    }
+
+    if (pool->workers) {
+        destroyWorkers(pool);
+    }
+
+    if (pool->threadStack) {
+        stackmon_unregister(pool->threadStack);
+        IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, pool->threadStack);
+        pool->threadStack = NULL;
+    }
+}
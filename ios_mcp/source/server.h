@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+
+// blocking calls of the servers wait at most this long, so their threads notice when the server is stopped
+#define SERVER_POLL_TIMEOUT 500
+
+#define SERVER_MAX_WORKERS 8
+
+typedef struct {
+    uint16_t port;
+    // stackmon names of the listener thread and of every worker
+    const char* name;
+    const char* const* workerNames;
+    uint32_t numWorkers;
+    uint32_t workerStackSize;
+    // runs on a worker thread for every accepted client, the socket is closed once it returns
+    void (*handleClient)(int sock, uint32_t worker);
+    // runs on the listener thread before a client is turned away because all workers are busy, optional
+    void (*rejectClient)(int sock);
+} ServerConfig;
+
+struct ServerPool;
+
+typedef struct {
+    struct ServerPool* pool;
+    uint32_t index;
+    int threadId;
+    uint8_t* stack;
+    uint32_t messageQueueBuf[2];
+    int messageQueue;
+    // socket of the client currently served, -1 if idle
+    volatile int clientSocket;
+} ServerWorker;
+
+/**
+ * A listener thread which hands every client to an idle worker thread.
+ * Static instances need threadId set to -1.
+ */
+typedef struct ServerPool {
+    const ServerConfig* config;
+    volatile int running;
+    int threadId;
+    uint8_t* threadStack;
+    ServerWorker* workers;
+} ServerPool;
+
+/**
+ * Wait until sock is readable, in steps of SERVER_POLL_TIMEOUT while *running is set.
+ * @param polls number of timeouts after which to give up, 0 to wait as long as *running is set
+ * @return > 0 once readable, 0 after polls timeouts, negative on errors or once *running was cleared
+ */
+int server_wait_readable(int sock, const volatile int* running, int polls);
+
+/**
+ * Send or receive all of length bytes through the copying socket calls.
+ * @return 0 on success, -1 if the connection failed
+ */
+int server_send_all(int sock, const void* data, uint32_t length);
+int server_recv_all(int sock, void* data, uint32_t length);
+
+/**
+ * Send all of length bytes from a socket buffer without copying it.
+ * @return 0 on success, -1 if the connection failed
+ */
+int server_send_all_buffer(int sock, const void* buffer, uint32_t length);
+
+/**
+ * Create the workers and start listening, config must stay valid until server_pool_deinit.
+ * @return 0 on success, -1 if the threads couldn't be created
+ */
+int server_pool_start(ServerPool* pool, const ServerConfig* config);
+
+/**
+ * Tell all threads to stop and abort the transfers of the clients without waiting for them.
+ * Can be called from a client handler.
+ */
+void server_pool_stop(ServerPool* pool);
+
+/**
+ * Stop the pool, wait for its threads and free them. Must not be called from a client handler.
+ */
+void server_pool_deinit(ServerPool* pool);
@@ -3,6 +3,7 @@
 #include <string.h>
 #include "socket.h"
 #include "imports.h"
+#include "trace.h"
 
 static int socket_handle = -1;
 
@@ -162,17 +163,19 @@ int shutdown(int sockfd, int how)
     return ret;
 }
 
-ssize_t recv(int sockfd, void *buf, size_t len, int flags)
+ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen)
 {
     if(!len) return -101;
+    if(src_addr && (!addrlen || *addrlen < 0x10)) return -1;
 
     // TODO : size checks, split up data into multiple vectors if necessary
     void* data_buf = IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, len, 0x40);
     if(!data_buf) return -100;
 
-    uint8_t* iobuf = allocIobuf(0x38);
+    uint8_t* iobuf = allocIobuf(0x48);
     IOSVec_t* iovec = (IOSVec_t*)iobuf;
     uint32_t* inbuf = (uint32_t*)&iobuf[0x30];
+    uint32_t* addrbuf = (uint32_t*)&iobuf[0x38];
 
     inbuf[0] = sockfd;
     inbuf[1] = flags;
@@ -181,10 +184,21 @@ ssize_t recv(int sockfd, void *buf, size_t len, int flags)
     iovec[0].len = 0x8;
     iovec[1].ptr = (void*)data_buf;
     iovec[1].len = len;
+    if(src_addr) {
+        // the source address is returned in the last vector, like sendto takes the destination
+        iovec[3].ptr = addrbuf;
+        iovec[3].len = 0x10;
+    }
 
+    TRACE_BEGIN(TRACE_TAG_SOCKET_RECV, sockfd, len);
     int ret = IOS_Ioctlv(socket_handle, 0xC, 1, 3, iovec);
-    if(ret > 0 && buf) {
-        memcpy(buf, data_buf, ret);
+    TRACE_END(TRACE_TAG_SOCKET_RECV, sockfd, ret);
+    if(ret >= 0) {
+        if(buf) memcpy(buf, data_buf, ret);
+        if(src_addr) {
+            memcpy(src_addr, addrbuf, 0x10);
+            *addrlen = 0x10;
+        }
     }
 
     freeIobuf(data_buf);
@@ -192,6 +206,11 @@ ssize_t recv(int sockfd, void *buf, size_t len, int flags)
     return ret;
 }
 
+ssize_t recv(int sockfd, void *buf, size_t len, int flags)
+{
+    return recvfrom(sockfd, buf, len, flags, NULL, NULL);
+}
+
 ssize_t send(int sockfd, const void *buf, size_t len, int flags)
 {
     if(!buf || !len) return -101;
@@ -214,9 +233,203 @@ ssize_t send(int sockfd, const void *buf, size_t len, int flags)
     iovec[1].ptr = (void*)data_buf;
     iovec[1].len = len;
 
+    TRACE_BEGIN(TRACE_TAG_SOCKET_SEND, sockfd, len);
     int ret = IOS_Ioctlv(socket_handle, 0xE, 4, 0, iovec);
+    TRACE_END(TRACE_TAG_SOCKET_SEND, sockfd, ret);
+
+    freeIobuf(data_buf);
+    freeIobuf(iobuf);
+    return ret;
+}
+
+ssize_t sendto(int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen)
+{
+    if(!buf || !len) return -101;
+    if(!dest_addr || addrlen != 0x10) return -1;
+
+    void* data_buf = IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, len, 0x40);
+    if(!data_buf) return -100;
+
+    uint8_t* iobuf = allocIobuf(0x48);
+    IOSVec_t* iovec = (IOSVec_t*)iobuf;
+    uint32_t* inbuf = (uint32_t*)&iobuf[0x30];
+    uint32_t* addrbuf = (uint32_t*)&iobuf[0x38];
+
+    memcpy(data_buf, buf, len);
+    memcpy(addrbuf, dest_addr, addrlen);
+
+    inbuf[0] = sockfd;
+    inbuf[1] = flags;
+
+    iovec[0].ptr = inbuf;
+    iovec[0].len = 0x8;
+    iovec[1].ptr = (void*)data_buf;
+    iovec[1].len = len;
+    iovec[3].ptr = addrbuf;
+    iovec[3].len = addrlen;
+
+    TRACE_BEGIN(TRACE_TAG_SOCKET_SEND, sockfd, len);
+    int ret = IOS_Ioctlv(socket_handle, 0xF, 4, 0, iovec);
+    TRACE_END(TRACE_TAG_SOCKET_SEND, sockfd, ret);
 
     freeIobuf(data_buf);
     freeIobuf(iobuf);
     return ret;
 }
+
+int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen)
+{
+    if(!optval || optlen > 0x20) return -1;
+
+    uint8_t* iobuf = allocIobuf(0x58);
+    IOSVec_t* iovec = (IOSVec_t*)iobuf;
+    uint32_t* inbuf = (uint32_t*)&iobuf[0x18];
+    uint8_t* optbuf = &iobuf[0x38];
+
+    inbuf[0] = sockfd;
+    inbuf[1] = level;
+    inbuf[2] = optname;
+    memcpy(optbuf, optval, optlen);
+
+    iovec[0].ptr = optbuf;
+    iovec[0].len = optlen;
+    iovec[1].ptr = inbuf;
+    iovec[1].len = 0xC;
+
+    int ret = IOS_Ioctlv(socket_handle, 0x8, 2, 0, iovec);
+
+    freeIobuf(iobuf);
+    return ret;
+}
+
+int socketSetNonBlocking(int sockfd, int enable)
+{
+    return setsockopt(sockfd, SOL_SOCKET, SO_NONBLOCK, &enable, sizeof(enable));
+}
+
+int socketSelect(int nfds, uint32_t* readfds, uint32_t* writefds, uint32_t* exceptfds, int32_t timeout)
+{
+    if(nfds < 0 || nfds > SOCKET_MAX_SELECT_FDS) return -1;
+
+    uint8_t* iobuf = allocIobuf(0x1C);
+    uint32_t* inbuf = (uint32_t*)iobuf;
+
+    // [nfds][readfds][writefds][exceptfds][tv_sec][tv_usec][has_timeout], the reply has the same layout
+    inbuf[0] = nfds;
+    inbuf[1] = readfds ? *readfds : 0;
+    inbuf[2] = writefds ? *writefds : 0;
+    inbuf[3] = exceptfds ? *exceptfds : 0;
+    if (timeout >= 0) {
+        inbuf[4] = timeout / 1000000;
+        inbuf[5] = timeout % 1000000;
+        inbuf[6] = 1;
+    }
+
+    int ret = IOS_Ioctl(socket_handle, 0x13, inbuf, 0x1C, inbuf, 0x1C);
+    if(ret >= 0) {
+        if (readfds) *readfds = inbuf[1];
+        if (writefds) *writefds = inbuf[2];
+        if (exceptfds) *exceptfds = inbuf[3];
+    }
+
+    freeIobuf(iobuf);
+    return ret;
+}
+
+int poll(struct pollfd* fds, unsigned int nfds, int timeout)
+{
+    uint32_t readfds = 0, writefds = 0, exceptfds = 0;
+    int maxfd = -1;
+    for (unsigned int i = 0; i < nfds; i++) {
+        int fd = fds[i].fd;
+        fds[i].revents = 0;
+        if (fd < 0) {
+            continue;
+        }
+        if (fd >= SOCKET_MAX_SELECT_FDS) {
+            return -1;
+        }
+
+        if (fds[i].events & POLLIN) readfds |= 1u << fd;
+        if (fds[i].events & POLLOUT) writefds |= 1u << fd;
+        exceptfds |= 1u << fd;
+        if (fd > maxfd) maxfd = fd;
+    }
+
+    int ret = socketSelect(maxfd + 1, &readfds, &writefds, &exceptfds, (timeout < 0) ? -1 : timeout * 1000);
+    if (ret <= 0) {
+        return ret;
+    }
+
+    int ready = 0;
+    for (unsigned int i = 0; i < nfds; i++) {
+        int fd = fds[i].fd;
+        if (fd < 0) {
+            continue;
+        }
+
+        if (readfds & (1u << fd)) fds[i].revents |= POLLIN;
+        if (writefds & (1u << fd)) fds[i].revents |= POLLOUT;
+        if (exceptfds & (1u << fd)) fds[i].revents |= POLLERR;
+        if (fds[i].revents) ready++;
+    }
+
+    return ready;
+}
+
+void* socketAllocBuffer(size_t size)
+{
+    return IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, size, 0x40);
+}
+
+void socketFreeBuffer(void* buf)
+{
+    IOS_HeapFree(CROSS_PROCESS_HEAP_ID, buf);
+}
+
+// data vectors go into iovec[1] and iovec[2], same as for send and recv
+static ssize_t transferv(int sockfd, const struct iovec* iov, int iovcnt, int flags, int recv)
+{
+    if(!iov || iovcnt < 1 || iovcnt > SOCKET_MAX_VECTORS) return -101;
+
+    uint8_t* iobuf = allocIobuf(0x38);
+    IOSVec_t* iovec = (IOSVec_t*)iobuf;
+    uint32_t* inbuf = (uint32_t*)&iobuf[0x30];
+
+    inbuf[0] = sockfd;
+    inbuf[1] = flags;
+
+    iovec[0].ptr = inbuf;
+    iovec[0].len = 0x8;
+
+    uint32_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        iovec[1 + i].ptr = iov[i].iov_base;
+        iovec[1 + i].len = iov[i].iov_len;
+        len += iov[i].iov_len;
+    }
+
+    int ret;
+    if (recv) {
+        TRACE_BEGIN(TRACE_TAG_SOCKET_RECV, sockfd, len);
+        ret = IOS_Ioctlv(socket_handle, 0xC, 1, 3, iovec);
+        TRACE_END(TRACE_TAG_SOCKET_RECV, sockfd, ret);
+    } else {
+        TRACE_BEGIN(TRACE_TAG_SOCKET_SEND, sockfd, len);
+        ret = IOS_Ioctlv(socket_handle, 0xE, 4, 0, iovec);
+        TRACE_END(TRACE_TAG_SOCKET_SEND, sockfd, ret);
+    }
+
+    freeIobuf(iobuf);
+    return ret;
+}
+
+ssize_t sendv(int sockfd, const struct iovec* iov, int iovcnt, int flags)
+{
+    return transferv(sockfd, iov, iovcnt, flags, 0);
+}
+
+ssize_t recvv(int sockfd, const struct iovec* iov, int iovcnt, int flags)
+{
+    return transferv(sockfd, iov, iovcnt, flags, 1);
+}
@@ -47,6 +47,18 @@
 #define SO_RCVTIMEO     0x1006
 #define SO_ERROR        0x1007
 #define SO_TYPE         0x1008
+#define SO_NONBLOCK     0x1016
+
+// error returned by non-blocking sockets when nothing can be done right now
+#define SO_EWOULDBLOCK  6
+
+// the socket driver handles sockets as bits of a 32-bit mask
+#define SOCKET_MAX_SELECT_FDS 32
+
+#define POLLIN      0x01
+#define POLLPRI     0x02
+#define POLLOUT     0x04
+#define POLLERR     0x08
 
 #define INADDR_ANY          0x00000000
 #define INADDR_BROADCAST    0xFFFFFFFF
@@ -104,6 +116,20 @@ struct linger {
     int l_linger;
 };
 
+struct pollfd {
+    int     fd;
+    short   events;
+    short   revents;
+};
+
+struct iovec {
+    void*   iov_base;
+    size_t  iov_len;
+};
+
+// the socket driver takes at most two data vectors per request
+#define SOCKET_MAX_VECTORS 2
+
 int socketInit();
 int socketExit();
 
@@ -116,8 +142,49 @@ int getsockname(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 int getsockopt(int sockfd, int level, int optname, void *optval, socklen_t *optlen);
 int listen(int sockfd, int backlog);
 ssize_t recv(int sockfd, void *buf, size_t len, int flags);
+ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen);
 ssize_t send(int sockfd, const void *buf, size_t len, int flags);
+ssize_t sendto(int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen);
 int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen);
 int shutdown(int sockfd, int how);
 int socket(int domain, int type, int protocol);
 int sockatmark(int sockfd);
+
+/**
+ * Enable or disable non-blocking mode on a socket.
+ * Non-blocking calls return -SO_EWOULDBLOCK instead of waiting.
+ */
+int socketSetNonBlocking(int sockfd, int enable);
+
+/**
+ * Wait until any of the sockets in the masks is ready, sockets are bit numbers (fd < SOCKET_MAX_SELECT_FDS).
+ * The masks are updated to only contain the ready sockets.
+ * @param timeout timeout in microseconds, negative to wait forever
+ * @return the number of ready sockets, 0 on timeout, negative on error
+ */
+int socketSelect(int nfds, uint32_t* readfds, uint32_t* writefds, uint32_t* exceptfds, int32_t timeout);
+
+/**
+ * poll() on top of socketSelect().
+ * @param timeout timeout in milliseconds, negative to wait forever
+ */
+int poll(struct pollfd* fds, unsigned int nfds, int timeout);
+
+/**
+ * Allocate a buffer which can be passed to the socket driver directly.
+ * Only buffers allocated with this function can be used with sendv() and recvv().
+ */
+void* socketAllocBuffer(size_t size);
+void socketFreeBuffer(void* buf);
+
+/**
+ * Send from up to SOCKET_MAX_VECTORS socket buffers without copying them.
+ * The vectors are sent back to back as if they were one buffer.
+ */
+ssize_t sendv(int sockfd, const struct iovec* iov, int iovcnt, int flags);
+
+/**
+ * Receive into up to SOCKET_MAX_VECTORS socket buffers without copying them.
+ * The buffers should start 0x40 aligned, the cache maintenance on them covers whole lines.
+ */
+ssize_t recvv(int sockfd, const struct iovec* iov, int iovcnt, int flags);
@@ -0,0 +1,117 @@
+#include "stackmon.h"
+
+#include <string.h>
+
+#define STACKMON_PATTERN 0xcd
+
+typedef struct {
+    char name[STACKMON_NAME_LENGTH];
+    // NULL once the thread is gone, only its usage is kept then
+    uint8_t* stack;
+    uint32_t size;
+    // deepest usage of stacks with this name which have been unregistered or repainted
+    uint32_t used;
+} StackEntry;
+
+static StackEntry stacks[STACKMON_MAX_STACKS];
+
+static uint32_t scanUsage(const StackEntry* entry)
+{
+    // stacks grow down, so the untouched part is at the start
+    uint32_t unused = 0;
+    while (unused < entry->size && entry->stack[unused] == STACKMON_PATTERN) {
+        unused++;
+    }
+
+    return entry->size - unused;
+}
+
+// keep the current usage of a registered stack before it's repainted or freed
+static void retireStack(StackEntry* entry)
+{
+    uint32_t used = scanUsage(entry);
+    if (used > entry->used) {
+        entry->used = used;
+    }
+}
+
+void stackmon_register(const char* name, void* stack, uint32_t size)
+{
+    StackEntry* entry = NULL;
+    for (int i = 0; i < STACKMON_MAX_STACKS && !entry; i++) {
+        if (stacks[i].stack == stack) {
+            entry = &stacks[i];
+            retireStack(entry);
+        }
+    }
+
+    // a thread which ran before continues the entry of its earlier run
+    for (int i = 0; i < STACKMON_MAX_STACKS && !entry; i++) {
+        if (!stacks[i].stack && strncmp(stacks[i].name, name, STACKMON_NAME_LENGTH - 1) == 0) {
+            entry = &stacks[i];
+        }
+    }
+
+    for (int i = 0; i < STACKMON_MAX_STACKS && !entry; i++) {
+        if (!stacks[i].name[0]) {
+            entry = &stacks[i];
+        }
+    }
+
+    // running threads are more interesting than the usage of stopped ones
+    for (int i = 0; i < STACKMON_MAX_STACKS && !entry; i++) {
+        if (!stacks[i].stack) {
+            entry = &stacks[i];
+        }
+    }
+
+    // still paint the stack, there is just no room to report it
+    memset(stack, STACKMON_PATTERN, size);
+
+    if (entry) {
+        if (strncmp(entry->name, name, STACKMON_NAME_LENGTH - 1) != 0 || entry->size != size) {
+            entry->used = 0;
+        }
+
+        strncpy(entry->name, name, STACKMON_NAME_LENGTH - 1);
+        entry->name[STACKMON_NAME_LENGTH - 1] = '\0';
+        entry->size = size;
+        entry->stack = stack;
+    }
+}
+
+void stackmon_unregister(void* stack)
+{
+    for (int i = 0; i < STACKMON_MAX_STACKS; i++) {
+        if (stacks[i].stack == stack) {
+            retireStack(&stacks[i]);
+            stacks[i].stack = NULL;
+        }
+    }
+}
+
+int stackmon_get_usage(StackUsage* usage, int maxCount)
+{
+    int count = 0;
+    for (int i = 0; i < STACKMON_MAX_STACKS && count < maxCount; i++) {
+        StackEntry* entry = &stacks[i];
+        if (!entry->name[0]) {
+            continue;
+        }
+
+        uint32_t used = entry->used;
+        if (entry->stack) {
+            uint32_t current = scanUsage(entry);
+            if (current > used) {
+                used = current;
+            }
+        }
+
+        memcpy(usage[count].name, entry->name, STACKMON_NAME_LENGTH);
+        usage[count].size = entry->size;
+        usage[count].used = used;
+        count++;
+    }
+
+    return count;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+// menu, async, install, logger, profiler and nbd,
+// plus the listener and workers of wupserver (4) and httpserver (3)
+#define STACKMON_MAX_STACKS 16
+#define STACKMON_NAME_LENGTH 16
+
+typedef struct {
+    char name[STACKMON_NAME_LENGTH];
+    uint32_t size;
+    // deepest stack usage seen so far
+    uint32_t used;
+} StackUsage;
+
+/**
+ * Fill a thread stack with a known pattern and keep track of it.
+ * Must be called before the thread is created. Registering the same stack again repaints it.
+ * A stack registered under the name of an unregistered one continues its high-water mark.
+ */
+void stackmon_register(const char* name, void* stack, uint32_t size);
+
+/**
+ * Stop tracking a stack, needs to be called before freeing it.
+ * Its high-water mark is still reported afterwards.
+ */
+void stackmon_unregister(void* stack);
+
+/**
+ * Scan all registered stacks for their high-water mark, including the ones of unregistered stacks.
+ * @return the amount of entries written to usage
+ */
+int stackmon_get_usage(StackUsage* usage, int maxCount);
@@ -0,0 +1,254 @@
+#include <string.h>
+#include "imports.h"
+#include "socket.h"
+#include "tftp.h"
+
+/*
+ * TFTP client, only read requests in octet mode.
+ * The server sends TFTP_WINDOW_SIZE blocks before it waits for an ack of the last one.
+ * If a block goes missing, the last block received in order is acked and the server
+ * continues from there, which is the retransmission scheme of RFC 7440.
+ */
+
+#define TFTP_RRQ    1
+#define TFTP_DATA   3
+#define TFTP_ACK    4
+#define TFTP_ERROR  5
+#define TFTP_OACK   6
+
+#define TFTP_ERROR_DISK_FULL    3
+#define TFTP_ERROR_OPTIONS      8
+
+#define TFTP_DEFAULT_BLOCK_SIZE 512
+// the largest block which fits into an ethernet frame
+#define TFTP_BLOCK_SIZE         1468
+#define TFTP_WINDOW_SIZE        16
+
+// the request asks for TFTP_BLOCK_SIZE and TFTP_WINDOW_SIZE, tsize 0 asks the server for the file size
+static const char requestOptions[] = "octet\0" "blksize\0" "1468\0" "windowsize\0" "16\0" "tsize\0" "0";
+
+// in milliseconds
+#define TFTP_TIMEOUT    1000
+#define TFTP_RETRIES    5
+
+static uint32_t parseNumber(const char* str)
+{
+    uint32_t number = 0;
+    while (*str >= '0' && *str <= '9') {
+        number = number * 10 + (*str++ - '0');
+    }
+    return number;
+}
+
+static int sendRequest(int sock, const struct sockaddr_in* peer, uint8_t* packet, const char* filename, uint32_t filenameLength)
+{
+    packet[0] = 0;
+    packet[1] = TFTP_RRQ;
+    memcpy(packet + 2, filename, filenameLength);
+    packet[2 + filenameLength] = '\0';
+    memcpy(packet + 3 + filenameLength, requestOptions, sizeof(requestOptions));
+
+    return sendto(sock, packet, 3 + filenameLength + sizeof(requestOptions), 0, (const struct sockaddr*) peer, sizeof(*peer));
+}
+
+static int sendAck(int sock, const struct sockaddr_in* peer, uint16_t block)
+{
+    uint8_t ack[4] = { 0, TFTP_ACK, block >> 8, block };
+    return sendto(sock, ack, sizeof(ack), 0, (const struct sockaddr*) peer, sizeof(*peer));
+}
+
+static void sendError(int sock, const struct sockaddr_in* peer, uint16_t code, const char* message)
+{
+    uint8_t error[0x20] = { 0, TFTP_ERROR, code >> 8, code };
+    uint32_t length = strnlen(message, sizeof(error) - 5);
+    memcpy(error + 4, message, length);
+
+    sendto(sock, error, 5 + length, 0, (const struct sockaddr*) peer, sizeof(*peer));
+}
+
+// options are pairs of null terminated names and values
+static int parseOptions(const uint8_t* data, uint32_t size, uint32_t* blockSize, uint32_t* windowSize, uint32_t* totalSize)
+{
+    const char* end = (const char*) data + size;
+    const char* name = (const char*) data;
+    while (name < end) {
+        const char* value = name + strnlen(name, end - name) + 1;
+        if (value >= end) {
+            return -1;
+        }
+
+        uint32_t number = parseNumber(value);
+        if (strncmp(name, "blksize", sizeof("blksize")) == 0) {
+            if (number < 8 || number > TFTP_BLOCK_SIZE) {
+                return -1;
+            }
+            *blockSize = number;
+        } else if (strncmp(name, "windowsize", sizeof("windowsize")) == 0) {
+            if (number < 1 || number > TFTP_WINDOW_SIZE) {
+                return -1;
+            }
+            *windowSize = number;
+        } else if (strncmp(name, "tsize", sizeof("tsize")) == 0) {
+            *totalSize = number;
+        }
+
+        name = value + strnlen(value, end - value) + 1;
+    }
+
+    return 0;
+}
+
+int tftp_get(uint32_t serverAddress, const char* filename, TftpTransfer* transfer)
+{
+    transfer->totalSize = 0;
+    transfer->received = 0;
+    transfer->error[0] = '\0';
+
+    uint32_t filenameLength = strnlen(filename, TFTP_MAX_FILENAME + 1);
+    if (filenameLength > TFTP_MAX_FILENAME) {
+        return TFTP_ERROR_ABORTED;
+    }
+
+    // large enough for a data block and the request
+    uint8_t* packet = IOS_HeapAlloc(LOCAL_PROCESS_HEAP_ID, 4 + TFTP_BLOCK_SIZE);
+    if (!packet) {
+        return TFTP_ERROR_MEMORY;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, packet);
+        return TFTP_ERROR_SOCKET;
+    }
+
+    // the server answers from a new port, which is used for the rest of the transfer
+    struct sockaddr_in peer;
+    memset(&peer, 0, sizeof(peer));
+    peer.sin_family = AF_INET;
+    peer.sin_port = TFTP_PORT;
+    peer.sin_addr.s_addr = serverAddress;
+    int connected = 0;
+
+    uint32_t blockSize = TFTP_DEFAULT_BLOCK_SIZE;
+    uint32_t windowSize = 1;
+    uint32_t windowCount = 0;
+    // last block received in order, the block number wraps around for large files
+    uint16_t block = 0;
+    // blocks received out of order since the last one in order
+    uint32_t unexpected = 0;
+    int retries = 0;
+
+    int res = TFTP_ERROR_SOCKET;
+    if (sendRequest(sock, &peer, packet, filename, filenameLength) < 0) {
+        goto done;
+    }
+
+    while (1) {
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        int ret = poll(&pfd, 1, TFTP_TIMEOUT);
+        if (ret < 0) {
+            res = TFTP_ERROR_SOCKET;
+            break;
+        }
+
+        if (ret == 0) {
+            if (++retries > TFTP_RETRIES) {
+                res = TFTP_ERROR_TIMEOUT;
+                break;
+            }
+
+            // the request or an ack got lost, the server sends the next window once it gets the ack
+            windowCount = 0;
+            ret = connected ? sendAck(sock, &peer, block) : sendRequest(sock, &peer, packet, filename, filenameLength);
+            if (ret < 0) {
+                res = TFTP_ERROR_SOCKET;
+                break;
+            }
+            continue;
+        }
+
+        struct sockaddr_in from;
+        socklen_t fromLength = sizeof(from);
+        int size = recvfrom(sock, packet, 4 + TFTP_BLOCK_SIZE, 0, (struct sockaddr*) &from, &fromLength);
+        if (size < 0) {
+            res = TFTP_ERROR_SOCKET;
+            break;
+        }
+        if (size < 4 || from.sin_addr.s_addr != serverAddress) {
+            continue;
+        }
+
+        if (!connected) {
+            peer.sin_port = from.sin_port;
+            connected = 1;
+        } else if (from.sin_port != peer.sin_port) {
+            continue;
+        }
+
+        uint16_t opcode = (packet[0] << 8) | packet[1];
+        uint16_t number = (packet[2] << 8) | packet[3];
+        ret = 0;
+        if (opcode == TFTP_OACK && transfer->received == 0 && block == 0) {
+            if (parseOptions(packet + 2, size - 2, &blockSize, &windowSize, &transfer->totalSize) < 0) {
+                sendError(sock, &peer, TFTP_ERROR_OPTIONS, "Invalid options");
+                strncpy(transfer->error, "Invalid option acknowledgement", sizeof(transfer->error));
+                res = TFTP_ERROR_SERVER;
+                break;
+            }
+
+            retries = 0;
+            ret = sendAck(sock, &peer, 0);
+        } else if (opcode == TFTP_DATA) {
+            uint32_t dataSize = size - 4;
+            if (number == (uint16_t) (block + 1) && dataSize <= blockSize) {
+                block = number;
+                unexpected = 0;
+                retries = 0;
+
+                if (dataSize && transfer->write(transfer, packet + 4, dataSize) < 0) {
+                    sendError(sock, &peer, TFTP_ERROR_DISK_FULL, "Write failed");
+                    res = TFTP_ERROR_ABORTED;
+                    break;
+                }
+                transfer->received += dataSize;
+
+                // a short block ends the transfer
+                if (dataSize < blockSize) {
+                    sendAck(sock, &peer, block);
+                    res = 0;
+                    break;
+                }
+
+                if (++windowCount == windowSize) {
+                    windowCount = 0;
+                    ret = sendAck(sock, &peer, block);
+                }
+            } else if (unexpected++ % windowSize == 0) {
+                // a block got lost or the server resent a window after a lost ack,
+                // ack once per window so the server continues after the last block received in order
+                windowCount = 0;
+                ret = sendAck(sock, &peer, block);
+            }
+        } else if (opcode == TFTP_ERROR) {
+            uint32_t length = strnlen((const char*) packet + 4, size - 4);
+            if (length >= sizeof(transfer->error)) {
+                length = sizeof(transfer->error) - 1;
+            }
+            memcpy(transfer->error, packet + 4, length);
+            transfer->error[length] = '\0';
+
+            res = TFTP_ERROR_SERVER;
+            break;
+        }
+
+        if (ret < 0) {
+            res = TFTP_ERROR_SOCKET;
+            break;
+        }
+    }
+
+done:
+    closesocket(sock);
+    IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, packet);
+    return res;
+}
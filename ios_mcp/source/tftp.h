@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+#define TFTP_PORT 69
+#define TFTP_MAX_FILENAME 0x100
+
+#define TFTP_ERROR_SOCKET   -1
+#define TFTP_ERROR_TIMEOUT  -2
+#define TFTP_ERROR_SERVER   -3
+#define TFTP_ERROR_ABORTED  -4
+#define TFTP_ERROR_MEMORY   -5
+
+typedef struct TftpTransfer TftpTransfer;
+
+struct TftpTransfer {
+    /**
+     * Called with the data of every block, in order.
+     * @return 0 to continue, negative to abort the transfer
+     */
+    int (*write)(TftpTransfer* transfer, const uint8_t* data, uint32_t size);
+    void* userdata;
+
+    // size announced by the server with the tsize option, 0 if unknown
+    uint32_t totalSize;
+    uint32_t received;
+    // message of the server for TFTP_ERROR_SERVER
+    char error[0x40];
+};
+
+/**
+ * Download a file with TFTP (RFC 1350) in octet mode.
+ * Asks the server for larger blocks (RFC 2348), several blocks per ack (RFC 7440) and the file size (RFC 2349),
+ * and falls back to plain 512 byte blocks if the server doesn't support options.
+ * @param serverAddress IPv4 address of the server
+ * @param filename Name of the file on the server, at most TFTP_MAX_FILENAME characters
+ * @return 0 on success or a TFTP_ERROR_* code
+ */
+int tftp_get(uint32_t serverAddress, const char* filename, TftpTransfer* transfer);
@@ -0,0 +1,150 @@
+#include "trace.h"
+
+#ifdef TRACE
+
+#include "imports.h"
+#include "fsa.h"
+#include "stackmon.h"
+
+#include <stddef.h>
+#include <string.h>
+
+// must be a power of two
+#define TRACE_EVENT_COUNT 1024
+
+#define TRACE_MAGIC 0x54524345 // "TRCE"
+#define TRACE_VERSION 2
+#define TRACE_TAG_NAME_LENGTH 16
+
+typedef struct {
+    uint32_t timestamp;
+    uint8_t type;
+    uint8_t tag;
+    uint16_t threadId;
+    uint32_t args[2];
+} TraceEvent;
+static_assert(sizeof(TraceEvent) == 0x10);
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    // ticks per second of the timestamps
+    uint32_t timebase;
+    uint32_t numEvents;
+    uint32_t numTags;
+    uint32_t numStacks;
+    char tagNames[TRACE_TAG_COUNT][TRACE_TAG_NAME_LENGTH];
+    // stack high-water marks at the time of the dump
+    StackUsage stacks[STACKMON_MAX_STACKS];
+} TraceHeader;
+
+static const char tagNames[TRACE_TAG_COUNT][TRACE_TAG_NAME_LENGTH] = {
+    [TRACE_TAG_FSA_OPEN_FILE]           = "FSA_OpenFile",
+    [TRACE_TAG_FSA_CLOSE_FILE]          = "FSA_CloseFile",
+    [TRACE_TAG_FSA_READ_FILE]           = "FSA_ReadFile",
+    [TRACE_TAG_FSA_WRITE_FILE]          = "FSA_WriteFile",
+    [TRACE_TAG_FSA_RAW_READ]            = "FSA_RawRead",
+    [TRACE_TAG_FSA_RAW_WRITE]           = "FSA_RawWrite",
+    [TRACE_TAG_SOCKET_RECV]             = "recv",
+    [TRACE_TAG_SOCKET_SEND]             = "send",
+    [TRACE_TAG_GFX_CLEAR]               = "gfx_clear",
+    [TRACE_TAG_GFX_RECT]                = "gfx_rect",
+    [TRACE_TAG_GFX_PRINT]               = "gfx_print",
+    [TRACE_TAG_BSP_READ]                = "bspRead",
+    [TRACE_TAG_MCP_INSTALL_PROGRESS]    = "InstallProgress",
+};
+
+// allocated for IPC, so it can be written to a file without copying
+static TraceEvent* traceEvents = NULL;
+static volatile uint32_t traceWritePos = 0;
+
+int trace_init(void)
+{
+    if (traceEvents) {
+        return 0;
+    }
+
+    traceEvents = IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, TRACE_EVENT_COUNT * sizeof(TraceEvent), 0x40);
+    if (!traceEvents) {
+        return -1;
+    }
+
+    traceWritePos = 0;
+    return 0;
+}
+
+void trace_event(TraceEventType type, TraceTag tag, uint32_t arg0, uint32_t arg1)
+{
+    if (!traceEvents) {
+        return;
+    }
+
+    uint64_t now;
+    IOS_GetAbsTime64(&now);
+
+    // threads may race for the same slot here, this only ever loses an event
+    TraceEvent* ev = &traceEvents[traceWritePos++ & (TRACE_EVENT_COUNT - 1)];
+    ev->timestamp = (uint32_t) now;
+    ev->type = type;
+    ev->tag = tag;
+    ev->threadId = IOS_GetCurrentThreadId();
+    ev->args[0] = arg0;
+    ev->args[1] = arg1;
+}
+
+int trace_dump(int fsaHandle, const char* path)
+{
+    if (!traceEvents) {
+        return -1;
+    }
+
+    TraceHeader* header = IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, sizeof(TraceHeader), 0x40);
+    if (!header) {
+        return -1;
+    }
+
+    // stop recording while writing the buffer, the FSA calls would be traced as well
+    TraceEvent* events = traceEvents;
+    traceEvents = NULL;
+
+    uint32_t count = traceWritePos;
+    uint32_t start = 0;
+    if (count > TRACE_EVENT_COUNT) {
+        start = count & (TRACE_EVENT_COUNT - 1);
+        count = TRACE_EVENT_COUNT;
+    }
+
+    header->magic = TRACE_MAGIC;
+    header->version = TRACE_VERSION;
+    // IOS_GetAbsTime64 counts microseconds
+    header->timebase = 1000000;
+    header->numEvents = count;
+    header->numTags = TRACE_TAG_COUNT;
+    memcpy(header->tagNames, tagNames, sizeof(tagNames));
+    header->numStacks = stackmon_get_usage(header->stacks, STACKMON_MAX_STACKS);
+
+    int fileHandle;
+    int res = FSA_OpenFile(fsaHandle, path, "w", &fileHandle);
+    if (res >= 0) {
+        // only the valid stack entries are written
+        res = FSA_WriteFile(fsaHandle, header, 1, offsetof(TraceHeader, stacks) + header->numStacks * sizeof(StackUsage), fileHandle, 0);
+
+        // write the events oldest first
+        uint32_t firstPart = (count < TRACE_EVENT_COUNT - start) ? count : TRACE_EVENT_COUNT - start;
+        if (res >= 0 && firstPart) {
+            res = FSA_WriteFile(fsaHandle, &events[start], 1, firstPart * sizeof(TraceEvent), fileHandle, 0);
+        }
+        if (res >= 0 && count - firstPart) {
+            res = FSA_WriteFile(fsaHandle, events, 1, (count - firstPart) * sizeof(TraceEvent), fileHandle, 0);
+        }
+
+        FSA_CloseFile(fsaHandle, fileHandle);
+    }
+
+    IOS_HeapFree(CROSS_PROCESS_HEAP_ID, header);
+    traceEvents = events;
+
+    return (res < 0) ? res : 0;
+}
+
+#endif /* TRACE */
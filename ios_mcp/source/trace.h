@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    TRACE_TAG_FSA_OPEN_FILE,
+    TRACE_TAG_FSA_CLOSE_FILE,
+    TRACE_TAG_FSA_READ_FILE,
+    TRACE_TAG_FSA_WRITE_FILE,
+    TRACE_TAG_FSA_RAW_READ,
+    TRACE_TAG_FSA_RAW_WRITE,
+    TRACE_TAG_SOCKET_RECV,
+    TRACE_TAG_SOCKET_SEND,
+    TRACE_TAG_GFX_CLEAR,
+    TRACE_TAG_GFX_RECT,
+    TRACE_TAG_GFX_PRINT,
+    TRACE_TAG_BSP_READ,
+    TRACE_TAG_MCP_INSTALL_PROGRESS,
+
+    TRACE_TAG_COUNT,
+} TraceTag;
+
+typedef enum {
+    TRACE_EVENT_BEGIN   = 'B',
+    TRACE_EVENT_END     = 'E',
+    TRACE_EVENT_INSTANT = 'i',
+} TraceEventType;
+
+#ifdef TRACE
+
+#define TRACE_BEGIN(tag, arg0, arg1)    trace_event(TRACE_EVENT_BEGIN, (tag), (uint32_t) (arg0), (uint32_t) (arg1))
+#define TRACE_END(tag, arg0, arg1)      trace_event(TRACE_EVENT_END, (tag), (uint32_t) (arg0), (uint32_t) (arg1))
+#define TRACE_INSTANT(tag, arg0, arg1)  trace_event(TRACE_EVENT_INSTANT, (tag), (uint32_t) (arg0), (uint32_t) (arg1))
+
+int trace_init(void);
+
+void trace_event(TraceEventType type, TraceTag tag, uint32_t arg0, uint32_t arg1);
+
+/**
+ * Write the trace buffer to a file.
+ * Use tools/trace2json.py to convert it to the Chrome trace format.
+ * @return 0 on success; negative on error.
+ */
+int trace_dump(int fsaHandle, const char* path);
+
+#else /* !TRACE */
+
+#define TRACE_BEGIN(tag, arg0, arg1)    do { } while (0)
+#define TRACE_END(tag, arg0, arg1)      do { } while (0)
+#define TRACE_INSTANT(tag, arg0, arg1)  do { } while (0)
+
+static inline int trace_init(void) { return 0; }
+
+#endif /* TRACE */
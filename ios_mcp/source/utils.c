@@ -1,6 +1,8 @@
 #include "utils.h"
 #include "imports.h"
 #include "fsa.h"
+#include "trace.h"
+#include "stackmon.h"
 
 #define COPY_BUFFER_SIZE 1024
 
@@ -48,6 +50,7 @@ int initializeUtils(void)
         return -1;
     }
 
+    stackmon_register("async", asyncThreadStack, sizeof(asyncThreadStack));
     asyncThreadHandle = IOS_CreateThread(asyncThread, NULL, asyncThreadStack + sizeof(asyncThreadStack), sizeof(asyncThreadStack), IOS_GetThreadPriority(0) - 0x20, IOS_THREAD_FLAGS_NONE);
     if (asyncThreadHandle < 0) {
         return -1;
@@ -87,6 +90,26 @@ void kernWrite32(uint32_t address, uint32_t value)
     IOS_Syscall0x81(1, address, value);
 }
 
+int kernReadLog(void* buffer, uint32_t size)
+{
+    return IOS_Syscall0x81(2, (uint32_t) buffer, size);
+}
+
+int kernWriteSerial(const void* buffer, uint32_t size)
+{
+    return IOS_Syscall0x81(3, (uint32_t) buffer, size);
+}
+
+int kernProfilerControl(uint32_t interval)
+{
+    return IOS_Syscall0x81(4, 0, interval);
+}
+
+int kernProfilerRead(void* buffer, uint32_t size)
+{
+    return IOS_Syscall0x81(5, (uint32_t) buffer, size);
+}
+
 int EEPROM_Read(uint16_t offset, uint16_t num, uint16_t* buf)
 {
     if (offset + num > 0x100) {
@@ -95,7 +118,9 @@ int EEPROM_Read(uint16_t offset, uint16_t num, uint16_t* buf)
 
     for (uint16_t i = offset; i < offset + num; i++) {
         uint16_t tmp;
+        TRACE_BEGIN(TRACE_TAG_BSP_READ, i, 2);
         int res = bspRead("EE", i, "access", 2, &tmp);
+        TRACE_END(TRACE_TAG_BSP_READ, i, res);
         if (res < 0) {
             return res;
         }
@@ -164,11 +189,15 @@ int DISPLAY_DCInit(uint32_t configuration)
 
 int DISPLAY_ReadDCConfig(DC_Config* config)
 {
-    return bspRead("DISPLAY", 0, "DC_CONFIG", sizeof(DC_Config), config);
+    TRACE_BEGIN(TRACE_TAG_BSP_READ, 0, sizeof(DC_Config));
+    int res = bspRead("DISPLAY", 0, "DC_CONFIG", sizeof(DC_Config), config);
+    TRACE_END(TRACE_TAG_BSP_READ, 0, res);
+    return res;
 }
 
 int SMC_ReadSystemEventFlag(uint8_t* flag)
 {
+    // not traced, the menu polls this in a tight loop and would flush out all other events
     return bspRead("SMC", 0, "SystemEventFlag", 1, flag);
 }
 
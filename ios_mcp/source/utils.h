@@ -70,6 +70,19 @@ uint32_t kernRead32(uint32_t address);
 
 void kernWrite32(uint32_t address, uint32_t value);
 
+int kernReadLog(void* buffer, uint32_t size);
+
+int kernWriteSerial(const void* buffer, uint32_t size);
+
+/**
+ * Set the sampling interval of the kernel profiler in timer interrupts, 0 stops it.
+ * Only available in builds with PROFILER=1.
+ * @return the amount of dropped samples; negative on error.
+ */
+int kernProfilerControl(uint32_t interval);
+
+int kernProfilerRead(void* buffer, uint32_t size);
+
 int EEPROM_Read(uint16_t offset, uint16_t num, uint16_t* buf);
 
 int resetPPC(void);
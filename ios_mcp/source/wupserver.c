@@ -5,19 +5,511 @@
 #include "imports.h"
 #include "socket.h"
 #include "wupserver.h"
+#include "server.h"
+#include "fsa.h"
+#include "menu.h"
+#include "utils.h"
 
 #define MCP_SVC_BASE ((void*) 0x050567ec)
 
-static int serverRunning = 0;
-static int serverSocket = -1;
-static int threadId = -1;
-static uint8_t threadStack[0x1000] __attribute__((aligned(0x20)));
+// host builds replace the svc table, see tools/wupserver_host
+#ifndef WUPSERVER_SVC
+#define WUPSERVER_SVC(svc_id) ((int (*const)(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t))(MCP_SVC_BASE + (svc_id) * 8))
+#endif
+
+// every client gets its own worker thread, so this bounds the memory used by the server
+#ifndef WUPSERVER_MAX_CLIENTS
+#define WUPSERVER_MAX_CLIENTS 4
+#endif
+
+#define WORKER_STACK_SIZE 0x800
+#define COMMAND_BUFFER_SIZE 0x600
+
+/*
+ * Clients start out with the legacy protocol, where every recv is handled as a single command.
+ * Sending the hello command [6][WUPSERVER_HELLO_MAGIC][version] as the first command switches
+ * the connection to the framed protocol, the reply is [0][negotiated version].
+ * In framed mode requests and replies are prefixed with [length][request_id], where length is the
+ * size of the payload following the header. The payload is the same as in the legacy protocol.
+ * Requests can be pipelined, replies are sent in order.
+ * Frames with the request_id WATCH_PUSH_REQUEST_ID are pushed by the server for watches, see serverWatchHandler.
+ */
+#define WUPSERVER_HELLO_MAGIC 0x57555046 // "WUPF"
+#define WUPSERVER_PROTOCOL_VERSION 1
+
+#define FRAME_HEADER_SIZE 8
+#define FRAME_IN_BUFFER_SIZE (FRAME_HEADER_SIZE + COMMAND_BUFFER_SIZE)
+// replies are collected here until no more complete requests are buffered
+#define FRAME_OUT_BUFFER_SIZE 0x800
+
+#define WATCH_MAX_COUNT 8
+#define WATCH_MAX_SIZE 0x100
+#define WATCH_MIN_INTERVAL 1000
+#define WATCH_PUSH_REQUEST_ID 0xffffffff
+
+typedef struct {
+    uint32_t addr;
+    // 0 if the slot is unused
+    uint32_t length;
+    uint32_t interval;
+    uint64_t nextSample;
+    uint8_t data[WATCH_MAX_SIZE];
+} Watch;
+
+// buffers of a worker of the pool
+typedef struct {
+    uint32_t* commandBuffer;
+    uint8_t* frameInBuffer;
+    uint8_t* frameOutBuffer;
+    // allocated on the first subscribe, freed when the client disconnects
+    Watch* watches;
+} Worker;
+
+static const char* const workerNames[] = { "wupworker0", "wupworker1", "wupworker2", "wupworker3", "wupworker4", "wupworker5", "wupworker6", "wupworker7" };
+static_assert(WUPSERVER_MAX_CLIENTS <= sizeof(workerNames) / sizeof(workerNames[0]), "not enough worker names");
+static_assert(WUPSERVER_MAX_CLIENTS <= SERVER_MAX_WORKERS, "too many workers");
+
+static ServerPool pool = { .threadId = -1 };
+static Worker* workers = NULL;
+
+static int callSvc(int svc_id, const uint32_t* arguments)
+{
+    return WUPSERVER_SVC(svc_id)(arguments[0], arguments[1], arguments[2], arguments[3], arguments[4], arguments[5], arguments[6], arguments[7]);
+}
+
+/*
+ * batch
+ * [cmd_id][scratch_size][num_subcommands] followed by the sub-commands
+ * each sub-command is [op | refmask << 8 | num_args << 16][args...]
+ * arguments with their bit set in refmask are offsets into a scratch buffer allocated for the batch,
+ * which is allocated from the cross process heap so it can be passed to other processes.
+ * this also applies to the data words of a write, which allows writing pointers into the scratch buffer (e.g. for iovecs).
+ * ops:
+ *   0 write   [dst][data...]
+ *   1 read    [src][length] -> data (padded to 4 bytes) is appended to the reply
+ *   2 svc     [svc_id][args...] -> result is appended to the reply
+ *   4 memcpy  [dst][src][size]
+ * the reply is [0][results of all reads and svcs in order]
+ */
+#define BATCH_MAX_SCRATCH_SIZE 0x4000
+
+static int serverBatchHandler(uint32_t* command_buffer, uint32_t length)
+{
+    if (length < 12) {
+        return -1;
+    }
+
+    uint32_t scratchSize = command_buffer[1];
+    uint32_t numSubcommands = command_buffer[2];
+    uint32_t numWords = (length - 12) / 4;
+    if (scratchSize > BATCH_MAX_SCRATCH_SIZE) {
+        return -3;
+    }
+
+    // the reply overwrites command_buffer, so parse from a copy
+    uint32_t* request = IOS_HeapAlloc(LOCAL_PROCESS_HEAP_ID, numWords * 4 + 4);
+    uint8_t* scratch = scratchSize ? IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, scratchSize, 0x40) : NULL;
+    if (!request || (scratchSize && !scratch)) {
+        if (request) IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, request);
+        if (scratch) IOS_HeapFree(CROSS_PROCESS_HEAP_ID, scratch);
+        return -4;
+    }
+    memcpy(request, &command_buffer[3], numWords * 4);
+    if (scratch) {
+        memset(scratch, 0, scratchSize);
+    }
+
+    int res = 0;
+    uint32_t out = 1;
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i < numSubcommands; i++) {
+        if (pos >= numWords) {
+            res = -1;
+            break;
+        }
+
+        uint32_t op = request[pos] & 0xff;
+        uint32_t refmask = (request[pos] >> 8) & 0xff;
+        uint32_t numArgs = request[pos] >> 16;
+        uint32_t* args = &request[pos + 1];
+        if (numArgs > numWords - pos - 1) {
+            res = -1;
+            break;
+        }
+        pos += 1 + numArgs;
+
+        for (uint32_t j = 0; j < 8 && j < numArgs; j++) {
+            if (refmask & (1 << j)) {
+                if (!scratch || args[j] > scratchSize) {
+                    res = -3;
+                    break;
+                }
+                args[j] += (uint32_t) scratch;
+            }
+        }
+        if (res < 0) {
+            break;
+        }
+
+        if (op == 0 && numArgs >= 1) {
+            memcpy((void*) args[0], &args[1], (numArgs - 1) * 4);
+        } else if (op == 1 && numArgs == 2) {
+            // check before rounding up, which wraps for huge lengths
+            if (args[1] > COMMAND_BUFFER_SIZE) {
+                res = -3;
+                break;
+            }
+            uint32_t size = (args[1] + 3) & ~3;
+            if (out * 4 + size > COMMAND_BUFFER_SIZE) {
+                res = -3;
+                break;
+            }
+            memcpy(&command_buffer[out], (void*) args[0], args[1]);
+            out += size / 4;
+        } else if (op == 2 && numArgs >= 1) {
+            uint32_t arguments[8];
+            memset(arguments, 0x00, sizeof(arguments));
+            memcpy(arguments, &args[1], ((numArgs - 1) < 8 ? (numArgs - 1) : 8) * 4);
+            if ((out + 1) * 4 > COMMAND_BUFFER_SIZE) {
+                res = -3;
+                break;
+            }
+            command_buffer[out++] = callSvc(args[0], arguments);
+        } else if (op == 4 && numArgs == 3) {
+            memcpy((void*) args[0], (void*) args[1], args[2]);
+        } else {
+            res = -2;
+            break;
+        }
+    }
+
+    IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, request);
+    if (scratch) {
+        IOS_HeapFree(CROSS_PROCESS_HEAP_ID, scratch);
+    }
+
+    return (res < 0) ? res : (int) (out * 4);
+}
+
+/*
+ * search
+ * [cmd_id][start][end][pattern_length][max_matches][pattern][mask]
+ * scans [start, end) for pattern, the mask is optional and has the same length as the pattern.
+ * only bits set in the mask are compared.
+ * the reply is [0][next][num_matches][addresses...]
+ * the scan stops once max_matches addresses were found, next is the address to continue from,
+ * or end if the whole range was scanned.
+ */
+#define SEARCH_MAX_PATTERN_SIZE 0x40
+#define SEARCH_MAX_MATCHES ((COMMAND_BUFFER_SIZE - 12) / 4)
+
+static int serverSearchHandler(uint32_t* command_buffer, uint32_t length)
+{
+    if (length < 20) {
+        return -1;
+    }
+
+    uint32_t start = command_buffer[1];
+    uint32_t end = command_buffer[2];
+    uint32_t patternLength = command_buffer[3];
+    uint32_t maxMatches = command_buffer[4];
+    if (!patternLength || patternLength > SEARCH_MAX_PATTERN_SIZE || length < 20 + patternLength) {
+        return -1;
+    }
+    if (!maxMatches || maxMatches > SEARCH_MAX_MATCHES) {
+        maxMatches = SEARCH_MAX_MATCHES;
+    }
+
+    // the reply overwrites command_buffer, so copy the pattern out first
+    uint8_t pattern[SEARCH_MAX_PATTERN_SIZE];
+    uint8_t mask[SEARCH_MAX_PATTERN_SIZE];
+    const uint8_t* data = (const uint8_t*) &command_buffer[5];
+    memcpy(pattern, data, patternLength);
+    if (length >= 20 + patternLength * 2) {
+        memcpy(mask, data + patternLength, patternLength);
+    } else {
+        memset(mask, 0xff, patternLength);
+    }
+
+    for (uint32_t i = 0; i < patternLength; i++) {
+        pattern[i] &= mask[i];
+    }
+
+    uint32_t numMatches = 0;
+    uint32_t addr = start;
+    if (end >= start + patternLength) {
+        uint32_t last = end - patternLength;
+        for (; addr <= last && numMatches < maxMatches; addr++) {
+            const uint8_t* mem = (const uint8_t*) addr;
+            // most candidates fail on the first byte, so check that before doing the full compare
+            if ((mem[0] & mask[0]) != pattern[0]) {
+                continue;
+            }
+
+            uint32_t i = 1;
+            while (i < patternLength && (mem[i] & mask[i]) == pattern[i]) {
+                i++;
+            }
+
+            if (i == patternLength) {
+                command_buffer[3 + numMatches++] = addr;
+            }
+        }
+    }
+
+    command_buffer[1] = (numMatches < maxMatches) ? end : addr;
+    command_buffer[2] = numMatches;
+    return 12 + numMatches * 4;
+}
+
+/*
+ * hash
+ * [11][algorithm][addr][length] hashes memory
+ * [12][algorithm][path] hashes a file, path is null-terminated
+ * algorithms:
+ *   0 sha256 -> 32 byte digest
+ *   1 crc32  -> 4 byte digest
+ * the reply is [0][number of bytes hashed][digest]
+ */
+#define HASH_ALGORITHM_SHA256 0
+#define HASH_ALGORITHM_CRC32 1
+
+// data is staged in an ipc buffer, so this is also the most IOSC and FSA see per call
+#define HASH_CHUNK_SIZE 0x4000
+
+typedef struct {
+    uint32_t algorithm;
+    uint32_t crc;
+    uint8_t context[IOSC_HASH_CONTEXT_SIZE];
+} HashState;
+
+static int hashInit(HashState* state, uint32_t algorithm)
+{
+    state->algorithm = algorithm;
+    if (algorithm == HASH_ALGORITHM_SHA256) {
+        return IOSC_GenerateHash(state->context, sizeof(state->context), NULL, 0, IOSC_HASH_FLAGS_SHA256_INIT, NULL, 0);
+    } else if (algorithm == HASH_ALGORITHM_CRC32) {
+        state->crc = 0xffffffff;
+        return 0;
+    }
+
+    return -2;
+}
+
+static int hashUpdate(HashState* state, uint8_t* data, uint32_t size)
+{
+    if (state->algorithm == HASH_ALGORITHM_SHA256) {
+        return IOSC_GenerateHash(state->context, sizeof(state->context), data, size, IOSC_HASH_FLAGS_SHA256_UPDATE, NULL, 0);
+    }
+
+    state->crc = crc32(state->crc, data, size);
+    return 0;
+}
+
+// returns the size of the digest
+static int hashFinalize(HashState* state, uint8_t* digest)
+{
+    if (state->algorithm == HASH_ALGORITHM_SHA256) {
+        int res = IOSC_GenerateHash(state->context, sizeof(state->context), NULL, 0, IOSC_HASH_FLAGS_SHA256_FINALIZE, digest, 32);
+        return (res < 0) ? res : 32;
+    }
+
+    uint32_t crc = ~state->crc;
+    memcpy(digest, &crc, 4);
+    return 4;
+}
+
+static int hashMemory(HashState* state, uint8_t* chunk, uint32_t addr, uint32_t length)
+{
+    while (length) {
+        uint32_t size = (length < HASH_CHUNK_SIZE) ? length : HASH_CHUNK_SIZE;
+        // copy to the ipc buffer first, the crypto process can't access every address we can
+        memcpy(chunk, (void*) addr, size);
+
+        int res = hashUpdate(state, chunk, size);
+        if (res < 0) {
+            return res;
+        }
+
+        addr += size;
+        length -= size;
+    }
+
+    return 0;
+}
+
+static int hashFile(HashState* state, uint8_t* chunk, const char* path, uint32_t* outSize)
+{
+    int fileHandle;
+    int res = FSA_OpenFile(fsaHandle, path, "r", &fileHandle);
+    if (res < 0) {
+        return res;
+    }
+
+    *outSize = 0;
+    while ((res = FSA_ReadFile(fsaHandle, chunk, 1, HASH_CHUNK_SIZE, fileHandle, 0)) > 0) {
+        *outSize += res;
+        int hashRes = hashUpdate(state, chunk, res);
+        if (hashRes < 0) {
+            res = hashRes;
+            break;
+        }
+    }
+
+    FSA_CloseFile(fsaHandle, fileHandle);
+    return res;
+}
+
+static int serverHashHandler(uint32_t* command_buffer, uint32_t length)
+{
+    if (length < 12) {
+        return -1;
+    }
+
+    int isFile = (command_buffer[0] == 12);
+    HashState state;
+    int res = hashInit(&state, command_buffer[1]);
+    if (res < 0) {
+        return res;
+    }
+
+    uint8_t* chunk = IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, HASH_CHUNK_SIZE, 0x40);
+    if (!chunk) {
+        return -4;
+    }
+
+    uint32_t size;
+    if (isFile) {
+        // make sure the path is terminated
+        ((char*) command_buffer)[(length < COMMAND_BUFFER_SIZE) ? length : COMMAND_BUFFER_SIZE - 1] = '\0';
+        res = hashFile(&state, chunk, (const char*) &command_buffer[2], &size);
+    } else if (length >= 16) {
+        size = command_buffer[3];
+        res = hashMemory(&state, chunk, command_buffer[2], size);
+    } else {
+        res = -1;
+    }
+
+    IOS_HeapFree(CROSS_PROCESS_HEAP_ID, chunk);
+    if (res < 0) {
+        return res;
+    }
+
+    res = hashFinalize(&state, (uint8_t*) &command_buffer[2]);
+    if (res < 0) {
+        return res;
+    }
+
+    command_buffer[1] = size;
+    return 8 + res;
+}
+
+/*
+ * ioctl
+ * [15][fd][request][in_size][out_size][in data] -> [0][result][out data]
+ * ioctlv
+ * [16][fd][request][num_in][num_out][sizes of all vectors][in data of every in vector] -> [0][result][out data of every out vector]
+ * the data of every vector is padded to 4 bytes.
+ * every vector gets its own 0x40 aligned buffer from the cross process heap.
+ */
+#define IOCTL_MAX_VECTORS 8
+#define IOCTL_VECTOR_ALIGN(x) (((x) + 0x3f) & ~0x3f)
+#define IOCTL_DATA_ALIGN(x) (((x) + 3) & ~3)
+
+static int serverIoctlHandler(uint32_t* command_buffer, uint32_t length)
+{
+    if (length < 20) {
+        return -1;
+    }
+
+    int isIoctlv = (command_buffer[0] == 16);
+    int fd = command_buffer[1];
+    uint32_t request = command_buffer[2];
+    uint32_t numIn = isIoctlv ? command_buffer[3] : 1;
+    uint32_t numOut = isIoctlv ? command_buffer[4] : 1;
+    uint32_t numVecs = numIn + numOut;
+    if (numIn > IOCTL_MAX_VECTORS || numOut > IOCTL_MAX_VECTORS || numVecs > IOCTL_MAX_VECTORS) {
+        return -3;
+    }
+
+    uint32_t sizes[IOCTL_MAX_VECTORS];
+    const uint8_t* data;
+    if (isIoctlv) {
+        if (length < 20 + numVecs * 4) {
+            return -1;
+        }
+        memcpy(sizes, &command_buffer[5], numVecs * 4);
+        data = (const uint8_t*) &command_buffer[5 + numVecs];
+    } else {
+        sizes[0] = command_buffer[3];
+        sizes[1] = command_buffer[4];
+        data = (const uint8_t*) &command_buffer[5];
+    }
+
+    // make sure the request holds all in data and the reply fits all out data
+    uint32_t inLength = 0;
+    uint32_t outLength = 0;
+    uint32_t bufferSize = IOCTL_VECTOR_ALIGN(sizeof(IOSVec_t) * numVecs);
+    for (uint32_t i = 0; i < numVecs; i++) {
+        if (sizes[i] > COMMAND_BUFFER_SIZE) {
+            return -3;
+        }
+
+        if (i < numIn) {
+            inLength += IOCTL_DATA_ALIGN(sizes[i]);
+        } else {
+            outLength += IOCTL_DATA_ALIGN(sizes[i]);
+        }
+        bufferSize += IOCTL_VECTOR_ALIGN(sizes[i]);
+    }
+    if (data + inLength > (const uint8_t*) command_buffer + length || 8 + outLength > COMMAND_BUFFER_SIZE) {
+        return -3;
+    }
+
+    uint8_t* buffer = IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, bufferSize, 0x40);
+    if (!buffer) {
+        return -4;
+    }
+    memset(buffer, 0, bufferSize);
+
+    IOSVec_t* vecs = (IOSVec_t*) buffer;
+    uint8_t* ptr = buffer + IOCTL_VECTOR_ALIGN(sizeof(IOSVec_t) * numVecs);
+    for (uint32_t i = 0; i < numVecs; i++) {
+        vecs[i].ptr = sizes[i] ? ptr : NULL;
+        vecs[i].len = sizes[i];
+        if (i < numIn) {
+            memcpy(ptr, data, sizes[i]);
+            data += IOCTL_DATA_ALIGN(sizes[i]);
+        }
+        ptr += IOCTL_VECTOR_ALIGN(sizes[i]);
+    }
+
+    int res;
+    if (isIoctlv) {
+        res = IOS_Ioctlv(fd, request, numIn, numOut, vecs);
+    } else {
+        res = IOS_Ioctl(fd, request, vecs[0].ptr, vecs[0].len, vecs[1].ptr, vecs[1].len);
+    }
+
+    command_buffer[1] = res;
+    uint8_t* out = (uint8_t*) &command_buffer[2];
+    for (uint32_t i = numIn; i < numVecs; i++) {
+        if (sizes[i]) {
+            memcpy(out, vecs[i].ptr, sizes[i]);
+        }
+        out += IOCTL_DATA_ALIGN(sizes[i]);
+    }
+
+    IOS_HeapFree(CROSS_PROCESS_HEAP_ID, buffer);
+    return 8 + outLength;
+}
 
 // overwrites command_buffer with response
 // returns length of response (or 0 for no response, negative for error)
 static int serverCommandHandler(uint32_t* command_buffer, uint32_t length)
 {
-    if(!command_buffer || !length) return -1;
+    // frames can be shorter than a command id, make sure not to dispatch on what a previous command left behind
+    if(!command_buffer || length < 4) return -1;
 
     int out_length = 4;
 
@@ -25,6 +517,9 @@ static int serverCommandHandler(uint32_t* command_buffer, uint32_t length)
     case 0: {
         // write
         // [cmd_id][addr]
+            if (length < 8) {
+                return -1;
+            }
             void* dst = (void*)command_buffer[1];
 
             memcpy(dst, &command_buffer[2], length - 8);
@@ -33,8 +528,14 @@ static int serverCommandHandler(uint32_t* command_buffer, uint32_t length)
     case 1: {
         // read
         // [cmd_id][addr][length]
+            if (length != 12) {
+                return -1;
+            }
             void* src = (void*)command_buffer[1];
             length = command_buffer[2];
+            if (length > COMMAND_BUFFER_SIZE - 4) {
+                return -3;
+            }
 
             memcpy(&command_buffer[1], src, length);
             out_length = length + 4;
@@ -43,6 +544,9 @@ static int serverCommandHandler(uint32_t* command_buffer, uint32_t length)
     case 2: {
         // svc
         // [cmd_id][svc_id]
+            if (length < 8) {
+                return -1;
+            }
             int svc_id = command_buffer[1];
             int size_arguments = length - 8;
 
@@ -52,19 +556,23 @@ static int serverCommandHandler(uint32_t* command_buffer, uint32_t length)
 
             // return error code as data
             out_length = 8;
-            command_buffer[1] = ((int (*const)(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t))(MCP_SVC_BASE + svc_id * 8))
-                (arguments[0], arguments[1], arguments[2], arguments[3], arguments[4], arguments[5], arguments[6], arguments[7]);
+            command_buffer[1] = callSvc(svc_id, arguments);
         }
         break;
     case 3: {
         // kill
         // [cmd_id]
-            wupserver_deinit();
+            // this runs on a worker thread, so only stop the server here
+            // the threads are joined by the next wupserver_init/deinit
+            server_pool_stop(&pool);
         }
         break;
     case 4: {
         // memcpy
         // [dst][src][size]
+            if (length < 16) {
+                return -1;
+            }
             void* dst = (void*)command_buffer[1];
             void* src = (void*)command_buffer[2];
             int size = command_buffer[3];
@@ -75,6 +583,9 @@ static int serverCommandHandler(uint32_t* command_buffer, uint32_t length)
     case 5: {
         // repeated-write
         // [address][value][n]
+            if (length < 16) {
+                return -1;
+            }
             uint32_t* dst = (uint32_t*)command_buffer[1];
             uint32_t* cache_range = (uint32_t*)(command_buffer[1] & ~0xFF);
             uint32_t value = command_buffer[2];
@@ -97,6 +608,40 @@ static int serverCommandHandler(uint32_t* command_buffer, uint32_t length)
             }
         }
         break;
+    case 7: {
+        // batch, see serverBatchHandler
+            out_length = serverBatchHandler(command_buffer, length);
+            if (out_length < 0) {
+                return out_length;
+            }
+        }
+        break;
+    case 10: {
+        // search, see serverSearchHandler
+            out_length = serverSearchHandler(command_buffer, length);
+            if (out_length < 0) {
+                return out_length;
+            }
+        }
+        break;
+    case 11:
+    case 12: {
+        // hash memory / hash file, see serverHashHandler
+            out_length = serverHashHandler(command_buffer, length);
+            if (out_length < 0) {
+                return out_length;
+            }
+        }
+        break;
+    case 15:
+    case 16: {
+        // ioctl / ioctlv, see serverIoctlHandler
+            out_length = serverIoctlHandler(command_buffer, length);
+            if (out_length < 0) {
+                return out_length;
+            }
+        }
+        break;
     default:
         // unknown command
         return -2;
@@ -108,99 +653,438 @@ static int serverCommandHandler(uint32_t* command_buffer, uint32_t length)
     return out_length;
 }
 
-static void serverClientHandler(int sock)
+/*
+ * stream-read
+ * [cmd_id][addr][length] -> [0] followed by length bytes from addr
+ * in framed mode the reply frame is 4 + length bytes long
+ */
+static int serverStreamRead(int sock, const uint32_t* command_buffer, const uint32_t* frameHeader)
 {
-    uint32_t command_buffer[0x180];
+    uint32_t length = command_buffer[2];
 
-    while (serverRunning) {
-        int ret = recv(sock, command_buffer, sizeof(command_buffer), 0);
-        if (ret <= 0) {
-            break;
+    uint32_t reply[3];
+    int n = 0;
+    if (frameHeader) {
+        reply[n++] = 4 + length;
+        reply[n++] = frameHeader[1];
+    }
+    reply[n++] = 0;
+
+    if (server_send_all(sock, reply, n * 4) < 0) {
+        return -1;
+    }
+
+    return server_send_all(sock, (const void*) command_buffer[1], length);
+}
+
+/*
+ * stream-write
+ * [cmd_id][addr][length] followed by length bytes, outside of the frame in framed mode -> [0]
+ * data which has already been received is passed in buffered
+ * returns the amount of buffered bytes consumed, negative on error
+ */
+static int serverStreamWrite(int sock, uint32_t* command_buffer, const uint8_t* buffered, uint32_t bufferedLength)
+{
+    uint8_t* dst = (uint8_t*) command_buffer[1];
+    uint32_t length = command_buffer[2];
+
+    uint32_t consumed = (bufferedLength < length) ? bufferedLength : length;
+    memcpy(dst, buffered, consumed);
+
+    if (server_recv_all(sock, dst + consumed, length - consumed) < 0) {
+        return -1;
+    }
+
+    command_buffer[0] = 0;
+    return consumed;
+}
+
+/*
+ * subscribe
+ * [13][addr][length][interval] -> [0][watch_id]
+ * unsubscribe
+ * [14][watch_id]
+ * only available in framed mode. the range is sampled every interval microseconds,
+ * whenever it differs from the previous sample a frame with the request_id WATCH_PUSH_REQUEST_ID
+ * and the payload [watch_id][data] is pushed to the client.
+ */
+static int serverWatchHandler(Worker* worker, uint32_t* command_buffer, uint32_t length)
+{
+    if (command_buffer[0] == 14) {
+        if (length < 8) {
+            return -1;
+        }
+
+        uint32_t id = command_buffer[1];
+        if (!worker->watches || id >= WATCH_MAX_COUNT || !worker->watches[id].length) {
+            return -3;
+        }
+
+        worker->watches[id].length = 0;
+        command_buffer[0] = 0;
+        return 4;
+    }
+
+    if (length < 16) {
+        return -1;
+    }
+
+    uint32_t size = command_buffer[2];
+    if (!size || size > WATCH_MAX_SIZE) {
+        return -3;
+    }
+
+    if (!worker->watches) {
+        worker->watches = IOS_HeapAlloc(LOCAL_PROCESS_HEAP_ID, sizeof(Watch) * WATCH_MAX_COUNT);
+        if (!worker->watches) {
+            return -4;
         }
+        memset(worker->watches, 0, sizeof(Watch) * WATCH_MAX_COUNT);
+    }
 
-        ret = serverCommandHandler(command_buffer, ret);
-        if (ret > 0) {
-            send(sock, command_buffer, ret, 0);
-        } else if (ret < 0) {
-            send(sock, &ret, sizeof(int), 0);
+    uint32_t id;
+    for (id = 0; id < WATCH_MAX_COUNT; id++) {
+        if (!worker->watches[id].length) {
+            break;
         }
     }
+    if (id == WATCH_MAX_COUNT) {
+        return -4;
+    }
 
-    closesocket(sock);
+    Watch* watch = &worker->watches[id];
+    watch->addr = command_buffer[1];
+    watch->length = size;
+    watch->interval = (command_buffer[3] < WATCH_MIN_INTERVAL) ? WATCH_MIN_INTERVAL : command_buffer[3];
+
+    // only changes after subscribing are pushed
+    memcpy(watch->data, (void*) watch->addr, size);
+    IOS_GetAbsTime64(&watch->nextSample);
+    watch->nextSample += watch->interval;
+
+    command_buffer[0] = 0;
+    command_buffer[1] = id;
+    return 8;
 }
 
-static void serverListenClients()
+// samples all due watches and pushes the changed ones, nextSample is set to when the next one is due
+static int sampleWatches(int sock, Worker* worker, uint64_t* nextSample)
 {
-    serverSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    uint8_t* out = worker->frameOutBuffer;
+    uint32_t outLength = 0;
 
-    struct sockaddr_in server;
-    memset(&server, 0, sizeof(server));
+    uint64_t now;
+    IOS_GetAbsTime64(&now);
+    *nextSample = ~0ull;
+
+    for (uint32_t id = 0; id < WATCH_MAX_COUNT; id++) {
+        Watch* watch = &worker->watches[id];
+        if (!watch->length) {
+            continue;
+        }
 
-    server.sin_family = AF_INET;
-    server.sin_port = 1337;
-    server.sin_addr.s_addr = 0;
+        if (now >= watch->nextSample) {
+            // the range might be written by other cores or devices
+            uint32_t start = watch->addr & ~0x1f;
+            IOS_InvalidateDCache((void*) start, ((watch->addr + watch->length + 0x1f) & ~0x1f) - start);
+
+            if (memcmp(watch->data, (void*) watch->addr, watch->length) != 0) {
+                memcpy(watch->data, (void*) watch->addr, watch->length);
+
+                uint32_t frameLength = FRAME_HEADER_SIZE + 4 + ((watch->length + 3) & ~3);
+                if (outLength + frameLength > FRAME_OUT_BUFFER_SIZE) {
+                    if (server_send_all_buffer(sock, out, outLength) < 0) {
+                        return -1;
+                    }
+                    outLength = 0;
+                }
 
-    if (bind(serverSocket, (struct sockaddr*) &server, sizeof(server)) < 0) {
-        closesocket(serverSocket);
-        serverSocket = -1;
-        return;
+                uint32_t header[3] = { 4 + watch->length, WATCH_PUSH_REQUEST_ID, id };
+                memcpy(out + outLength, header, sizeof(header));
+                memcpy(out + outLength + sizeof(header), watch->data, watch->length);
+                outLength += FRAME_HEADER_SIZE + 4 + watch->length;
+            }
+
+            // don't try to catch up on missed samples
+            watch->nextSample += watch->interval;
+            if (watch->nextSample <= now) {
+                watch->nextSample = now + watch->interval;
+            }
+        }
+
+        if (watch->nextSample < *nextSample) {
+            *nextSample = watch->nextSample;
+        }
     }
 
-    if (listen(serverSocket, 1) < 0) {
-        closesocket(serverSocket);
-        serverSocket = -1;
-        return;
+    if (outLength && server_send_all_buffer(sock, out, outLength) < 0) {
+        return -1;
     }
 
-    while (serverRunning) {
-        int csock = accept(serverSocket, NULL, NULL);
-        if (csock < 0) {
-            break;
+    return 0;
+}
+
+// like server_wait_readable, but samples the watches of the worker while waiting
+static int waitReadableSampling(int sock, Worker* worker)
+{
+    while (pool.running) {
+        int timeout = SERVER_POLL_TIMEOUT;
+        if (worker->watches) {
+            uint64_t nextSample;
+            if (sampleWatches(sock, worker, &nextSample) < 0) {
+                return -1;
+            }
+
+            uint64_t now;
+            IOS_GetAbsTime64(&now);
+            if (nextSample <= now) {
+                timeout = 0;
+            } else if (nextSample - now < SERVER_POLL_TIMEOUT * 1000) {
+                timeout = (nextSample - now + 999) / 1000;
+            }
         }
 
-        serverClientHandler(csock);
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        int ret = poll(&pfd, 1, timeout);
+        if (ret != 0) {
+            return ret;
+        }
     }
 
-    closesocket(serverSocket);
-    serverSocket = -1;
+    return -1;
 }
 
-static int wupserver_thread(void *arg)
+static void serverFramedClientHandler(int sock, Worker* worker)
 {
-    while (1) {
-        if (!serverRunning) {
+    uint32_t* command_buffer = worker->commandBuffer;
+    uint8_t* in = worker->frameInBuffer;
+    uint8_t* out = worker->frameOutBuffer;
+    uint32_t inLength = 0;
+    uint32_t outLength = 0;
+
+    while (waitReadableSampling(sock, worker) > 0) {
+        int ret = recv(sock, in + inLength, FRAME_IN_BUFFER_SIZE - inLength, 0);
+        if (ret <= 0) {
             break;
         }
+        inLength += ret;
 
-        serverListenClients();
-        usleep(1000 * 1000);
+        // handle all complete frames, frames might be unaligned so copy them out
+        uint8_t* frame = in;
+        while (inLength >= FRAME_HEADER_SIZE) {
+            uint32_t header[2];
+            memcpy(header, frame, FRAME_HEADER_SIZE);
+            if (header[0] > COMMAND_BUFFER_SIZE) {
+                // can't ever fit, the stream can't be recovered from here
+                return;
+            }
+
+            if (inLength < FRAME_HEADER_SIZE + header[0]) {
+                break;
+            }
+
+            memcpy(command_buffer, frame + FRAME_HEADER_SIZE, header[0]);
+            frame += FRAME_HEADER_SIZE + header[0];
+            inLength -= FRAME_HEADER_SIZE + header[0];
+
+            if (header[0] == 12 && command_buffer[0] == 8) {
+                // keep replies in order
+                if (server_send_all_buffer(sock, out, outLength) < 0 || serverStreamRead(sock, command_buffer, header) < 0) {
+                    return;
+                }
+                outLength = 0;
+                continue;
+            } else if (header[0] == 12 && command_buffer[0] == 9) {
+                ret = serverStreamWrite(sock, command_buffer, frame, inLength);
+                if (ret < 0) {
+                    return;
+                }
+                frame += ret;
+                inLength -= ret;
+                ret = 4;
+            } else if (header[0] >= 4 && (command_buffer[0] == 13 || command_buffer[0] == 14)) {
+                ret = serverWatchHandler(worker, command_buffer, header[0]);
+            } else {
+                ret = serverCommandHandler(command_buffer, header[0]);
+            }
+
+            if (ret < 0) {
+                command_buffer[0] = ret;
+                ret = 4;
+            }
+
+            if (outLength + FRAME_HEADER_SIZE + ret > FRAME_OUT_BUFFER_SIZE) {
+                if (server_send_all_buffer(sock, out, outLength) < 0) {
+                    return;
+                }
+                outLength = 0;
+            }
+
+            header[0] = ret;
+            memcpy(out + outLength, header, FRAME_HEADER_SIZE);
+            memcpy(out + outLength + FRAME_HEADER_SIZE, command_buffer, ret);
+            outLength += FRAME_HEADER_SIZE + ret;
+        }
+
+        // keep the partial frame for the next recv
+        memmove(in, frame, inLength);
+
+        if (outLength) {
+            if (server_send_all_buffer(sock, out, outLength) < 0) {
+                return;
+            }
+            outLength = 0;
+        }
     }
+}
 
-    return 0;
+static void serverClientHandler(int sock, Worker* worker)
+{
+    uint32_t* command_buffer = worker->commandBuffer;
+
+    while (server_wait_readable(sock, &pool.running, 0) > 0) {
+        const struct iovec iov = { command_buffer, COMMAND_BUFFER_SIZE };
+        int ret = recvv(sock, &iov, 1, 0);
+        if (ret <= 0) {
+            break;
+        }
+
+        // hello
+        // [cmd_id][magic][version]
+        if (ret == 12 && command_buffer[0] == 6 && command_buffer[1] == WUPSERVER_HELLO_MAGIC) {
+            command_buffer[0] = 0;
+            command_buffer[1] = (command_buffer[2] < WUPSERVER_PROTOCOL_VERSION) ? command_buffer[2] : WUPSERVER_PROTOCOL_VERSION;
+            if (server_send_all_buffer(sock, command_buffer, 8) < 0) {
+                break;
+            }
+
+            if (command_buffer[1] >= 1) {
+                serverFramedClientHandler(sock, worker);
+                break;
+            }
+            continue;
+        }
+
+        if (ret >= 12 && command_buffer[0] == 8) {
+            if (serverStreamRead(sock, command_buffer, NULL) < 0) {
+                break;
+            }
+            continue;
+        } else if (ret >= 12 && command_buffer[0] == 9) {
+            // anything after the command header is already part of the data
+            if (serverStreamWrite(sock, command_buffer, (uint8_t*) &command_buffer[3], ret - 12) < 0) {
+                break;
+            }
+            ret = 4;
+        } else {
+            ret = serverCommandHandler(command_buffer, ret);
+        }
+
+        if (ret < 0) {
+            command_buffer[0] = ret;
+            ret = 4;
+        }
+
+        if (ret > 0 && server_send_all_buffer(sock, command_buffer, ret) < 0) {
+            break;
+        }
+    }
 }
 
-void wupserver_init(void)
+static void handleClient(int sock, uint32_t index)
+{
+    Worker* worker = &workers[index];
+
+    serverClientHandler(sock, worker);
+
+    if (worker->watches) {
+        IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, worker->watches);
+        worker->watches = NULL;
+    }
+}
+
+static const ServerConfig serverConfig = {
+    .port = 1337,
+    .name = "wupserver",
+    .workerNames = workerNames,
+    .numWorkers = WUPSERVER_MAX_CLIENTS,
+    .workerStackSize = WORKER_STACK_SIZE,
+    .handleClient = handleClient,
+};
+
+static void destroyWorkers(void)
 {
-    if (!serverRunning) {
-        serverSocket = -1;
+    for (int i = 0; i < WUPSERVER_MAX_CLIENTS; i++) {
+        Worker* worker = &workers[i];
 
-        threadId = IOS_CreateThread(wupserver_thread, NULL, threadStack + sizeof(threadStack), sizeof(threadStack), IOS_GetThreadPriority(0), IOS_THREAD_FLAGS_NONE);
-        if(threadId >= 0) {
-            IOS_StartThread(threadId);
-            serverRunning = 1;
+        if (worker->commandBuffer) {
+            socketFreeBuffer(worker->commandBuffer);
+        }
+
+        if (worker->frameInBuffer) {
+            IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, worker->frameInBuffer);
+        }
+
+        if (worker->frameOutBuffer) {
+            socketFreeBuffer(worker->frameOutBuffer);
         }
     }
+
+    IOS_HeapFree(LOCAL_PROCESS_HEAP_ID, workers);
+    workers = NULL;
 }
 
-void wupserver_deinit(void)
+static int createWorkers(void)
+{
+    workers = IOS_HeapAlloc(LOCAL_PROCESS_HEAP_ID, WUPSERVER_MAX_CLIENTS * sizeof(Worker));
+    if (!workers) {
+        return -1;
+    }
+
+    int res = 0;
+    for (int i = 0; i < WUPSERVER_MAX_CLIENTS; i++) {
+        Worker* worker = &workers[i];
+        worker->watches = NULL;
+        // replies are sent straight from these, frames are received at unaligned offsets though
+        worker->commandBuffer = socketAllocBuffer(COMMAND_BUFFER_SIZE);
+        worker->frameInBuffer = IOS_HeapAlloc(LOCAL_PROCESS_HEAP_ID, FRAME_IN_BUFFER_SIZE);
+        worker->frameOutBuffer = socketAllocBuffer(FRAME_OUT_BUFFER_SIZE);
+        if (!worker->commandBuffer || !worker->frameInBuffer || !worker->frameOutBuffer) {
+            res = -1;
+        }
+    }
+
+    if (res < 0) {
+        destroyWorkers();
+    }
+
+    return res;
+}
+
+void wupserver_init(void)
 {
-    if (serverRunning) {
-        serverRunning = 0;
+    // clean up after a server stopped by the kill command
+    if (!pool.running && pool.threadId >= 0) {
+        wupserver_deinit();
+    }
 
-        if (serverSocket >= 0) {
-            shutdown(serverSocket, SHUT_RDWR);
+    if (!pool.running) {
+        if (createWorkers() < 0) {
+            return;
         }
 
-        IOS_JoinThread(threadId, NULL);
+        if (server_pool_start(&pool, &serverConfig) < 0) {
+            destroyWorkers();
+        }
+    }
+}
+
+void wupserver_deinit(void)
+{
+    // the workers are only freed once the pool is done with them
+    server_pool_deinit(&pool);
+
+    if (workers) {
+        destroyWorkers();
     }
 }
@@ -0,0 +1,165 @@
+#!/usr/bin/env python3
+
+# Peer for the "Network Benchmark" option, run it on a Linux machine in the same network
+# and set bench_server=<address of this machine> in network.cfg on the SD Card.
+#
+# Every test is a TCP connection to port 5731 which starts with a request, all numbers are big endian:
+#   uint32_t magic ("WUNB"), test, size, seconds
+# 1 TCP send: the console sends until it shuts its side down, the peer answers with the bytes received (uint32_t)
+# 2 TCP recv: the peer sends size byte blocks for the given seconds and closes the connection
+# 3 UDP send: the console sends datagrams to UDP port 5731, starting with a sequence number (uint32_t),
+#             after it shut the TCP connection down the peer answers with the datagrams and bytes received (2x uint32_t)
+# 4 UDP echo: the peer sends every datagram back until the TCP connection is shut down
+
+from __future__ import annotations
+import argparse, select, socket, struct, time
+
+NETBENCH_PORT = 5731
+NETBENCH_MAGIC = 0x57554e42
+
+TEST_TCP_SEND = 1
+TEST_TCP_RECV = 2
+TEST_UDP_SEND = 3
+TEST_UDP_ECHO = 4
+
+TEST_NAMES = {TEST_TCP_SEND: 'TCP send', TEST_TCP_RECV: 'TCP recv', TEST_UDP_SEND: 'UDP send', TEST_UDP_ECHO: 'UDP echo'}
+
+# the last datagrams can arrive after the TCP shutdown
+UDP_GRACE_TIME = 0.2
+
+def mib(count: int, seconds: float) -> str:
+    return f'{count / seconds / (1 << 20):.2f}' if seconds > 0 else '-'
+
+class Timeline:
+    def __init__(self):
+        self.start = time.monotonic()
+        self.seconds = []
+
+    def add(self, count: int):
+        second = int(time.monotonic() - self.start)
+        while len(self.seconds) <= second:
+            self.seconds.append(0)
+        self.seconds[second] += count
+
+    def __str__(self) -> str:
+        return '[' + ' '.join(mib(count, 1) for count in self.seconds) + ']'
+
+def recv_exact(conn: socket.socket, size: int) -> bytes:
+    data = b''
+    while len(data) < size:
+        chunk = conn.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError('connection closed')
+        data += chunk
+    return data
+
+def tcp_send(conn: socket.socket) -> str:
+    timeline = Timeline()
+    total = 0
+    while True:
+        data = conn.recv(1 << 16)
+        if not data:
+            break
+        total += len(data)
+        timeline.add(len(data))
+    elapsed = time.monotonic() - timeline.start
+    conn.sendall(struct.pack('>I', total & 0xffffffff))
+    return f'received {total} bytes, {mib(total, elapsed)} MiB/s {timeline}'
+
+def tcp_recv(conn: socket.socket, size: int, seconds: int) -> str:
+    block = bytes(size)
+    timeline = Timeline()
+    total = 0
+    end = timeline.start + seconds
+    while time.monotonic() < end:
+        sent = conn.send(block)
+        total += sent
+        timeline.add(sent)
+    conn.shutdown(socket.SHUT_WR)
+    return f'sent {total} bytes, {mib(total, seconds)} MiB/s {timeline}'
+
+def udp_send(conn: socket.socket, udp: socket.socket, console: str) -> str:
+    timeline = Timeline()
+    packets = total = 0
+    highest = -1
+    deadline = None
+    while deadline is None or time.monotonic() < deadline:
+        timeout = None if deadline is None else max(0, deadline - time.monotonic())
+        readable, _, _ = select.select([conn, udp] if deadline is None else [udp], [], [], timeout)
+        if conn in readable:
+            if conn.recv(16):
+                continue
+            deadline = time.monotonic() + UDP_GRACE_TIME
+        if udp in readable:
+            data, (address, _) = udp.recvfrom(1 << 16)
+            if address != console or len(data) < 4:
+                continue
+            packets += 1
+            total += len(data)
+            highest = max(highest, struct.unpack_from('>I', data)[0])
+            timeline.add(len(data))
+    elapsed = time.monotonic() - timeline.start - UDP_GRACE_TIME
+    conn.sendall(struct.pack('>II', packets, total & 0xffffffff))
+    lost = highest + 1 - packets
+    return f'received {packets} datagrams ({lost} lost), {mib(total, elapsed)} MiB/s {timeline}'
+
+def udp_echo(conn: socket.socket, udp: socket.socket, console: str) -> str:
+    echoed = 0
+    while True:
+        readable, _, _ = select.select([conn, udp], [], [])
+        if udp in readable:
+            data, address = udp.recvfrom(1 << 16)
+            if address[0] == console:
+                udp.sendto(data, address)
+                echoed += 1
+        if conn in readable and not conn.recv(16):
+            break
+    return f'echoed {echoed} datagrams'
+
+def flush(udp: socket.socket):
+    while select.select([udp], [], [], 0)[0]:
+        udp.recvfrom(1 << 16)
+
+def handle(conn: socket.socket, udp: socket.socket, console: str):
+    magic, test, size, seconds = struct.unpack('>IIII', recv_exact(conn, 16))
+    if magic != NETBENCH_MAGIC or test not in TEST_NAMES:
+        raise ValueError('invalid request')
+
+    if test == TEST_TCP_SEND:
+        result = tcp_send(conn)
+    elif test == TEST_TCP_RECV:
+        result = tcp_recv(conn, size, seconds)
+    elif test == TEST_UDP_SEND:
+        result = udp_send(conn, udp, console)
+    else:
+        result = udp_echo(conn, udp, console)
+    print(f'{TEST_NAMES[test]} {size:6}: {result}', flush=True)
+
+def main():
+    parser = argparse.ArgumentParser(description='Peer for the Network Benchmark option of the recovery_menu')
+    parser.add_argument('--bind', default='0.0.0.0', help='address to listen on')
+    parser.add_argument('--port', type=int, default=NETBENCH_PORT, help='TCP and UDP port')
+    args = parser.parse_args()
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind((args.bind, args.port))
+    server.listen(1)
+
+    udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    udp.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 22)
+    udp.bind((args.bind, args.port))
+
+    print(f'Listening on port {args.port}', flush=True)
+    while True:
+        conn, (console, _) = server.accept()
+        with conn:
+            try:
+                handle(conn, udp, console)
+            except (OSError, ValueError) as e:
+                print(f'{console}: {e}', flush=True)
+            # datagrams which arrived too late for the last test
+            flush(udp)
+
+if __name__ == '__main__':
+    main()
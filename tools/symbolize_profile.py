@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+
+# Symbolizes a profile.bin written by the "Profiler" option against
+# ios_mcp.elf or ios_mcp_syms.h and prints the hottest functions
+
+from __future__ import annotations
+import sys, struct, bisect, re, argparse
+
+PROFILE_MAGIC = 0x50524f46
+PROFILE_VERSION = 1
+PROFILE_FLAG_PRIVILEGED = 1 << 15
+
+STT_FUNC = 2
+
+def load_elf_symbols(data: bytes) -> dict[int, str]:
+    if data[:4] != b'\x7fELF' or data[4] != 1 or data[5] != 2:
+        raise ValueError('expected a 32-bit big endian elf')
+
+    shoff, = struct.unpack_from('>I', data, 0x20)
+    shentsize, shnum = struct.unpack_from('>HH', data, 0x2e)
+    sections = [struct.unpack_from('>IIIIIIIIII', data, shoff + i * shentsize) for i in range(shnum)]
+
+    symbols = {}
+    for _, type, _, _, offset, size, link, _, _, entsize in sections:
+        if type != 2: # SHT_SYMTAB
+            continue
+        strtab = sections[link]
+        for i in range(size // entsize):
+            name, value, _, info, _, _ = struct.unpack_from('>IIIBBH', data, offset + i * entsize)
+            if info & 0xf != STT_FUNC:
+                continue
+            start = strtab[4] + name
+            symbols[value & ~1] = data[start:data.index(b'\0', start)].decode()
+    return symbols
+
+def load_syms_header(text: str) -> dict[int, str]:
+    symbols = {}
+    for name, value in re.findall(r'#define\s+(\w+)\s+0x([0-9a-fA-F]+)', text):
+        if not name.startswith('__'):
+            symbols[int(value, 16) & ~1] = name
+    return symbols
+
+def load_symbols(path: str) -> dict[int, str]:
+    with open(path, 'rb') as f:
+        data = f.read()
+    if data[:4] == b'\x7fELF':
+        return load_elf_symbols(data)
+    return load_syms_header(data.decode())
+
+def main() -> None:
+    parser = argparse.ArgumentParser()
+    parser.add_argument('profile', help='profile.bin from the SD Card')
+    parser.add_argument('symbols', help='ios_mcp.elf or ios_mcp_syms.h')
+    parser.add_argument('-t', '--threads', action='store_true', help='split results by thread id')
+    parser.add_argument('-n', '--count', type=int, default=30, help='amount of entries to print')
+    args = parser.parse_args()
+
+    with open(args.profile, 'rb') as f:
+        data = f.read()
+
+    magic, version, interval, dropped = struct.unpack_from('>IIII', data, 0)
+    if magic != PROFILE_MAGIC or version != PROFILE_VERSION:
+        raise ValueError('not a supported profile file')
+
+    symbols = load_symbols(args.symbols)
+    addrs = sorted(symbols)
+
+    hits = {}
+    total = 0
+    for pc, flags, tid in struct.iter_unpack('>IHH', data[0x10:]):
+        i = bisect.bisect_right(addrs, pc) - 1
+        # ios_mcp code lives at 0x05116000 - 0x0512c000, anything else belongs to IOSU
+        if 0x05116000 <= pc < 0x0512c000 and i >= 0:
+            name = symbols[addrs[i]]
+        elif flags & PROFILE_FLAG_PRIVILEGED:
+            name = '[kernel]'
+        else:
+            name = f'[mcp {pc & ~0xfff:08x}]'
+
+        key = (tid, name) if args.threads else name
+        hits[key] = hits.get(key, 0) + 1
+        total += 1
+
+    print(f'{total} samples, interval {interval}, {dropped} dropped')
+    for key, count in sorted(hits.items(), key=lambda x: -x[1])[:args.count]:
+        label = f'{key[0]:3d} {key[1]}' if args.threads else key
+        print(f'{count * 100 / total:6.2f}% {count:7d}  {label}')
+
+if __name__ == '__main__':
+    main()
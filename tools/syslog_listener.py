@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+
+# Receives the lines sent by the "Stream Syslogs" option and prints them, or appends them to one file per log.
+# Every datagram starts with a sequence number (uint32_t, big endian), followed by the null terminated name
+# of the log file and complete lines of it. Gaps in the sequence numbers are reported as lost datagrams.
+
+from __future__ import annotations
+import argparse, os, socket, struct, sys, time
+
+SYSLOG_STREAM_PORT = 4406
+
+def main():
+    parser = argparse.ArgumentParser(description='Listener for the Stream Syslogs option of the recovery_menu')
+    parser.add_argument('--bind', default='0.0.0.0', help='address to listen on')
+    parser.add_argument('--port', type=int, default=SYSLOG_STREAM_PORT, help='UDP port')
+    parser.add_argument('--dir', help='append the lines to a file per log in this directory instead of printing them')
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind((args.bind, args.port))
+    if args.dir:
+        os.makedirs(args.dir, exist_ok=True)
+
+    print(f'Listening on port {args.port}', file=sys.stderr, flush=True)
+    expected = {}
+    lost = {}
+    while True:
+        data, (console, _) = sock.recvfrom(1 << 16)
+        if len(data) < 5 or b'\0' not in data[4:]:
+            continue
+
+        sequence = struct.unpack_from('>I', data)[0]
+        name, text = data[4:].split(b'\0', 1)
+        name = os.path.basename(name.decode(errors='replace'))
+
+        # the sequence starts at 0 again when the option is restarted
+        if console in expected and sequence != expected[console]:
+            if sequence > expected[console]:
+                missing = sequence - expected[console]
+                lost[console] = lost.get(console, 0) + missing
+                print(f'{time.strftime("%H:%M:%S")} {console}: {missing} datagrams lost ({lost[console]} total)', file=sys.stderr, flush=True)
+            else:
+                print(f'{time.strftime("%H:%M:%S")} {console}: stream restarted', file=sys.stderr, flush=True)
+        expected[console] = sequence + 1
+
+        if args.dir:
+            with open(os.path.join(args.dir, name), 'ab') as f:
+                f.write(text)
+        else:
+            for line in text.decode(errors='replace').splitlines():
+                print(f'[{name}] {line}', flush=True)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+
+# Converts a trace.bin written by the "Dump Trace" option into the Chrome trace
+# event format, which can be loaded in chrome://tracing or https://ui.perfetto.dev
+
+from __future__ import annotations
+import sys, struct, json
+
+TRACE_MAGIC = 0x54524345
+TRACE_VERSION = 2
+TRACE_TAG_NAME_LENGTH = 16
+STACK_NAME_LENGTH = 16
+
+def convert(data: bytes) -> tuple[list[dict], dict]:
+    magic, version, timebase, num_events, num_tags, num_stacks = struct.unpack_from('>IIIIII', data, 0)
+    if magic != TRACE_MAGIC:
+        raise ValueError('not a trace file')
+    if version != TRACE_VERSION:
+        raise ValueError(f'unsupported trace version {version}')
+
+    offset = 0x18
+    tags = []
+    for _ in range(num_tags):
+        tags.append(data[offset:offset + TRACE_TAG_NAME_LENGTH].split(b'\0')[0].decode())
+        offset += TRACE_TAG_NAME_LENGTH
+
+    stacks = {}
+    for _ in range(num_stacks):
+        name = data[offset:offset + STACK_NAME_LENGTH].split(b'\0')[0].decode()
+        size, used = struct.unpack_from('>II', data, offset + STACK_NAME_LENGTH)
+        stacks[name] = {'size': size, 'used': used}
+        offset += STACK_NAME_LENGTH + 8
+
+    events = []
+    base = None
+    last = 0
+    high = 0
+    for _ in range(num_events):
+        timestamp, type, tag, tid, arg0, arg1 = struct.unpack_from('>IBBHII', data, offset)
+        offset += 0x10
+
+        # the timestamps are the low 32-bit of the IOSU time, unwrap them
+        if timestamp < last:
+            high += 1 << 32
+        last = timestamp
+        timestamp += high
+        if base is None:
+            base = timestamp
+
+        event = {
+            'name': tags[tag] if tag < len(tags) else f'tag{tag}',
+            'ph': chr(type),
+            'ts': (timestamp - base) * 1000000 / timebase,
+            'pid': 1,
+            'tid': tid,
+            'args': {'arg0': hex(arg0), 'arg1': hex(arg1)},
+        }
+        if type == ord('i'):
+            event['s'] = 't'
+        events.append(event)
+
+    return events, stacks
+
+def main() -> None:
+    if len(sys.argv) != 3:
+        print(f'Usage: {sys.argv[0]} <trace.bin> <trace.json>')
+        sys.exit(1)
+
+    with open(sys.argv[1], 'rb') as f:
+        events, stacks = convert(f.read())
+
+    for name, stack in stacks.items():
+        print(f'stack {name:16s} {stack["used"]:5d} / {stack["size"]:5d} bytes')
+
+    with open(sys.argv[2], 'w') as f:
+        json.dump({'traceEvents': events, 'displayTimeUnit': 'ms', 'otherData': {'stacks': stacks}}, f)
+
+if __name__ == '__main__':
+    main()
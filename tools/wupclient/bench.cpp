@@ -0,0 +1,149 @@
+// Throughput benchmark for wupserver, keeps a fixed number of requests in flight on one connection
+
+#include "wupclient.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <getopt.h>
+#include <variant>
+
+namespace {
+
+void usage(const char* name)
+{
+    std::fprintf(stderr,
+        "usage: %s [-H host] [-p port] [-l] [-o op] [-a addr] [-n count] [-s size] [-d depth]\n"
+        "  -H host     address of the console (default 127.0.0.1)\n"
+        "  -p port     port of wupserver (default 1337)\n"
+        "  -l          the server is little-endian (tools/wupserver_host)\n"
+        "  -o op       read, write, svc or mix (default read)\n"
+        "  -a addr     address to read from and write to, required for write and mix\n"
+        "  -n count    number of requests (default 10000)\n"
+        "  -s size     bytes per read or write (default 4)\n"
+        "  -d depth    requests in flight (default 32)\n", name);
+}
+
+using Pending = std::variant<std::future<std::vector<uint8_t>>, std::future<void>, std::future<int32_t>>;
+
+void wait(Pending& pending)
+{
+    // svcs might fail on the stand-in server, only the round trip matters here
+    std::visit([](auto& future) {
+        try {
+            future.get();
+        } catch (const wup::ServerError&) {
+        }
+    }, pending);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::string host = "127.0.0.1";
+    uint16_t port = wup::Client::DefaultPort;
+    wup::ByteOrder order = wup::ByteOrder::Big;
+    std::string op = "read";
+    uint32_t addr = 0;
+    bool haveAddr = false;
+    uint32_t count = 10000;
+    uint32_t size = 4;
+    uint32_t depth = 32;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:lo:a:n:s:d:")) != -1) {
+        switch (opt) {
+        case 'H':
+            host = optarg;
+            break;
+        case 'p':
+            port = uint16_t(std::atoi(optarg));
+            break;
+        case 'l':
+            order = wup::ByteOrder::Little;
+            break;
+        case 'o':
+            op = optarg;
+            break;
+        case 'a':
+            addr = uint32_t(std::strtoul(optarg, nullptr, 0));
+            haveAddr = true;
+            break;
+        case 'n':
+            count = uint32_t(std::strtoul(optarg, nullptr, 0));
+            break;
+        case 's':
+            size = uint32_t(std::strtoul(optarg, nullptr, 0));
+            break;
+        case 'd':
+            depth = uint32_t(std::strtoul(optarg, nullptr, 0));
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if ((op != "read" && op != "write" && op != "svc" && op != "mix") || !depth) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // don't write to some random address of a real console
+    if ((op == "write" || op == "mix") && !haveAddr) {
+        std::fprintf(stderr, "%s needs an address to write to (-a)\n", op.c_str());
+        return 1;
+    }
+    if (!haveAddr) {
+        // start of the memory of tools/wupserver_host
+        addr = 0x10000000;
+    }
+
+    try {
+        wup::Client client(order);
+        client.connect(host, port);
+
+        std::vector<uint8_t> data(size, 0x5a);
+        std::deque<Pending> inFlight;
+        uint64_t bytes = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < count; i++) {
+            if (inFlight.size() >= depth) {
+                wait(inFlight.front());
+                inFlight.pop_front();
+            }
+
+            // mix cycles through read, write and svc
+            uint32_t kind = (op == "read") ? 0 : (op == "write") ? 1 : (op == "svc") ? 2 : (i % 3);
+            if (kind == 0) {
+                inFlight.emplace_back(client.read(addr, size));
+                bytes += size;
+            } else if (kind == 1) {
+                inFlight.emplace_back(client.write(addr, data));
+                bytes += size;
+            } else {
+                // IOS_GetCurrentThreadId, harmless on a console
+                inFlight.emplace_back(client.svc(0x03, {}));
+            }
+        }
+
+        while (!inFlight.empty()) {
+            wait(inFlight.front());
+            inFlight.pop_front();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::printf("%s: %u requests of %u bytes, depth %u\n", op.c_str(), count, size, depth);
+        std::printf("  %.3f s, %.0f requests/s, %.2f MiB/s, %.1f us per request\n",
+            seconds, count / seconds, bytes / seconds / (1024.0 * 1024.0), seconds * 1e6 / count);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+// Command line interface for wupclient, run without arguments for usage
+
+#include "wupclient.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <iostream>
+
+namespace {
+
+void usage(const char* name)
+{
+    std::fprintf(stderr,
+        "usage: %s [-H host] [-p port] [-l] <command> [args...]\n"
+        "  -H host     address of the console (default 127.0.0.1)\n"
+        "  -p port     port of wupserver (default 1337)\n"
+        "  -l          the server is little-endian (tools/wupserver_host)\n"
+        "commands:\n"
+        "  read <addr> <length> [file]\n"
+        "  write <addr> <hex bytes>\n"
+        "  svc <id> [args...]\n"
+        "  search <start> <end> <hex pattern> [hex mask]\n"
+        "  hash <sha256|crc32> <addr> <length>\n"
+        "  hashfile <sha256|crc32> <path>\n"
+        "  watch <addr> <length> [interval in us]\n"
+        "  kill\n", name);
+}
+
+uint32_t parseNumber(const char* str)
+{
+    char* end;
+    unsigned long value = std::strtoul(str, &end, 0);
+    if (*end) {
+        throw std::invalid_argument(std::string("not a number: ") + str);
+    }
+    return uint32_t(value);
+}
+
+std::vector<uint8_t> parseHex(const char* str)
+{
+    size_t length = std::strlen(str);
+    if (length % 2) {
+        throw std::invalid_argument(std::string("odd number of hex digits: ") + str);
+    }
+
+    std::vector<uint8_t> data;
+    for (size_t i = 0; i < length; i += 2) {
+        char byte[3] = { str[i], str[i + 1], '\0' };
+        char* end;
+        data.push_back(uint8_t(std::strtoul(byte, &end, 16)));
+        if (*end) {
+            throw std::invalid_argument(std::string("not hex: ") + str);
+        }
+    }
+    return data;
+}
+
+wup::HashAlgorithm parseAlgorithm(const char* str)
+{
+    if (!std::strcmp(str, "sha256")) {
+        return wup::HashAlgorithm::Sha256;
+    } else if (!std::strcmp(str, "crc32")) {
+        return wup::HashAlgorithm::Crc32;
+    }
+    throw std::invalid_argument(std::string("unknown hash algorithm: ") + str);
+}
+
+void printHex(const std::vector<uint8_t>& data)
+{
+    for (uint8_t byte : data) {
+        std::printf("%02x", byte);
+    }
+    std::printf("\n");
+}
+
+void hexdump(uint32_t addr, const std::vector<uint8_t>& data)
+{
+    for (size_t i = 0; i < data.size(); i += 16) {
+        std::printf("%08x:", uint32_t(addr + i));
+        for (size_t j = i; j < i + 16 && j < data.size(); j++) {
+            std::printf(" %02x", data[j]);
+        }
+        std::printf("\n");
+    }
+}
+
+int run(wup::Client& client, int argc, char** argv)
+{
+    std::string command = argv[0];
+
+    if (command == "read" && (argc == 3 || argc == 4)) {
+        uint32_t addr = parseNumber(argv[1]);
+        std::vector<uint8_t> data = client.read(addr, parseNumber(argv[2])).get();
+        if (argc == 4) {
+            FILE* file = std::fopen(argv[3], "wb");
+            if (!file || std::fwrite(data.data(), 1, data.size(), file) != data.size()) {
+                std::fprintf(stderr, "can't write %s\n", argv[3]);
+                return 1;
+            }
+            std::fclose(file);
+        } else {
+            hexdump(addr, data);
+        }
+    } else if (command == "write" && argc == 3) {
+        client.write(parseNumber(argv[1]), parseHex(argv[2])).get();
+    } else if (command == "svc" && argc >= 2) {
+        std::vector<uint32_t> args;
+        for (int i = 2; i < argc; i++) {
+            args.push_back(parseNumber(argv[i]));
+        }
+        int32_t result = client.svc(parseNumber(argv[1]), args).get();
+        std::printf("%d (0x%08x)\n", result, uint32_t(result));
+    } else if (command == "search" && (argc == 4 || argc == 5)) {
+        uint32_t start = parseNumber(argv[1]);
+        uint32_t end = parseNumber(argv[2]);
+        std::vector<uint8_t> pattern = parseHex(argv[3]);
+        std::vector<uint8_t> mask = (argc == 5) ? parseHex(argv[4]) : std::vector<uint8_t>();
+
+        // the server returns matches in batches, keep going until the whole range is scanned
+        while (start < end) {
+            wup::SearchResult result = client.search(start, end, pattern, mask).get();
+            for (uint32_t match : result.matches) {
+                std::printf("%08x\n", match);
+            }
+            if (result.next <= start) {
+                break;
+            }
+            start = result.next;
+        }
+    } else if (command == "hash" && argc == 4) {
+        printHex(client.hashMemory(parseAlgorithm(argv[1]), parseNumber(argv[2]), parseNumber(argv[3])).get());
+    } else if (command == "hashfile" && argc == 3) {
+        printHex(client.hashFile(parseAlgorithm(argv[1]), argv[2]).get());
+    } else if (command == "watch" && (argc == 3 || argc == 4)) {
+        uint32_t addr = parseNumber(argv[1]);
+        client.setWatchHandler([addr](uint32_t, const std::vector<uint8_t>& data) {
+            hexdump(addr, data);
+            std::printf("\n");
+            std::fflush(stdout);
+        });
+        client.watch(addr, parseNumber(argv[2]), (argc == 4) ? parseNumber(argv[3]) : 100000).get();
+
+        // changes are printed until the connection is closed
+        std::string line;
+        std::getline(std::cin, line);
+    } else if (command == "kill" && argc == 1) {
+        client.kill().get();
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::string host = "127.0.0.1";
+    uint16_t port = wup::Client::DefaultPort;
+    wup::ByteOrder order = wup::ByteOrder::Big;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+H:p:l")) != -1) {
+        switch (opt) {
+        case 'H':
+            host = optarg;
+            break;
+        case 'p':
+            port = uint16_t(std::atoi(optarg));
+            break;
+        case 'l':
+            order = wup::ByteOrder::Little;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        wup::Client client(order);
+        client.connect(host, port);
+
+        int res = run(client, argc - optind, argv + optind);
+        if (res < 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        return res;
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+}
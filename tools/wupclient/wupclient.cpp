@@ -0,0 +1,559 @@
+#include "wupclient.h"
+
+#include <cstring>
+#include <type_traits>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace wup {
+
+namespace {
+
+constexpr uint32_t HelloCommand = 6;
+constexpr uint32_t HelloMagic = 0x57555046; // "WUPF"
+constexpr uint32_t ProtocolVersion = 1;
+constexpr uint32_t FrameHeaderSize = 8;
+constexpr uint32_t PushRequestId = 0xffffffff;
+// seconds
+constexpr time_t HelloTimeout = 5;
+
+enum Command : uint32_t {
+    CommandWrite = 0,
+    CommandRead = 1,
+    CommandSvc = 2,
+    CommandKill = 3,
+    CommandMemcpy = 4,
+    CommandBatch = 7,
+    CommandStreamRead = 8,
+    CommandStreamWrite = 9,
+    CommandSearch = 10,
+    CommandHashMemory = 11,
+    CommandHashFile = 12,
+    CommandWatch = 13,
+    CommandUnwatch = 14,
+    CommandIoctl = 15,
+    CommandIoctlv = 16,
+};
+
+void sendAll(int sock, const uint8_t* data, size_t length)
+{
+    while (length) {
+        ssize_t ret = ::send(sock, data, length, MSG_NOSIGNAL);
+        if (ret <= 0) {
+            throw std::runtime_error("send failed");
+        }
+        data += ret;
+        length -= ret;
+    }
+}
+
+bool recvAll(int sock, uint8_t* data, size_t length)
+{
+    while (length) {
+        ssize_t ret = ::recv(sock, data, length, 0);
+        if (ret <= 0) {
+            return false;
+        }
+        data += ret;
+        length -= ret;
+    }
+    return true;
+}
+
+size_t align4(size_t size)
+{
+    return (size + 3) & ~size_t(3);
+}
+
+}
+
+ServerError::ServerError(int32_t status)
+    : std::runtime_error("wupserver returned " + std::to_string(status)), status_(status)
+{
+}
+
+void Batch::add(uint32_t op, uint8_t refmask, const std::vector<uint32_t>& args)
+{
+    words_.push_back(op | (uint32_t(refmask) << 8) | (uint32_t(args.size()) << 16));
+    words_.insert(words_.end(), args.begin(), args.end());
+    count_++;
+}
+
+void Batch::write(uint32_t dst, const std::vector<uint32_t>& words, uint8_t refmask)
+{
+    std::vector<uint32_t> args{dst};
+    args.insert(args.end(), words.begin(), words.end());
+    add(CommandWrite, refmask, args);
+}
+
+void Batch::read(uint32_t src, uint32_t length, uint8_t refmask)
+{
+    add(CommandRead, refmask, {src, length});
+}
+
+void Batch::svc(uint32_t id, const std::vector<uint32_t>& args, uint8_t refmask)
+{
+    std::vector<uint32_t> all{id};
+    all.insert(all.end(), args.begin(), args.end());
+    add(CommandSvc, refmask, all);
+}
+
+void Batch::memcpy(uint32_t dst, uint32_t src, uint32_t size, uint8_t refmask)
+{
+    add(CommandMemcpy, refmask, {dst, src, size});
+}
+
+Client::Client(ByteOrder order) : order_(order)
+{
+}
+
+Client::~Client()
+{
+    close();
+}
+
+uint32_t Client::toWord(const uint8_t* data) const
+{
+    if (order_ == ByteOrder::Big) {
+        return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | data[3];
+    }
+    return (uint32_t(data[3]) << 24) | (uint32_t(data[2]) << 16) | (uint32_t(data[1]) << 8) | data[0];
+}
+
+void Client::fromWord(uint32_t value, uint8_t* data) const
+{
+    for (int i = 0; i < 4; i++) {
+        int shift = (order_ == ByteOrder::Big) ? (24 - i * 8) : (i * 8);
+        data[i] = uint8_t(value >> shift);
+    }
+}
+
+void Client::connect(const std::string& host, uint16_t port)
+{
+    close();
+
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0 || !result) {
+        throw std::runtime_error("can't resolve " + host);
+    }
+
+    int sock = ::socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (sock < 0 || ::connect(sock, result->ai_addr, result->ai_addrlen) < 0) {
+        freeaddrinfo(result);
+        if (sock >= 0) {
+            ::close(sock);
+        }
+        throw std::runtime_error("can't connect to " + host);
+    }
+    freeaddrinfo(result);
+
+    // requests are small and latency bound
+    int enable = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    // the hello is sent with the legacy protocol
+    uint8_t hello[12];
+    fromWord(HelloCommand, hello);
+    fromWord(HelloMagic, hello + 4);
+    fromWord(ProtocolVersion, hello + 8);
+    try {
+        sendAll(sock, hello, sizeof(hello));
+    } catch (...) {
+        ::close(sock);
+        throw;
+    }
+
+    // don't wait forever on a server which doesn't answer the hello at all
+    timeval timeout{};
+    timeout.tv_sec = HelloTimeout;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // legacy servers only answer with an error status, the version follows a successful one
+    uint8_t status[4];
+    uint8_t version[4];
+    if (!recvAll(sock, status, sizeof(status))) {
+        ::close(sock);
+        throw std::runtime_error("server didn't answer the hello");
+    }
+    if (toWord(status) != 0) {
+        ::close(sock);
+        throw std::runtime_error("server only supports the legacy protocol, or the byte order is wrong");
+    }
+    if (!recvAll(sock, version, sizeof(version)) || toWord(version) < 1) {
+        ::close(sock);
+        throw std::runtime_error("server doesn't support the framed protocol, check the byte order");
+    }
+
+    // the receive thread blocks until the connection is shut down
+    timeout.tv_sec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    socket_ = sock;
+    error_ = nullptr;
+    receiver_ = std::thread(&Client::receiveThread, this);
+}
+
+void Client::close()
+{
+    if (socket_ < 0) {
+        return;
+    }
+
+    // wakes up the receive thread, which fails everything still pending
+    shutdown(socket_, SHUT_RDWR);
+    if (receiver_.joinable()) {
+        receiver_.join();
+    }
+    ::close(socket_);
+    socket_ = -1;
+}
+
+void Client::setWatchHandler(std::function<void(uint32_t id, const std::vector<uint8_t>& data)> handler)
+{
+    std::lock_guard<std::mutex> lock(watchMutex_);
+    watchHandler_ = std::move(handler);
+}
+
+void Client::send(const std::vector<uint32_t>& words, const std::vector<uint8_t>& data,
+    const std::vector<uint8_t>& raw, Completion completion)
+{
+    uint32_t length = words.size() * 4 + data.size();
+    if (length > MaxFrameSize) {
+        completion(nullptr, std::make_exception_ptr(std::length_error("request doesn't fit into a frame")));
+        return;
+    }
+
+    std::vector<uint8_t> buffer(FrameHeaderSize + length);
+    fromWord(length, buffer.data());
+    for (size_t i = 0; i < words.size(); i++) {
+        fromWord(words[i], buffer.data() + FrameHeaderSize + i * 4);
+    }
+    std::memcpy(buffer.data() + FrameHeaderSize + words.size() * 4, data.data(), data.size());
+
+    // frames have to be sent in the order of their ids, the server replies in order
+    std::lock_guard<std::mutex> sendLock(sendMutex_);
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        if (socket_ < 0 || error_) {
+            std::exception_ptr error = error_ ? error_ : std::make_exception_ptr(std::runtime_error("not connected"));
+            completion(nullptr, error);
+            return;
+        }
+
+        uint32_t id = nextId_++;
+        if (nextId_ == PushRequestId) {
+            nextId_ = 1;
+        }
+        fromWord(id, buffer.data() + 4);
+        pending_[id] = std::move(completion);
+    }
+
+    // a failed send shuts down the connection, which fails the request in the receive thread
+    try {
+        sendAll(socket_, buffer.data(), buffer.size());
+        if (!raw.empty()) {
+            sendAll(socket_, raw.data(), raw.size());
+        }
+    } catch (...) {
+        shutdown(socket_, SHUT_RDWR);
+    }
+}
+
+void Client::receiveThread()
+{
+    while (true) {
+        uint8_t header[FrameHeaderSize];
+        if (!recvAll(socket_, header, sizeof(header))) {
+            break;
+        }
+
+        uint32_t length = toWord(header);
+        uint32_t id = toWord(header + 4);
+        std::vector<uint8_t> payload(length);
+        if (!recvAll(socket_, payload.data(), length)) {
+            break;
+        }
+
+        if (id == PushRequestId) {
+            if (length < 4) {
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(watchMutex_);
+            if (watchHandler_) {
+                watchHandler_(toWord(payload.data()), std::vector<uint8_t>(payload.begin() + 4, payload.end()));
+            }
+            continue;
+        }
+
+        Completion completion;
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex_);
+            auto it = pending_.find(id);
+            if (it == pending_.end()) {
+                continue;
+            }
+            completion = std::move(it->second);
+            pending_.erase(it);
+        }
+
+        Reply reply;
+        reply.status = (length >= 4) ? int32_t(toWord(payload.data())) : -1;
+        if (length > 4) {
+            reply.data.assign(payload.begin() + 4, payload.end());
+        }
+        completion(&reply, nullptr);
+    }
+
+    failAll(std::make_exception_ptr(std::runtime_error("connection closed")));
+}
+
+void Client::failAll(std::exception_ptr error)
+{
+    std::map<uint32_t, Completion> pending;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        error_ = error;
+        pending.swap(pending_);
+    }
+
+    for (auto& entry : pending) {
+        entry.second(nullptr, error);
+    }
+}
+
+template <typename T, typename Convert>
+std::future<T> Client::submit(const std::vector<uint32_t>& words, const std::vector<uint8_t>& data,
+    const std::vector<uint8_t>& raw, Convert convert)
+{
+    auto promise = std::make_shared<std::promise<T>>();
+    std::future<T> future = promise->get_future();
+
+    send(words, data, raw, [promise, convert](Reply* reply, std::exception_ptr error) {
+        if (error) {
+            promise->set_exception(error);
+            return;
+        }
+
+        try {
+            if (reply->status < 0) {
+                throw ServerError(reply->status);
+            }
+
+            if constexpr (std::is_void_v<T>) {
+                convert(*reply);
+                promise->set_value();
+            } else {
+                promise->set_value(convert(*reply));
+            }
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+    });
+
+    return future;
+}
+
+std::future<Reply> Client::request(const std::vector<uint32_t>& words, const std::vector<uint8_t>& data,
+    const std::vector<uint8_t>& raw)
+{
+    auto promise = std::make_shared<std::promise<Reply>>();
+    std::future<Reply> future = promise->get_future();
+
+    send(words, data, raw, [promise](Reply* reply, std::exception_ptr error) {
+        if (error) {
+            promise->set_exception(error);
+        } else {
+            promise->set_value(std::move(*reply));
+        }
+    });
+
+    return future;
+}
+
+std::future<std::vector<uint8_t>> Client::read(uint32_t addr, uint32_t length)
+{
+    auto convert = [length](Reply& reply) {
+        if (reply.data.size() < length) {
+            throw std::runtime_error("short read");
+        }
+        reply.data.resize(length);
+        return std::move(reply.data);
+    };
+
+    // the reply of a regular read has to fit into the command buffer, bigger reads are streamed
+    if (length <= MaxFrameSize - 4) {
+        return submit<std::vector<uint8_t>>({CommandRead, addr, length}, {}, {}, convert);
+    }
+    return submit<std::vector<uint8_t>>({CommandStreamRead, addr, length}, {}, {}, convert);
+}
+
+std::future<void> Client::write(uint32_t addr, const std::vector<uint8_t>& data)
+{
+    auto convert = [](Reply&) {};
+    if (data.size() <= MaxFrameSize - 8) {
+        return submit<void>({CommandWrite, addr}, data, {}, convert);
+    }
+    return submit<void>({CommandStreamWrite, addr, uint32_t(data.size())}, {}, data, convert);
+}
+
+std::future<int32_t> Client::svc(uint32_t id, const std::vector<uint32_t>& args)
+{
+    std::vector<uint32_t> words{CommandSvc, id};
+    words.insert(words.end(), args.begin(), args.end());
+    return submit<int32_t>(words, {}, {}, [this](Reply& reply) {
+        if (reply.data.size() < 4) {
+            throw std::runtime_error("short reply");
+        }
+        return int32_t(toWord(reply.data.data()));
+    });
+}
+
+std::future<void> Client::memcpy(uint32_t dst, uint32_t src, uint32_t size)
+{
+    return submit<void>({CommandMemcpy, dst, src, size}, {}, {}, [](Reply&) {});
+}
+
+std::future<std::vector<uint8_t>> Client::batch(const Batch& batch)
+{
+    std::vector<uint32_t> words{CommandBatch, batch.scratchSize_, batch.count_};
+    words.insert(words.end(), batch.words_.begin(), batch.words_.end());
+    return submit<std::vector<uint8_t>>(words, {}, {}, [](Reply& reply) { return std::move(reply.data); });
+}
+
+std::future<SearchResult> Client::search(uint32_t start, uint32_t end, const std::vector<uint8_t>& pattern,
+    const std::vector<uint8_t>& mask, uint32_t maxMatches)
+{
+    if (!mask.empty() && mask.size() != pattern.size()) {
+        throw std::invalid_argument("mask and pattern differ in size");
+    }
+
+    std::vector<uint8_t> data(pattern);
+    data.insert(data.end(), mask.begin(), mask.end());
+    return submit<SearchResult>({CommandSearch, start, end, uint32_t(pattern.size()), maxMatches}, data, {},
+        [this](Reply& reply) {
+            if (reply.data.size() < 8) {
+                throw std::runtime_error("short reply");
+            }
+
+            SearchResult result;
+            result.next = toWord(reply.data.data());
+            uint32_t count = toWord(reply.data.data() + 4);
+            if (reply.data.size() < 8 + count * 4) {
+                throw std::runtime_error("short reply");
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                result.matches.push_back(toWord(reply.data.data() + 8 + i * 4));
+            }
+            return result;
+        });
+}
+
+std::future<std::vector<uint8_t>> Client::hashMemory(HashAlgorithm algorithm, uint32_t addr, uint32_t length)
+{
+    return submit<std::vector<uint8_t>>({CommandHashMemory, uint32_t(algorithm), addr, length}, {}, {},
+        [](Reply& reply) {
+            // skip the number of bytes hashed
+            return std::vector<uint8_t>(reply.data.begin() + std::min<size_t>(4, reply.data.size()), reply.data.end());
+        });
+}
+
+std::future<std::vector<uint8_t>> Client::hashFile(HashAlgorithm algorithm, const std::string& path)
+{
+    std::vector<uint8_t> data(path.begin(), path.end());
+    data.push_back('\0');
+    return submit<std::vector<uint8_t>>({CommandHashFile, uint32_t(algorithm)}, data, {},
+        [](Reply& reply) {
+            return std::vector<uint8_t>(reply.data.begin() + std::min<size_t>(4, reply.data.size()), reply.data.end());
+        });
+}
+
+std::future<IoctlResult> Client::ioctl(int32_t fd, uint32_t request, const std::vector<uint8_t>& in, uint32_t outSize)
+{
+    std::vector<uint8_t> data(in);
+    data.resize(align4(in.size()));
+    return submit<IoctlResult>({CommandIoctl, uint32_t(fd), request, uint32_t(in.size()), outSize}, data, {},
+        [this, outSize](Reply& reply) {
+            if (reply.data.size() < 4 + outSize) {
+                throw std::runtime_error("short reply");
+            }
+
+            IoctlResult result;
+            result.result = int32_t(toWord(reply.data.data()));
+            result.out.emplace_back(reply.data.begin() + 4, reply.data.begin() + 4 + outSize);
+            return result;
+        });
+}
+
+std::future<IoctlResult> Client::ioctlv(int32_t fd, uint32_t request, const std::vector<std::vector<uint8_t>>& in,
+    const std::vector<uint32_t>& outSizes)
+{
+    std::vector<uint32_t> words{CommandIoctlv, uint32_t(fd), request, uint32_t(in.size()), uint32_t(outSizes.size())};
+    std::vector<uint8_t> data;
+    for (const auto& vec : in) {
+        words.push_back(vec.size());
+        data.insert(data.end(), vec.begin(), vec.end());
+        data.resize(align4(data.size()));
+    }
+    words.insert(words.end(), outSizes.begin(), outSizes.end());
+
+    return submit<IoctlResult>(words, data, {}, [this, outSizes](Reply& reply) {
+        if (reply.data.size() < 4) {
+            throw std::runtime_error("short reply");
+        }
+
+        IoctlResult result;
+        result.result = int32_t(toWord(reply.data.data()));
+        size_t offset = 4;
+        for (uint32_t size : outSizes) {
+            if (reply.data.size() < offset + size) {
+                throw std::runtime_error("short reply");
+            }
+            result.out.emplace_back(reply.data.begin() + offset, reply.data.begin() + offset + size);
+            offset += align4(size);
+        }
+        return result;
+    });
+}
+
+std::future<uint32_t> Client::watch(uint32_t addr, uint32_t length, uint32_t intervalUs)
+{
+    return submit<uint32_t>({CommandWatch, addr, length, intervalUs}, {}, {}, [this](Reply& reply) {
+        if (reply.data.size() < 4) {
+            throw std::runtime_error("short reply");
+        }
+        return toWord(reply.data.data());
+    });
+}
+
+std::future<void> Client::unwatch(uint32_t id)
+{
+    return submit<void>({CommandUnwatch, id}, {}, {}, [](Reply&) {});
+}
+
+std::future<void> Client::kill()
+{
+    auto promise = std::make_shared<std::promise<void>>();
+    std::future<void> future = promise->get_future();
+
+    // the server shuts down all client sockets when it stops, the reply might not make it
+    send({CommandKill}, {}, {}, [promise](Reply* reply, std::exception_ptr) {
+        if (reply && reply->status < 0) {
+            promise->set_exception(std::make_exception_ptr(ServerError(reply->status)));
+        } else {
+            promise->set_value();
+        }
+    });
+
+    return future;
+}
+
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+// Client for the framed wupserver protocol, see the protocol description in ios_mcp/source/wupserver.c.
+// Every request returns a future right away, any number of requests can be in flight on one connection.
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace wup {
+
+enum class ByteOrder {
+    // the console
+    Big,
+    // tools/wupserver_host on x86 and most other hosts
+    Little,
+};
+
+enum class HashAlgorithm : uint32_t {
+    Sha256 = 0,
+    Crc32 = 1,
+};
+
+// thrown from futures if the server returned a negative status
+class ServerError : public std::runtime_error {
+public:
+    explicit ServerError(int32_t status);
+    int32_t status() const { return status_; }
+
+private:
+    int32_t status_;
+};
+
+struct Reply {
+    int32_t status = 0;
+    // everything following the status word
+    std::vector<uint8_t> data;
+};
+
+struct SearchResult {
+    // address to continue the search from, the end of the range once everything was scanned
+    uint32_t next = 0;
+    std::vector<uint32_t> matches;
+};
+
+struct IoctlResult {
+    int32_t result = 0;
+    std::vector<std::vector<uint8_t>> out;
+};
+
+// collects sub-commands for Client::batch, arguments with their bit set in refmask are offsets into the scratch buffer
+class Batch {
+public:
+    explicit Batch(uint32_t scratchSize = 0) : scratchSize_(scratchSize) {}
+
+    void write(uint32_t dst, const std::vector<uint32_t>& words, uint8_t refmask = 0);
+    void read(uint32_t src, uint32_t length, uint8_t refmask = 0);
+    void svc(uint32_t id, const std::vector<uint32_t>& args, uint8_t refmask = 0);
+    void memcpy(uint32_t dst, uint32_t src, uint32_t size, uint8_t refmask = 0);
+
+private:
+    friend class Client;
+
+    void add(uint32_t op, uint8_t refmask, const std::vector<uint32_t>& args);
+
+    uint32_t scratchSize_;
+    uint32_t count_ = 0;
+    std::vector<uint32_t> words_;
+};
+
+class Client {
+public:
+    // largest payload of a single frame, bigger reads and writes are streamed
+    static constexpr uint32_t MaxFrameSize = 0x600;
+    static constexpr uint16_t DefaultPort = 1337;
+
+    explicit Client(ByteOrder order = ByteOrder::Big);
+    ~Client();
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    // connects and switches to the framed protocol, throws std::runtime_error on failure
+    void connect(const std::string& host, uint16_t port = DefaultPort);
+    void close();
+
+    std::future<std::vector<uint8_t>> read(uint32_t addr, uint32_t length);
+    std::future<void> write(uint32_t addr, const std::vector<uint8_t>& data);
+    std::future<int32_t> svc(uint32_t id, const std::vector<uint32_t>& args);
+    std::future<void> memcpy(uint32_t dst, uint32_t src, uint32_t size);
+    // returns the results of all reads and svcs of the batch, in order
+    std::future<std::vector<uint8_t>> batch(const Batch& batch);
+    std::future<SearchResult> search(uint32_t start, uint32_t end, const std::vector<uint8_t>& pattern,
+        const std::vector<uint8_t>& mask = {}, uint32_t maxMatches = 0);
+    std::future<std::vector<uint8_t>> hashMemory(HashAlgorithm algorithm, uint32_t addr, uint32_t length);
+    std::future<std::vector<uint8_t>> hashFile(HashAlgorithm algorithm, const std::string& path);
+    std::future<IoctlResult> ioctl(int32_t fd, uint32_t request, const std::vector<uint8_t>& in, uint32_t outSize);
+    std::future<IoctlResult> ioctlv(int32_t fd, uint32_t request, const std::vector<std::vector<uint8_t>>& in,
+        const std::vector<uint32_t>& outSizes);
+    // returns the id of the watch, changes are passed to the watch handler
+    std::future<uint32_t> watch(uint32_t addr, uint32_t length, uint32_t intervalUs);
+    std::future<void> unwatch(uint32_t id);
+    // stops the server
+    std::future<void> kill();
+
+    // called from the receive thread for every change of a watched range
+    void setWatchHandler(std::function<void(uint32_t id, const std::vector<uint8_t>& data)> handler);
+
+    // sends a raw framed request, words are encoded in the byte order of the server,
+    // raw is sent right after the frame without being part of it (for streaming writes)
+    std::future<Reply> request(const std::vector<uint32_t>& words, const std::vector<uint8_t>& data = {},
+        const std::vector<uint8_t>& raw = {});
+
+    uint32_t toWord(const uint8_t* data) const;
+    void fromWord(uint32_t value, uint8_t* data) const;
+
+private:
+    using Completion = std::function<void(Reply*, std::exception_ptr)>;
+
+    template <typename T, typename Convert>
+    std::future<T> submit(const std::vector<uint32_t>& words, const std::vector<uint8_t>& data,
+        const std::vector<uint8_t>& raw, Convert convert);
+
+    void send(const std::vector<uint32_t>& words, const std::vector<uint8_t>& data,
+        const std::vector<uint8_t>& raw, Completion completion);
+    void receiveThread();
+    void failAll(std::exception_ptr error);
+
+    ByteOrder order_;
+    int socket_ = -1;
+    std::thread receiver_;
+
+    std::mutex sendMutex_;
+    std::mutex pendingMutex_;
+    std::map<uint32_t, Completion> pending_;
+    std::exception_ptr error_;
+    uint32_t nextId_ = 1;
+
+    std::mutex watchMutex_;
+    std::function<void(uint32_t, const std::vector<uint8_t>&)> watchHandler_;
+};
+
+}
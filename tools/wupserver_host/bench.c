@@ -0,0 +1,262 @@
+// Benchmarks wupserver on the host, without a console.
+// wupserver.c is included directly, so serverCommandHandler can be timed on its own,
+// in addition to going through the server over loopback with the legacy and the framed protocol.
+
+#include "wupserver.c"
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum {
+    OP_READ,
+    OP_WRITE,
+    OP_SVC,
+    OP_MIX,
+};
+
+static const char* const opNames[] = { "read", "write", "svc", "mix" };
+
+typedef struct {
+    uint32_t count;
+    uint32_t size;
+    uint32_t depth;
+} BenchConfig;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// builds command i of op into buf, returns its length and stores the length of the reply in replyLength
+static uint32_t buildCommand(uint32_t* buf, int op, uint32_t i, uint32_t size, uint32_t* replyLength, uint64_t* bytes)
+{
+    if (op == OP_MIX) {
+        op = i % 3;
+    }
+
+    switch (op) {
+    case OP_READ:
+        buf[0] = 1;
+        buf[1] = HOST_ARENA_BASE;
+        buf[2] = size;
+        *replyLength = 4 + size;
+        *bytes += size;
+        return 12;
+    case OP_WRITE:
+        buf[0] = 0;
+        buf[1] = HOST_ARENA_BASE;
+        memset(&buf[2], 0x5a, size);
+        *replyLength = 4;
+        *bytes += size;
+        return 8 + size;
+    default:
+        // IOS_GetCurrentThreadId
+        buf[0] = 2;
+        buf[1] = 0x03;
+        *replyLength = 8;
+        return 8;
+    }
+}
+
+static void report(const char* mode, int op, const BenchConfig* config, double seconds, uint64_t bytes)
+{
+    printf("%-9s %-6s %12.0f %10.2f %10.2f\n", mode, opNames[op], config->count / seconds,
+        bytes / seconds / (1024.0 * 1024.0), seconds * 1e6 / config->count);
+}
+
+static void benchDispatch(int op, const BenchConfig* config)
+{
+    uint32_t* buf = socketAllocBuffer(COMMAND_BUFFER_SIZE);
+    uint64_t bytes = 0;
+
+    double start = now();
+    for (uint32_t i = 0; i < config->count; i++) {
+        uint32_t replyLength;
+        uint32_t length = buildCommand(buf, op, i, config->size, &replyLength, &bytes);
+        serverCommandHandler(buf, length);
+    }
+    report("dispatch", op, config, now() - start, bytes);
+
+    socketFreeBuffer(buf);
+}
+
+static int connectServer(void)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = 1337;
+    addr.sin_addr.s_addr = INADDR_LOOPBACK;
+
+    // the listener might not be up yet
+    for (int retry = 0; retry < 50; retry++) {
+        if (connect(sock, (struct sockaddr*) &addr, sizeof(addr)) == 0) {
+            return sock;
+        }
+        usleep(100 * 1000);
+    }
+
+    closesocket(sock);
+    return -1;
+}
+
+// one command per round trip, the way wupclient.py talks to the server
+static int benchLegacy(int op, const BenchConfig* config)
+{
+    int sock = connectServer();
+    if (sock < 0) {
+        return -1;
+    }
+
+    uint32_t* buf = malloc(COMMAND_BUFFER_SIZE);
+    uint64_t bytes = 0;
+
+    double start = now();
+    for (uint32_t i = 0; i < config->count; i++) {
+        uint32_t replyLength;
+        uint32_t length = buildCommand(buf, op, i, config->size, &replyLength, &bytes);
+        if (server_send_all(sock, buf, length) < 0 || server_recv_all(sock, buf, replyLength) < 0) {
+            break;
+        }
+    }
+    report("legacy", op, config, now() - start, bytes);
+
+    free(buf);
+    closesocket(sock);
+    return 0;
+}
+
+// keeps depth frames in flight
+static int benchFramed(int op, const BenchConfig* config)
+{
+    int sock = connectServer();
+    if (sock < 0) {
+        return -1;
+    }
+
+    uint32_t* buf = malloc(FRAME_HEADER_SIZE + COMMAND_BUFFER_SIZE);
+    uint32_t* replyLengths = malloc(config->depth * sizeof(uint32_t));
+
+    uint32_t hello[3] = { 6, WUPSERVER_HELLO_MAGIC, WUPSERVER_PROTOCOL_VERSION };
+    if (server_send_all(sock, hello, sizeof(hello)) < 0 || server_recv_all(sock, hello, 8) < 0 || hello[0] != 0) {
+        free(replyLengths);
+        free(buf);
+        closesocket(sock);
+        return -1;
+    }
+
+    uint64_t bytes = 0;
+    uint32_t sent = 0;
+    uint32_t received = 0;
+
+    double start = now();
+    while (received < config->count) {
+        if (sent < config->count && sent - received < config->depth) {
+            uint32_t length = buildCommand(&buf[2], op, sent, config->size, &replyLengths[sent % config->depth], &bytes);
+            buf[0] = length;
+            buf[1] = sent;
+            if (server_send_all(sock, buf, FRAME_HEADER_SIZE + length) < 0) {
+                break;
+            }
+            sent++;
+            continue;
+        }
+
+        if (server_recv_all(sock, buf, FRAME_HEADER_SIZE + replyLengths[received % config->depth]) < 0) {
+            break;
+        }
+        received++;
+    }
+    report("framed", op, config, now() - start, bytes);
+
+    free(replyLengths);
+    free(buf);
+    closesocket(sock);
+    return 0;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "usage: %s [-n count] [-s size] [-d depth] [op...]\n"
+        "  -n count    commands per run (default 100000)\n"
+        "  -s size     bytes per read or write (default 4, at most 0x5f8)\n"
+        "  -d depth    frames in flight for the framed protocol (default 32)\n"
+        "  op          read, write, svc or mix (default all of them)\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    BenchConfig config = { 100000, 4, 32 };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:d:")) != -1) {
+        switch (opt) {
+        case 'n':
+            config.count = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            config.size = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            config.depth = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (config.size > COMMAND_BUFFER_SIZE - 8 || !config.depth) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int ops[4];
+    int numOps = 0;
+    for (int i = optind; i < argc; i++) {
+        int op;
+        for (op = 0; op < 4; op++) {
+            if (!strcmp(argv[i], opNames[op])) {
+                break;
+            }
+        }
+        if (op == 4 || numOps == 4) {
+            usage(argv[0]);
+            return 1;
+        }
+        ops[numOps++] = op;
+    }
+    if (!numOps) {
+        for (int op = 0; op < 4; op++) {
+            ops[numOps++] = op;
+        }
+    }
+
+    if (host_arena_init() < 0) {
+        fprintf(stderr, "Failed to map the arena at 0x%08x\n", HOST_ARENA_BASE);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    wupserver_init();
+
+    printf("%u commands, %u bytes per read/write, depth %u\n", config.count, config.size, config.depth);
+    printf("%-9s %-6s %12s %10s %10s\n", "mode", "op", "commands/s", "MiB/s", "us/command");
+    for (int i = 0; i < numOps; i++) {
+        benchDispatch(ops[i], &config);
+        if (benchLegacy(ops[i], &config) < 0 || benchFramed(ops[i], &config) < 0) {
+            fprintf(stderr, "Failed to connect to the server, is port 1337 in use?\n");
+            break;
+        }
+    }
+
+    wupserver_deinit();
+    return 0;
+}
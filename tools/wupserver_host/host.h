@@ -0,0 +1,24 @@
+#pragma once
+
+// Force-included into ios_mcp/source/wupserver.c when building it for the host.
+// The socket API of ios_mcp collides with libc, so wupserver's calls are renamed to the shim in socket_shim.c.
+
+#include "ios_shim.h"
+
+#define socket              wup_socket
+#define bind                wup_bind
+#define connect             wup_connect
+#define listen              wup_listen
+#define accept              wup_accept
+#define recv                wup_recv
+#define send                wup_send
+#define shutdown            wup_shutdown
+#define closesocket         wup_closesocket
+#define poll                wup_poll
+#define sendv               wup_sendv
+#define recvv               wup_recvv
+#define socketAllocBuffer   wup_socketAllocBuffer
+#define socketFreeBuffer    wup_socketFreeBuffer
+
+// there is no svc table on the host, svcs are dispatched by host_svc() instead
+#define WUPSERVER_SVC(svc_id) host_svc(svc_id)
@@ -0,0 +1,111 @@
+// Runs requests with the HTTP client of ios_mcp/source/httpclient.c on the host, for httpclient_test.py.
+// usage: httpclient_host <port> <request>...
+// every request is METHOD:PATH, or METHOD:PATH:SIZE to send a body of SIZE bytes,
+// sleep:MS waits between requests. All requests go through the same client.
+// Prints one line per request with the result, the received body is only reported as length and CRC-32.
+
+#include "ios_shim.h"
+#include "httpclient.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    uint32_t received;
+    uint32_t crc;
+} BodyState;
+
+static uint32_t crc32Update(uint32_t crc, const uint8_t* data, uint32_t size)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static int receiveBody(HttpResponse* response, const uint8_t* data, uint32_t size)
+{
+    BodyState* state = (BodyState*) response->userdata;
+    state->received += size;
+    state->crc = crc32Update(state->crc, data, size);
+    return 0;
+}
+
+static int runRequest(HttpClient* client, char* request)
+{
+    char* method = strtok(request, ":");
+    char* path = strtok(NULL, ":");
+    char* size = strtok(NULL, ":");
+    if (!method || !path) {
+        fprintf(stderr, "invalid request\n");
+        return -1;
+    }
+
+    struct iovec body;
+    uint8_t* buffer = NULL;
+    if (size) {
+        body.iov_len = strtoul(size, NULL, 0);
+        buffer = socketAllocBuffer(body.iov_len);
+        if (!buffer) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < body.iov_len; i++) {
+            buffer[i] = i * 7;
+        }
+        body.iov_base = buffer;
+    }
+
+    BodyState state = { 0, 0 };
+    HttpResponse response;
+    response.body = receiveBody;
+    response.userdata = &state;
+
+    // the server answers with 100 Continue before the final response
+    int ret = httpclient_request(client, method, path, size ? "Expect: 100-continue\r\n" : NULL, size ? &body : NULL, &response);
+    printf("%s %s ret=%d status=%d length=%ld received=%u crc=%08x\n", method, path, ret, response.status,
+        (response.contentLength == HTTP_CLIENT_UNKNOWN_LENGTH) ? -1L : (long) response.contentLength, state.received, state.crc);
+    fflush(stdout);
+
+    if (buffer) {
+        socketFreeBuffer(buffer);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <port> <request>...\n", argv[0]);
+        return 1;
+    }
+
+    if (host_arena_init() < 0) {
+        fprintf(stderr, "Failed to map the arena at 0x%08x\n", HOST_ARENA_BASE);
+        return 1;
+    }
+
+    HttpClient client;
+    if (httpclient_init(&client, INADDR_LOOPBACK, atoi(argv[1]), "127.0.0.1") < 0) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    int res = 0;
+    for (int i = 2; i < argc && res == 0; i++) {
+        if (strncmp(argv[i], "sleep:", 6) == 0) {
+            usleep(atoi(argv[i] + 6) * 1000);
+            continue;
+        }
+
+        res = runRequest(&client, argv[i]);
+    }
+
+    httpclient_close(&client);
+    return (res == 0) ? 0 : 1;
+}
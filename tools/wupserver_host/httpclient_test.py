@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+# Tests the HTTP client of ios_mcp/source/httpclient.c through httpclient_host, against a server built on http.server.
+# Covers bodies with Content-Length, chunked bodies with extensions and trailers, bodies delimited by closing the
+# connection, 100 Continue before the response, HEAD and 204 responses, and a kept open connection which the
+# server closed while the client was idle.
+# usage: httpclient_test.py <path to httpclient_host>
+
+import http.server
+import random
+import re
+import subprocess
+import sys
+import threading
+import zlib
+
+
+def data(size):
+    return bytes((i * 13) & 0xff for i in range(size))
+
+
+def sent_body(size):
+    return bytes((i * 7) & 0xff for i in range(size))
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    connections = 0
+    # number of the connection every path was requested on
+    served = {}
+
+    def setup(self):
+        super().setup()
+        Handler.connections += 1
+        self.connection_number = Handler.connections
+
+    def log_message(self, format, *args):
+        pass
+
+    def send_length(self, status, body):
+        self.send_response(status)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        if self.command != "HEAD":
+            self.wfile.write(body)
+
+    def do_HEAD(self):
+        self.do_GET()
+
+    def do_GET(self):
+        Handler.served[self.path] = self.connection_number
+        parts = self.path.split("/")
+        if parts[1] == "length":
+            self.send_length(200, data(int(parts[2])))
+        elif parts[1] == "chunked":
+            self.send_response(200)
+            self.send_header("Transfer-Encoding", "chunked")
+            self.end_headers()
+            body = data(int(parts[2]))
+            rng = random.Random(1)
+            pos = 0
+            while pos < len(body):
+                chunk = body[pos:pos + rng.randrange(1, 9000)]
+                self.wfile.write(b"%x;ext=%d\r\n" % (len(chunk), pos) + chunk + b"\r\n")
+                self.wfile.flush()
+                pos += len(chunk)
+            self.wfile.write(b"0;last\r\nX-Trailer: 1\r\nX-Other-Trailer: 2\r\n\r\n")
+        elif parts[1] == "close":
+            # neither Content-Length nor chunked, the body ends with the connection
+            self.send_response(200)
+            self.end_headers()
+            self.wfile.write(data(int(parts[2])))
+            self.close_connection = True
+        elif parts[1] == "nocontent":
+            self.send_response(204)
+            self.end_headers()
+        elif parts[1] == "idleclose":
+            # announced as kept open, but closed right after the response
+            self.send_length(200, b"ok")
+            self.close_connection = True
+        else:
+            self.send_length(404, b"not found")
+
+    def do_POST(self):
+        Handler.served[self.path] = self.connection_number
+        # handle_expect_100 already sent 100 Continue
+        body = self.rfile.read(int(self.headers["Content-Length"]))
+        self.send_length(200, body)
+
+
+class Expect:
+    # responses without a body, like those to HEAD requests or 204, report a length of 0
+    def __init__(self, request, status, length, body, connection):
+        self.request = request
+        self.status = status
+        self.length = length
+        self.body = body
+        # number of the connection the request is expected on, counted from 1
+        self.connection = connection
+
+
+EXPECTED = [
+    Expect("GET:/length/100000", 200, 100000, data(100000), 1),
+    Expect("GET:/length/0", 200, 0, b"", 1),
+    Expect("HEAD:/length/5000", 200, 0, b"", 1),
+    Expect("GET:/nocontent", 204, 0, b"", 1),
+    Expect("GET:/chunked/100000", 200, -1, data(100000), 1),
+    Expect("POST:/echo:20000", 200, 20000, sent_body(20000), 1),
+    Expect("GET:/idleclose", 200, 2, b"ok", 1),
+    Expect("sleep:200", None, None, None, None),
+    Expect("GET:/length/10", 200, 10, data(10), 2),
+    Expect("GET:/close/70000", 200, -1, data(70000), 2),
+    Expect("GET:/length/3", 200, 3, data(3), 3),
+    Expect("GET:/missing", 404, 9, b"not found", 3),
+]
+
+LINE = re.compile(r"(\S+) (\S+) ret=(-?\d+) status=(\d+) length=(-?\d+) received=(\d+) crc=([0-9a-f]+)")
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(f"usage: {sys.argv[0]} <path to httpclient_host>")
+        return 1
+
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), Handler)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+
+    args = [sys.argv[1], str(server.server_port)]
+    process = subprocess.Popen(args + [e.request for e in EXPECTED], stdout=subprocess.PIPE, text=True)
+    failed = False
+    for expect in EXPECTED:
+        if expect.status is None:
+            continue
+
+        line = process.stdout.readline()
+        match = LINE.match(line)
+        if not match:
+            print(f"{expect.request}: unexpected output {line!r}")
+            failed = True
+            break
+
+        ret, status, length, received = (int(match.group(i)) for i in range(3, 7))
+        crc = int(match.group(7), 16)
+        errors = []
+        if ret != 0:
+            errors.append(f"returned {ret}")
+        if status != expect.status:
+            errors.append(f"status {status}, expected {expect.status}")
+        if length != expect.length:
+            errors.append(f"length {length}, expected {expect.length}")
+        if received != len(expect.body) or crc != zlib.crc32(expect.body):
+            errors.append(f"received {received} bytes with crc {crc:08x}, expected {len(expect.body)} with {zlib.crc32(expect.body):08x}")
+        # the client might already run the next request, so the connection is looked up by the path
+        connection = Handler.served.get(expect.request.split(":")[1])
+        if connection != expect.connection:
+            errors.append(f"sent on connection {connection}, expected {expect.connection}")
+
+        print(f"{expect.request}: {'ok' if not errors else ', '.join(errors)}")
+        failed |= bool(errors)
+
+    if process.wait(timeout=30) != 0:
+        print(f"httpclient_host exited with {process.returncode}")
+        failed = True
+
+    server.shutdown()
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
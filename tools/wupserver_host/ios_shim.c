@@ -0,0 +1,521 @@
+// Minimal IOS environment for running wupserver.c on the host.
+// Everything wupserver treats as an address has to fit into 32 bits, so heap allocations are
+// served from an arena mapped at a fixed low address. The start of the arena stands in for console memory.
+
+#include "ios_shim.h"
+#include "imports.h"
+#include "fsa.h"
+#include "stackmon.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define HOST_MAX_THREADS 16
+#define HOST_MAX_QUEUES 16
+
+int fsaHandle = -1;
+
+typedef struct HeapBlock {
+    uint32_t size;
+    uint32_t free;
+    struct HeapBlock* next;
+    struct HeapBlock* prev;
+} HeapBlock;
+
+static pthread_mutex_t heapMutex = PTHREAD_MUTEX_INITIALIZER;
+static HeapBlock* heapHead = NULL;
+
+typedef struct {
+    int used;
+    pthread_t thread;
+    int (*fun)(void* arg);
+    void* arg;
+    int started;
+} HostThread;
+
+static pthread_mutex_t threadMutex = PTHREAD_MUTEX_INITIALIZER;
+static HostThread threads[HOST_MAX_THREADS];
+
+typedef struct {
+    int used;
+    uint32_t* buf;
+    uint32_t size;
+    uint32_t first;
+    uint32_t count;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} HostQueue;
+
+static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+static HostQueue queues[HOST_MAX_QUEUES];
+
+int host_arena_init(void)
+{
+    void* arena = mmap((void*) HOST_ARENA_BASE, HOST_ARENA_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (arena != (void*) HOST_ARENA_BASE) {
+        return -1;
+    }
+
+    heapHead = (HeapBlock*) (HOST_ARENA_BASE + HOST_MEMORY_SIZE);
+    heapHead->size = HOST_ARENA_SIZE - HOST_MEMORY_SIZE - sizeof(HeapBlock);
+    heapHead->free = 1;
+    heapHead->next = NULL;
+    heapHead->prev = NULL;
+    return 0;
+}
+
+static void splitBlock(HeapBlock* block, uint32_t size)
+{
+    if (block->size < size + sizeof(HeapBlock) + 0x40) {
+        return;
+    }
+
+    HeapBlock* rest = (HeapBlock*) ((uint8_t*) (block + 1) + size);
+    rest->size = block->size - size - sizeof(HeapBlock);
+    rest->free = 1;
+    rest->next = block->next;
+    rest->prev = block;
+    if (rest->next) {
+        rest->next->prev = rest;
+    }
+    block->next = rest;
+    block->size = size;
+}
+
+void* IOS_HeapAllocAligned(uint32_t heap, uint32_t size, uint32_t alignment)
+{
+    (void) heap;
+    if (alignment < 0x20) {
+        alignment = 0x20;
+    }
+    size = (size + 0x1f) & ~0x1f;
+
+    void* ptr = NULL;
+    pthread_mutex_lock(&heapMutex);
+    for (HeapBlock* block = heapHead; block; block = block->next) {
+        if (!block->free) {
+            continue;
+        }
+
+        // leave room for a free block in front of the aligned allocation
+        uintptr_t data = (uintptr_t) (block + 1);
+        uintptr_t aligned = (data + alignment - 1) & ~(uintptr_t) (alignment - 1);
+        while (aligned != data && aligned - data < sizeof(HeapBlock) + 0x20) {
+            aligned += alignment;
+        }
+
+        // the padding becomes a block of its own, which has to be splittable
+        uint32_t padding = aligned - data;
+        if (block->size < padding + size + (padding ? 0x40 : 0)) {
+            continue;
+        }
+
+        if (padding) {
+            splitBlock(block, padding - sizeof(HeapBlock));
+            block = block->next;
+        }
+
+        splitBlock(block, size);
+        block->free = 0;
+        ptr = block + 1;
+        break;
+    }
+    pthread_mutex_unlock(&heapMutex);
+
+    return ptr;
+}
+
+void* IOS_HeapAlloc(uint32_t heap, uint32_t size)
+{
+    return IOS_HeapAllocAligned(heap, size, 0x20);
+}
+
+void IOS_HeapFree(uint32_t heap, void* ptr)
+{
+    (void) heap;
+    if (!ptr) {
+        return;
+    }
+
+    pthread_mutex_lock(&heapMutex);
+    HeapBlock* block = (HeapBlock*) ptr - 1;
+    block->free = 1;
+
+    if (block->next && block->next->free) {
+        block->size += sizeof(HeapBlock) + block->next->size;
+        block->next = block->next->next;
+        if (block->next) {
+            block->next->prev = block;
+        }
+    }
+
+    if (block->prev && block->prev->free) {
+        HeapBlock* prev = block->prev;
+        prev->size += sizeof(HeapBlock) + block->size;
+        prev->next = block->next;
+        if (prev->next) {
+            prev->next->prev = prev;
+        }
+    }
+    pthread_mutex_unlock(&heapMutex);
+}
+
+static void* threadEntry(void* arg)
+{
+    HostThread* thread = arg;
+    return (void*) (intptr_t) thread->fun(thread->arg);
+}
+
+int IOS_CreateThread(int (*fun)(void* arg), void* arg, void* stack_top, uint32_t stacksize, int priority, IOS_ThreadFlags flags)
+{
+    // host threads bring their own stack
+    (void) stack_top;
+    (void) stacksize;
+    (void) priority;
+    (void) flags;
+
+    pthread_mutex_lock(&threadMutex);
+    for (int i = 0; i < HOST_MAX_THREADS; i++) {
+        if (!threads[i].used) {
+            threads[i].used = 1;
+            threads[i].fun = fun;
+            threads[i].arg = arg;
+            threads[i].started = 0;
+            pthread_mutex_unlock(&threadMutex);
+            return i;
+        }
+    }
+    pthread_mutex_unlock(&threadMutex);
+
+    return -5;
+}
+
+int IOS_StartThread(int threadid)
+{
+    if (threadid < 0 || threadid >= HOST_MAX_THREADS || !threads[threadid].used) {
+        return -4;
+    }
+
+    if (pthread_create(&threads[threadid].thread, NULL, threadEntry, &threads[threadid]) != 0) {
+        return -1;
+    }
+    threads[threadid].started = 1;
+    return 0;
+}
+
+int IOS_JoinThread(int threadid, int* retval)
+{
+    if (threadid < 0 || threadid >= HOST_MAX_THREADS || !threads[threadid].used) {
+        return -4;
+    }
+
+    void* ret = NULL;
+    if (threads[threadid].started) {
+        pthread_join(threads[threadid].thread, &ret);
+    }
+    if (retval) {
+        *retval = (int) (intptr_t) ret;
+    }
+
+    pthread_mutex_lock(&threadMutex);
+    threads[threadid].used = 0;
+    pthread_mutex_unlock(&threadMutex);
+    return 0;
+}
+
+int IOS_GetThreadPriority(int threadid)
+{
+    (void) threadid;
+    return 0x50;
+}
+
+int IOS_CreateMessageQueue(uint32_t* ptr, uint32_t n_msgs)
+{
+    pthread_mutex_lock(&queueMutex);
+    for (int i = 0; i < HOST_MAX_QUEUES; i++) {
+        if (!queues[i].used) {
+            HostQueue* queue = &queues[i];
+            queue->used = 1;
+            queue->buf = ptr;
+            queue->size = n_msgs;
+            queue->first = 0;
+            queue->count = 0;
+            pthread_mutex_init(&queue->mutex, NULL);
+            pthread_cond_init(&queue->cond, NULL);
+            pthread_mutex_unlock(&queueMutex);
+            return i;
+        }
+    }
+    pthread_mutex_unlock(&queueMutex);
+
+    return -5;
+}
+
+int IOS_DestroyMessageQueue(int queueid)
+{
+    if (queueid < 0 || queueid >= HOST_MAX_QUEUES || !queues[queueid].used) {
+        return -4;
+    }
+
+    pthread_mutex_lock(&queueMutex);
+    pthread_mutex_destroy(&queues[queueid].mutex);
+    pthread_cond_destroy(&queues[queueid].cond);
+    queues[queueid].used = 0;
+    pthread_mutex_unlock(&queueMutex);
+    return 0;
+}
+
+int IOS_SendMessage(int queueid, uint32_t message, IOS_MessageFlags flags)
+{
+    if (queueid < 0 || queueid >= HOST_MAX_QUEUES || !queues[queueid].used) {
+        return -4;
+    }
+
+    HostQueue* queue = &queues[queueid];
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->size) {
+        if (flags & IOS_MESSAGE_FLAGS_NON_BLOCKING) {
+            pthread_mutex_unlock(&queue->mutex);
+            return -8;
+        }
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+
+    queue->buf[(queue->first + queue->count) % queue->size] = message;
+    queue->count++;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+    return 0;
+}
+
+int IOS_ReceiveMessage(int queueid, uint32_t* message, IOS_MessageFlags flags)
+{
+    if (queueid < 0 || queueid >= HOST_MAX_QUEUES || !queues[queueid].used) {
+        return -4;
+    }
+
+    HostQueue* queue = &queues[queueid];
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0) {
+        if (flags & IOS_MESSAGE_FLAGS_NON_BLOCKING) {
+            pthread_mutex_unlock(&queue->mutex);
+            return -7;
+        }
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+
+    *message = queue->buf[queue->first];
+    queue->first = (queue->first + 1) % queue->size;
+    queue->count--;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+    return 0;
+}
+
+// there are no devices on the host
+int IOS_Open(const char* device, int mode)
+{
+    (void) device;
+    (void) mode;
+    return -6;
+}
+
+int IOS_Close(int fd)
+{
+    (void) fd;
+    return -4;
+}
+
+int IOS_Ioctl(int fd, uint32_t request, void* input_buffer, uint32_t input_buffer_len, void* output_buffer, uint32_t output_buffer_len)
+{
+    (void) fd;
+    (void) request;
+    (void) input_buffer;
+    (void) input_buffer_len;
+    (void) output_buffer;
+    (void) output_buffer_len;
+    return -4;
+}
+
+int IOS_Ioctlv(int fd, uint32_t request, uint32_t vector_count_in, uint32_t vector_count_out, IOSVec_t* vector)
+{
+    (void) fd;
+    (void) request;
+    (void) vector_count_in;
+    (void) vector_count_out;
+    (void) vector;
+    return -4;
+}
+
+int IOS_GetAbsTime64(uint64_t* time)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *time = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    return 0;
+}
+
+void IOS_InvalidateDCache(void* ptr, uint32_t len)
+{
+    (void) ptr;
+    (void) len;
+}
+
+void IOS_FlushDCache(void* ptr, uint32_t len)
+{
+    (void) ptr;
+    (void) len;
+}
+
+int IOSC_GenerateHash(uint8_t* context, uint32_t contextSize, uint8_t* inputData, uint32_t inputSize, uint32_t flags, uint8_t* hashData, uint32_t outputSize)
+{
+    // there is no crypto process to ask, sha256 requests fail
+    (void) context;
+    (void) contextSize;
+    (void) inputData;
+    (void) inputSize;
+    (void) flags;
+    (void) hashData;
+    (void) outputSize;
+    return -1;
+}
+
+uint32_t crc32(uint32_t seed, const void* data, size_t len)
+{
+    uint32_t crc = seed;
+    const uint8_t* src = data;
+
+    while (len--) {
+        crc ^= *src++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+        }
+    }
+
+    return crc;
+}
+
+int FSA_OpenFile(int fd, const char* path, const char* mode, int* outHandle)
+{
+    (void) fd;
+    (void) path;
+    (void) mode;
+    (void) outHandle;
+    return -1;
+}
+
+int FSA_ReadFile(int fd, void* data, uint32_t size, uint32_t cnt, int fileHandle, uint32_t flags)
+{
+    (void) fd;
+    (void) data;
+    (void) size;
+    (void) cnt;
+    (void) fileHandle;
+    (void) flags;
+    return -1;
+}
+
+int FSA_CloseFile(int fd, int fileHandle)
+{
+    (void) fd;
+    (void) fileHandle;
+    return 0;
+}
+
+void stackmon_register(const char* name, void* stack, uint32_t size)
+{
+    (void) name;
+    (void) stack;
+    (void) size;
+}
+
+void stackmon_unregister(void* stack)
+{
+    (void) stack;
+}
+
+#define SVC_ARGS uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5, uint32_t a6, uint32_t a7
+
+static int svcGetCurrentThreadId(SVC_ARGS)
+{
+    for (int i = 0; i < HOST_MAX_THREADS; i++) {
+        if (threads[i].used && threads[i].started && pthread_equal(threads[i].thread, pthread_self())) {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+static int svcHeapAlloc(SVC_ARGS)
+{
+    return (int) (uintptr_t) IOS_HeapAlloc(a0, a1);
+}
+
+static int svcHeapAllocAligned(SVC_ARGS)
+{
+    return (int) (uintptr_t) IOS_HeapAllocAligned(a0, a1, a2);
+}
+
+static int svcHeapFree(SVC_ARGS)
+{
+    IOS_HeapFree(a0, (void*) (uintptr_t) a1);
+    return 0;
+}
+
+static int svcOpen(SVC_ARGS)
+{
+    return IOS_Open((const char*) (uintptr_t) a0, a1);
+}
+
+static int svcClose(SVC_ARGS)
+{
+    return IOS_Close(a0);
+}
+
+static int svcIoctl(SVC_ARGS)
+{
+    return IOS_Ioctl(a0, a1, (void*) (uintptr_t) a2, a3, (void*) (uintptr_t) a4, a5);
+}
+
+static int svcIoctlv(SVC_ARGS)
+{
+    return IOS_Ioctlv(a0, a1, a2, a3, (IOSVec_t*) (uintptr_t) a4);
+}
+
+static int svcUnsupported(SVC_ARGS)
+{
+    return -1;
+}
+
+// the svcs used by wupclient scripts, with the ids of the mcp svc table
+static const struct {
+    int id;
+    HostSvcFunc func;
+} svcTable[] = {
+    { 0x03, svcGetCurrentThreadId },
+    { 0x27, svcHeapAlloc },
+    { 0x28, svcHeapAllocAligned },
+    { 0x29, svcHeapFree },
+    { 0x33, svcOpen },
+    { 0x34, svcClose },
+    { 0x38, svcIoctl },
+    { 0x39, svcIoctlv },
+};
+
+HostSvcFunc host_svc(int svc_id)
+{
+    for (size_t i = 0; i < sizeof(svcTable) / sizeof(svcTable[0]); i++) {
+        if (svcTable[i].id == svc_id) {
+            return svcTable[i].func;
+        }
+    }
+
+    return svcUnsupported;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+// the ipc and driver structures of ios_mcp are checked against their 32-bit layouts,
+// which don't hold with 64-bit pointers. include this before any ios_mcp header.
+#define _Static_assert(...)
+
+// wupserver casts addresses to 32-bit words, so everything it touches is placed below 4GB
+#define HOST_ARENA_BASE     0x10000000u
+#define HOST_ARENA_SIZE     0x08000000u
+// the first part of the arena can be freely read and written by clients, the rest is the heap
+#define HOST_MEMORY_SIZE    0x04000000u
+
+typedef int (*HostSvcFunc)(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+
+/**
+ * Map the arena, must be called before anything else.
+ * @return 0 on success, negative if the address range is already in use
+ */
+int host_arena_init(void);
+
+/**
+ * Look up the function called for a svc command.
+ */
+HostSvcFunc host_svc(int svc_id);
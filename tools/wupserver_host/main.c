@@ -0,0 +1,36 @@
+// Runs wupserver.c on the host, as a stand-in for a console when working on clients and the protocol.
+
+#include "ios_shim.h"
+#include "wupserver.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+
+int main(int argc, char** argv)
+{
+    (void) argc;
+    (void) argv;
+
+    if (host_arena_init() < 0) {
+        fprintf(stderr, "Failed to map the arena at 0x%08x\n", HOST_ARENA_BASE);
+        return 1;
+    }
+
+    // wait for ctrl+c on this thread, the server threads don't handle signals
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    wupserver_init();
+    printf("wupserver listening on port 1337, memory at 0x%08x - 0x%08x\n", HOST_ARENA_BASE, HOST_ARENA_BASE + HOST_MEMORY_SIZE);
+
+    int sig;
+    sigwait(&signals, &sig);
+
+    wupserver_deinit();
+    return 0;
+}
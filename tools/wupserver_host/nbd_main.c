@@ -0,0 +1,159 @@
+// Runs the NBD server of ios_mcp/source/nbd.c on the host, with the raw device backed by an image file.
+// Every FSA_RawRead and FSA_RawWrite is counted, to see how well requests are coalesced.
+
+#include "ios_shim.h"
+#include "fsa.h"
+#include "nbd.h"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DEVICE_HANDLE 1
+
+static int imageFd = -1;
+static uint32_t sectorSize = 512;
+static uint64_t numSectors = 0;
+
+static uint64_t rawReads, rawReadBytes;
+static uint64_t rawWrites, rawWriteBytes;
+
+int FSA_GetDeviceInfo(int fd, const char* device_path, int type, uint32_t* out_data)
+{
+    (void) fd;
+    (void) device_path;
+
+    if (type != 4) {
+        return -1;
+    }
+
+    // same layout as on the console
+    memset(out_data, 0, 0x28);
+    out_data[0x08 / 4] = numSectors >> 32;
+    out_data[0x0c / 4] = numSectors;
+    out_data[0x10 / 4] = sectorSize;
+    return 0;
+}
+
+int FSA_RawOpen(int fd, const char* device_path, int* outHandle)
+{
+    (void) fd;
+    (void) device_path;
+
+    *outHandle = DEVICE_HANDLE;
+    return 0;
+}
+
+int FSA_RawRead(int fd, void* data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle)
+{
+    (void) fd;
+
+    if (device_handle != DEVICE_HANDLE || size_bytes != sectorSize || blocks_offset + cnt > numSectors) {
+        return -1;
+    }
+
+    __atomic_add_fetch(&rawReads, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&rawReadBytes, (uint64_t) size_bytes * cnt, __ATOMIC_RELAXED);
+    return (pread(imageFd, data, (size_t) size_bytes * cnt, blocks_offset * size_bytes) == (ssize_t) size_bytes * cnt) ? 0 : -1;
+}
+
+int FSA_RawWrite(int fd, void* data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle)
+{
+    (void) fd;
+
+    if (device_handle != DEVICE_HANDLE || size_bytes != sectorSize || blocks_offset + cnt > numSectors) {
+        return -1;
+    }
+
+    __atomic_add_fetch(&rawWrites, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&rawWriteBytes, (uint64_t) size_bytes * cnt, __ATOMIC_RELAXED);
+    return (pwrite(imageFd, data, (size_t) size_bytes * cnt, blocks_offset * size_bytes) == (ssize_t) size_bytes * cnt) ? 0 : -1;
+}
+
+int FSA_RawClose(int fd, int device_handle)
+{
+    (void) fd;
+    (void) device_handle;
+    return 0;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "usage: %s [-r] [-s sector size] <image>\n"
+        "  -r          export read-only\n"
+        "  -s size     sector size of the device (default 512)\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    int readOnly = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "rs:")) != -1) {
+        switch (opt) {
+        case 'r':
+            readOnly = 1;
+            break;
+        case 's':
+            sectorSize = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind != argc - 1 || !sectorSize) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    imageFd = open(argv[optind], readOnly ? O_RDONLY : O_RDWR);
+    struct stat st;
+    if (imageFd < 0 || fstat(imageFd, &st) < 0) {
+        fprintf(stderr, "Failed to open %s\n", argv[optind]);
+        return 1;
+    }
+    numSectors = st.st_size / sectorSize;
+
+    if (host_arena_init() < 0) {
+        fprintf(stderr, "Failed to map the arena at 0x%08x\n", HOST_ARENA_BASE);
+        return 1;
+    }
+
+    // wait for ctrl+c on this thread, the server thread doesn't handle signals
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    uint64_t size;
+    int res = nbd_init("/dev/host", readOnly, &size);
+    if (res < 0) {
+        fprintf(stderr, "nbd_init failed: %d\n", res);
+        return 1;
+    }
+    printf("nbd server listening on port %d, %llu bytes in sectors of %u bytes%s\n",
+        NBD_PORT, (unsigned long long) size, sectorSize, readOnly ? ", read-only" : "");
+    fflush(stdout);
+
+    int sig;
+    sigwait(&signals, &sig);
+
+    nbd_deinit();
+    printf("%llu raw reads (%llu bytes), %llu raw writes (%llu bytes)\n",
+        (unsigned long long) rawReads, (unsigned long long) rawReadBytes,
+        (unsigned long long) rawWrites, (unsigned long long) rawWriteBytes);
+
+    close(imageFd);
+    return 0;
+}
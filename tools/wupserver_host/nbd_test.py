@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+# Tests the NBD server of ios_mcp/source/nbd.c through nbdserver_host, with a small NBD client.
+# Random reads and writes are checked against a copy of the image kept by the test,
+# and the image file must match that copy once the server wrote everything back.
+# usage: nbd_test.py <path to nbdserver_host>
+
+import os
+import random
+import signal
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+PORT = 10809
+IMAGE_SIZE = 4 * 1024 * 1024
+
+NBD_MAGIC = 0x4e42444d41474943
+IHAVEOPT = 0x49484156454f5054
+OPTION_REPLY_MAGIC = 0x0003e889045565a9
+REQUEST_MAGIC = 0x25609513
+SIMPLE_REPLY_MAGIC = 0x67446698
+
+OPT_EXPORT_NAME = 1
+OPT_GO = 7
+REP_ACK = 1
+REP_INFO = 3
+
+CMD_READ = 0
+CMD_WRITE = 1
+CMD_DISC = 2
+CMD_FLUSH = 3
+CMD_FLAG_FUA = 1
+
+FLAG_NO_ZEROES = 2
+FLAG_READ_ONLY = 2
+
+EPERM = 1
+EINVAL = 22
+
+
+class Client:
+    def __init__(self, go=True):
+        for _ in range(50):
+            try:
+                self.sock = socket.create_connection(("127.0.0.1", PORT))
+                break
+            except ConnectionRefusedError:
+                time.sleep(0.1)
+        else:
+            raise RuntimeError("can't connect to the server")
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.handle = 0
+
+        magic, opt, flags = struct.unpack(">QQH", self.recv(18))
+        assert magic == NBD_MAGIC and opt == IHAVEOPT, "bad greeting"
+        if go:
+            self.sock.sendall(struct.pack(">I", FLAG_NO_ZEROES))
+            self.go()
+        else:
+            # the old way, without FLAG_NO_ZEROES the reply is padded
+            self.sock.sendall(struct.pack(">I", 0))
+            self.sock.sendall(struct.pack(">QII", IHAVEOPT, OPT_EXPORT_NAME, 0))
+            self.size, self.flags = struct.unpack(">QH", self.recv(10))
+            assert self.recv(124) == bytes(124)
+
+    def recv(self, length):
+        data = b""
+        while len(data) < length:
+            chunk = self.sock.recv(length - len(data))
+            if not chunk:
+                raise RuntimeError("connection closed")
+            data += chunk
+        return data
+
+    def go(self):
+        self.sock.sendall(struct.pack(">QII", IHAVEOPT, OPT_GO, 6) + struct.pack(">IH", 0, 0))
+        self.size = None
+        self.blockSize = None
+        while True:
+            magic, option, type, length = struct.unpack(">QIII", self.recv(20))
+            assert magic == OPTION_REPLY_MAGIC and option == OPT_GO
+            data = self.recv(length)
+            if type == REP_ACK:
+                break
+            assert type == REP_INFO, "unexpected reply type %x" % type
+            info = struct.unpack(">H", data[:2])[0]
+            if info == 0:
+                self.size, self.flags = struct.unpack(">QH", data[2:])
+            elif info == 3:
+                self.blockSize = struct.unpack(">III", data[2:])
+        assert self.size is not None
+
+    def request(self, type, offset, length, data=b"", flags=0):
+        self.handle += 1
+        self.sock.sendall(struct.pack(">IHHQQI", REQUEST_MAGIC, flags, type, self.handle, offset, length) + data)
+        if type == CMD_DISC:
+            return 0, b""
+        magic, error, handle = struct.unpack(">IIQ", self.recv(16))
+        assert magic == SIMPLE_REPLY_MAGIC and handle == self.handle
+        if type == CMD_READ and error == 0:
+            return error, self.recv(length)
+        return error, b""
+
+    def read(self, offset, length):
+        error, data = self.request(CMD_READ, offset, length)
+        assert error == 0, "read %x+%x failed: %d" % (offset, length, error)
+        return data
+
+    def write(self, offset, data, flags=0):
+        error, _ = self.request(CMD_WRITE, offset, len(data), data, flags)
+        assert error == 0, "write %x+%x failed: %d" % (offset, len(data), error)
+
+    def close(self):
+        self.request(CMD_DISC, 0, 0)
+        self.sock.close()
+
+
+def startServer(server, image, *args):
+    proc = subprocess.Popen([server, *args, image], stdout=subprocess.PIPE, text=True)
+    proc.stdout.readline()
+    return proc
+
+
+def stopServer(proc):
+    proc.send_signal(signal.SIGINT)
+    out = proc.communicate(timeout=10)[0]
+    assert proc.returncode == 0
+    return out.strip()
+
+
+def randomAccess(rng, size):
+    # mostly sequential and sector sized, like a filesystem would do, with some odd ones in between
+    kind = rng.random()
+    if kind < 0.6:
+        length = rng.choice([0x200, 0x1000, 0x10000, 0x20000])
+        offset = rng.randrange(0, size - length, 0x200)
+    else:
+        length = rng.randrange(1, 0x3000)
+        offset = rng.randrange(0, size - length)
+    return offset, length
+
+
+def testReadWrite(server, image, shadow):
+    rng = random.Random(1)
+    proc = startServer(server, image)
+    try:
+        client = Client()
+        assert client.size == IMAGE_SIZE and not client.flags & FLAG_READ_ONLY
+        assert client.blockSize and client.blockSize[0] == 512
+
+        # sequential write followed by a sequential read, which should be coalesced into few device accesses
+        data = os.urandom(0x40000)
+        for i in range(0, len(data), 0x1000):
+            client.write(0x100000 + i, data[i:i + 0x1000])
+        shadow[0x100000:0x100000 + len(data)] = data
+        for i in range(0, len(data), 0x1000):
+            assert client.read(0x100000 + i, 0x1000) == data[i:i + 0x1000]
+
+        for i in range(2000):
+            offset, length = randomAccess(rng, IMAGE_SIZE)
+            op = rng.random()
+            if op < 0.5:
+                assert client.read(offset, length) == bytes(shadow[offset:offset + length]), "mismatch at %x+%x" % (offset, length)
+            elif op < 0.95:
+                data = os.urandom(length)
+                client.write(offset, data, CMD_FLAG_FUA if rng.random() < 0.1 else 0)
+                shadow[offset:offset + length] = data
+            else:
+                assert client.request(CMD_FLUSH, 0, 0)[0] == 0
+
+        assert client.request(CMD_READ, IMAGE_SIZE - 0x100, 0x200)[0] == EINVAL
+        assert client.request(CMD_WRITE, IMAGE_SIZE, 0x200, bytes(0x200))[0] == EINVAL
+        # the connection must still be usable after rejected requests
+        assert client.read(0, 0x200) == bytes(shadow[0:0x200])
+        client.close()
+
+        # whatever is still in the window is written back once the client leaves
+        client = Client(go=False)
+        assert client.size == IMAGE_SIZE
+        for offset in range(0, IMAGE_SIZE, 0x80000):
+            assert client.read(offset, 0x80000) == bytes(shadow[offset:offset + 0x80000])
+        client.close()
+    finally:
+        stats = stopServer(proc)
+
+    with open(image, "rb") as f:
+        assert f.read() == bytes(shadow), "image doesn't match"
+    print("read/write: ok, " + stats)
+
+
+def testReadOnly(server, image, shadow):
+    proc = startServer(server, image, "-r")
+    try:
+        client = Client()
+        assert client.flags & FLAG_READ_ONLY
+        assert client.request(CMD_WRITE, 0, 0x200, bytes(0x200))[0] == EPERM
+        assert client.read(0, 0x1000) == bytes(shadow[0:0x1000])
+        client.close()
+    finally:
+        stopServer(proc)
+
+    with open(image, "rb") as f:
+        assert f.read() == bytes(shadow), "read-only image was modified"
+    print("read-only: ok")
+
+
+def main():
+    if len(sys.argv) != 2:
+        print("usage: %s <path to nbdserver_host>" % sys.argv[0])
+        return 1
+
+    with tempfile.TemporaryDirectory() as tmp:
+        image = os.path.join(tmp, "image.bin")
+        shadow = bytearray(os.urandom(IMAGE_SIZE))
+        with open(image, "wb") as f:
+            f.write(shadow)
+
+        testReadWrite(sys.argv[1], image, shadow)
+        testReadOnly(sys.argv[1], image, shadow)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,187 @@
+// Maps the ios_mcp socket API used by wupserver.c onto POSIX sockets.
+// This file can't include socket.h since it collides with the system headers,
+// so the structures used by wupserver are mirrored here.
+
+#include "ios_shim.h"
+#include "imports.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// struct sockaddr_in of ios_mcp, the port is stored in host byte order like on the console
+typedef struct {
+    uint16_t family;
+    uint16_t port;
+    uint32_t addr;
+    uint8_t zero[8];
+} WupSockaddrIn;
+
+typedef struct {
+    int fd;
+    short events;
+    short revents;
+} WupPollfd;
+
+typedef struct {
+    void* base;
+    size_t len;
+} WupIovec;
+
+#define WUP_POLLIN  0x01
+#define WUP_POLLPRI 0x02
+#define WUP_POLLOUT 0x04
+#define WUP_POLLERR 0x08
+
+// the socket driver takes at most two data vectors
+#define WUP_MAX_VECTORS 2
+
+int wup_socket(int domain, int type, int protocol)
+{
+    (void) domain;
+    (void) protocol;
+
+    int fd = socket(AF_INET, (type == 2) ? SOCK_DGRAM : SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // allow restarting the server right away
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (type != 2) {
+        // don't let small replies wait for acks, this is about latency
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    }
+    return fd;
+}
+
+static void toSockaddr(const WupSockaddrIn* in, struct sockaddr_in* out)
+{
+    memset(out, 0, sizeof(*out));
+    out->sin_family = AF_INET;
+    out->sin_port = htons(in->port);
+    out->sin_addr.s_addr = htonl(in->addr);
+}
+
+int wup_bind(int sockfd, const void* addr, uint32_t addrlen)
+{
+    (void) addrlen;
+
+    struct sockaddr_in server;
+    toSockaddr(addr, &server);
+    return bind(sockfd, (struct sockaddr*) &server, sizeof(server));
+}
+
+int wup_connect(int sockfd, const void* addr, uint32_t addrlen)
+{
+    (void) addrlen;
+
+    struct sockaddr_in server;
+    toSockaddr(addr, &server);
+    return connect(sockfd, (struct sockaddr*) &server, sizeof(server));
+}
+
+int wup_listen(int sockfd, int backlog)
+{
+    return listen(sockfd, backlog);
+}
+
+int wup_accept(int sockfd, void* addr, uint32_t* addrlen)
+{
+    // wupserver doesn't care about the peer
+    (void) addr;
+    (void) addrlen;
+    return accept(sockfd, NULL, NULL);
+}
+
+ssize_t wup_recv(int sockfd, void* buf, size_t len, int flags)
+{
+    (void) flags;
+    return recv(sockfd, buf, len, 0);
+}
+
+ssize_t wup_send(int sockfd, const void* buf, size_t len, int flags)
+{
+    (void) flags;
+    return send(sockfd, buf, len, MSG_NOSIGNAL);
+}
+
+int wup_shutdown(int sockfd, int how)
+{
+    return shutdown(sockfd, how);
+}
+
+int wup_closesocket(int sockfd)
+{
+    return close(sockfd);
+}
+
+int wup_poll(WupPollfd* fds, unsigned int nfds, int timeout)
+{
+    struct pollfd pfds[32];
+    if (nfds > sizeof(pfds) / sizeof(pfds[0])) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < nfds; i++) {
+        pfds[i].fd = fds[i].fd;
+        pfds[i].events = ((fds[i].events & WUP_POLLIN) ? POLLIN : 0) | ((fds[i].events & WUP_POLLOUT) ? POLLOUT : 0);
+        pfds[i].revents = 0;
+    }
+
+    int ret = poll(pfds, nfds, timeout);
+    if (ret < 0) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < nfds; i++) {
+        fds[i].revents = ((pfds[i].revents & POLLIN) ? WUP_POLLIN : 0) | ((pfds[i].revents & POLLOUT) ? WUP_POLLOUT : 0)
+            | ((pfds[i].revents & (POLLERR | POLLHUP)) ? WUP_POLLERR : 0);
+    }
+
+    return ret;
+}
+
+void* wup_socketAllocBuffer(size_t size)
+{
+    return IOS_HeapAllocAligned(CROSS_PROCESS_HEAP_ID, size, 0x40);
+}
+
+void wup_socketFreeBuffer(void* buf)
+{
+    IOS_HeapFree(CROSS_PROCESS_HEAP_ID, buf);
+}
+
+static ssize_t transferv(int sockfd, const WupIovec* iov, int iovcnt, int recv)
+{
+    if (!iov || iovcnt < 1 || iovcnt > WUP_MAX_VECTORS) return -101;
+
+    struct iovec vecs[WUP_MAX_VECTORS];
+    for (int i = 0; i < iovcnt; i++) {
+        vecs[i].iov_base = iov[i].base;
+        vecs[i].iov_len = iov[i].len;
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = vecs;
+    msg.msg_iovlen = iovcnt;
+    return recv ? recvmsg(sockfd, &msg, 0) : sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+}
+
+ssize_t wup_sendv(int sockfd, const WupIovec* iov, int iovcnt, int flags)
+{
+    (void) flags;
+    return transferv(sockfd, iov, iovcnt, 0);
+}
+
+ssize_t wup_recvv(int sockfd, const WupIovec* iov, int iovcnt, int flags)
+{
+    (void) flags;
+    return transferv(sockfd, iov, iovcnt, 1);
+}